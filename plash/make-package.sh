@@ -120,6 +120,7 @@ if [ "$USE_PYTHON" = yes ]; then
   install_python_script plash-pkg-install
   install_python_script plash-pkg-launch
   install_python_script plash-pkg-deb-inst
+  install_python_script plash-log-decode
   dh_pysupport
 fi
 
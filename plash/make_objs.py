@@ -50,7 +50,7 @@ def run_command(args, **kwargs):
 
 def get_build_config():
     proc = subprocess.Popen(
-        ["sh", "-c", ". src/config.sh && export USE_GTK && export CC && env"],
+        ["sh", "-c", ". src/config.sh && export USE_GTK USE_PYTHON REGION_PROFILE && export CC && env"],
         stdout=subprocess.PIPE)
     stdout, stderr = proc.communicate()
     assert proc.wait() == 0, proc.wait()
@@ -62,8 +62,8 @@ def get_build_config():
 config = get_build_config()
 
 
-def get_pkg_config_args():
-    proc = subprocess.Popen("pkg-config gtk+-2.0 --cflags", shell=True,
+def get_pkg_config_args(package="gtk+-2.0"):
+    proc = subprocess.Popen("pkg-config %s --cflags" % package, shell=True,
                             stdout=subprocess.PIPE)
     stdout, stderr = proc.communicate()
     assert proc.wait() == 0, proc.wait()
@@ -195,14 +195,19 @@ def get_non_libc_targets():
         return target
 
     opts_s = c_flags + ["-DENABLE_LOGGING"]
+    # Only the server side is profiled; the copies of region.c in
+    # libc.so and ld.so are always built without this.
+    if config.get("REGION_PROFILE") == "yes":
+        opts_s.append("-DREGION_PROFILE")
     if config["USE_GTK"] == "yes":
         opts_s.append("-DPLASH_GLIB")
         opts_s.extend(get_pkg_config_args())
 
-    def build_lib(name):
-        o_file = gcc("src/%s.c" % name, "obj/%s.o" % name, opts_s)
+    def build_lib(name, extra_opts=[]):
+        o_file = gcc("src/%s.c" % name, "obj/%s.o" % name,
+                     opts_s + extra_opts)
         os_file = gcc("src/%s.c" % name, "obj/%s.os" % name,
-                      opts_s + ["-D_REENTRANT", "-fPIC"])
+                      opts_s + extra_opts + ["-D_REENTRANT", "-fPIC"])
         lib_objs_o.append(o_file.get_dest())
         lib_objs_os.append(os_file.get_dest())
 
@@ -237,6 +242,11 @@ def get_non_libc_targets():
     build_lib("shell-fds")
     build_lib("shell-wait")
 
+    # The Python module uses this and always links against Glib, even
+    # when Gtk is not being used.
+    if config["USE_PYTHON"] == "yes":
+        build_lib("fd-forward", get_pkg_config_args("glib-2.0"))
+
     if config["USE_GTK"] == "yes":
         build_lib("powerbox")
 
@@ -0,0 +1,108 @@
+# Copyright (C) 2008 Mark Seaborn
+#
+# This file is part of Plash.
+#
+# Plash is free software; you can redistribute it and/or modify it
+# under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation; either version 2.1 of
+# the License, or (at your option) any later version.
+#
+# Plash is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with Plash; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301,
+# USA.
+
+"""
+Decoder for the binary log format written by make_binary_log_from_fd().
+See src/log.h for the layout.
+"""
+
+import os
+import struct
+
+
+MAGIC = "PlashLg1"
+
+LOG_OP = 1
+LOG_MSG = 2
+LOG_BRANCH = 3
+LOG_END = 4
+
+READ_ONLY = 1
+
+# Matches struct binary_log_record.
+header_format = "=IHHIIQIHHII"
+header_size = struct.calcsize(header_format)
+
+
+class DecodeError(Exception):
+
+    pass
+
+
+def read_records(data):
+    """Yields the records in a binary log as dictionaries."""
+    if data[:len(MAGIC)] != MAGIC:
+        raise DecodeError("Not a binary Plash log")
+    pos = len(MAGIC)
+    while pos < len(data):
+        if pos + header_size > len(data):
+            raise DecodeError("Truncated record header at offset %i" % pos)
+        (size, rec_type, flags, stream_id, arg, time_us, duration_us,
+         name_size, reserved, msg_size, reply_size) = \
+            struct.unpack(header_format, data[pos:pos + header_size])
+        if (size != header_size + name_size + msg_size + reply_size or
+            pos + size > len(data)):
+            raise DecodeError("Bad record at offset %i" % pos)
+        body = pos + header_size
+        name = data[body:body + name_size]
+        body += name_size
+        msg = data[body:body + msg_size]
+        body += msg_size
+        reply = data[body:body + reply_size]
+        yield {"type": rec_type, "flags": flags, "stream_id": stream_id,
+               "arg": arg, "time_us": time_us, "duration_us": duration_us,
+               "op_name": name, "msg": msg, "reply": reply}
+        pos += size
+
+
+def format_record(rec, show_times=False):
+    """Renders a record as a line in the format of the text log."""
+    if rec["type"] == LOG_OP:
+        if rec["arg"] != 0:
+            reply = "fail: %s" % os.strerror(rec["arg"])
+        else:
+            reply = rec["reply"]
+        if len(rec["msg"]) > 0:
+            separator = ": "
+        else:
+            separator = ""
+        text = "#%i: [%s%s] %s%s%s: %s" % (
+            rec["stream_id"],
+            (rec["flags"] & READ_ONLY) and "r" or "w",
+            rec["arg"] != 0 and "!" or ".",
+            rec["op_name"], separator, rec["msg"], reply)
+    elif rec["type"] == LOG_MSG:
+        text = "#%i: %s" % (rec["stream_id"], rec["msg"])
+    elif rec["type"] == LOG_BRANCH:
+        text = "#%i branch to #%i: %s" % (rec["stream_id"], rec["arg"],
+                                          rec["msg"])
+    elif rec["type"] == LOG_END:
+        text = "#%i end" % rec["stream_id"]
+    else:
+        raise DecodeError("Unknown record type %i" % rec["type"])
+    if show_times:
+        text = "%i.%06i +%ius %s" % (rec["time_us"] // 1000000,
+                                     rec["time_us"] % 1000000,
+                                     rec["duration_us"], text)
+    return text
+
+
+def decode(data, show_times=False):
+    """Returns the lines of text for a binary log."""
+    return [format_record(rec, show_times) for rec in read_records(data)]
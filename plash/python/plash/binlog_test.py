@@ -0,0 +1,77 @@
+# Copyright (C) 2008 Mark Seaborn
+#
+# This file is part of Plash.
+#
+# Plash is free software; you can redistribute it and/or modify it
+# under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation; either version 2.1 of
+# the License, or (at your option) any later version.
+#
+# Plash is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with Plash; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301,
+# USA.
+
+import errno
+import os
+import shutil
+import tempfile
+import unittest
+
+import plash_core
+import plash.binlog
+import plash.env
+import plash.marshal
+import plash.namespace
+
+
+class BinaryLogTest(unittest.TestCase):
+
+    def setUp(self):
+        self._temp_dir = tempfile.mkdtemp(prefix="plash-test")
+
+    def tearDown(self):
+        shutil.rmtree(self._temp_dir)
+
+    def read_log(self, filename):
+        fh = open(filename, "rb")
+        try:
+            return fh.read()
+        finally:
+            fh.close()
+
+    def test_decode_matches_text_log(self):
+        filename = os.path.join(self._temp_dir, "log")
+        fd = os.open(filename, os.O_WRONLY | os.O_CREAT | os.O_TRUNC)
+        log = plash.namespace.make_binary_log_from_fd(plash_core.wrap_fd(fd))
+        fs_op = plash.namespace.make_fs_op(plash.env.get_root_dir(), log)
+        fs_op.fsop_log("hello")
+        self.assertRaises(plash.marshal.UnmarshalError,
+                          lambda: fs_op.fsop_chdir("/does/not/exist"))
+        # Records are buffered until the log is dropped.  "del" is not
+        # allowed here because fs_op is used by the lambda above.
+        fs_op = None
+        log = None
+        lines = plash.binlog.decode(self.read_log(filename))
+        self.assertEquals(
+            lines,
+            ["#1: [r.] log: hello: ?",
+             "#1: [r!] chdir: /does/not/exist: fail: %s"
+             % os.strerror(errno.ENOENT),
+             "#1 end"])
+
+    def test_bad_data(self):
+        self.assertRaises(plash.binlog.DecodeError,
+                          lambda: plash.binlog.decode("not a log"))
+        self.assertRaises(plash.binlog.DecodeError,
+                          lambda: plash.binlog.decode(plash.binlog.MAGIC
+                                                      + "\0\0\0"))
+
+
+if __name__ == "__main__":
+    unittest.main()
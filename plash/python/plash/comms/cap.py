@@ -17,10 +17,12 @@
 # Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301,
 # USA.
 
+import os
 import struct
 import weakref
 
 import plash_core
+import plash.comms.event_loop
 import plash.comms.simple
 import plash.comms.stream
 
@@ -364,7 +366,8 @@ class LocalObject(PlashObject):
         return_cont.cap_invoke(result)
 
 
-def make_connection(event_loop, socket_fd, caps_export, import_count=0):
+def make_python_connection(event_loop, socket_fd, caps_export,
+                           import_count=0):
     if len(caps_export) == 0 and import_count == 0:
         # No need to create a connection.  socket_fd will be dropped.
         return []
@@ -383,3 +386,35 @@ def make_connection(event_loop, socket_fd, caps_export, import_count=0):
     reader = plash.comms.stream.FDBufferedReader(
         event_loop, socket_fd, connection.handle_message, on_eof_or_fd_error)
     return connection.get_initial_imported_objects(import_count)
+
+
+def make_c_connection(event_loop, socket_fd, caps_export, import_count=0):
+    """Creates a connection using the C implementation of the protocol
+    in cap-protocol.c.  This registers with Glib's default main loop,
+    so it only works with GlibEventLoop.  Unlike the Python
+    implementation, it does not preserve the identity of Python
+    objects that are sent more than once."""
+    assert isinstance(event_loop, plash.comms.event_loop.GlibEventLoop)
+    if len(caps_export) == 0 and import_count == 0:
+        return []
+    sock_fd = plash_core.wrap_fd(os.dup(socket_fd.fileno()))
+    return plash_core.cap_make_connection.make_conn2(sock_fd, import_count,
+                                                     caps_export)
+
+
+def use_c_connection(event_loop):
+    return (isinstance(event_loop, plash.comms.event_loop.GlibEventLoop) and
+            os.environ.get("PLASH_PYTHON_COMMS", "") == "")
+
+
+def make_connection(event_loop, socket_fd, caps_export, import_count=0):
+    """Creates a connection on socket_fd, exporting caps_export and
+    returning import_count imported objects.  The faster C
+    implementation is used when event_loop allows it.  Setting
+    PLASH_PYTHON_COMMS in the environment selects the Python
+    implementation instead."""
+    if use_c_connection(event_loop):
+        make = make_c_connection
+    else:
+        make = make_python_connection
+    return make(event_loop, socket_fd, caps_export, import_count)
@@ -21,8 +21,8 @@ import plash_core
 import plash.comms.cap as cap
 import plash.comms.cap_test as cap_test
 import plash.comms.event_loop
+import plash.comms.simple
 import plash.comms.stream
-import plash.filedesc
 import testrunner
 
 
@@ -46,14 +46,46 @@ class CapProtocolCTests(cap_test.CapProtocolTestsMixin, testrunner.TestCase):
         return plash.comms.stream.socketpair()
 
     def make_connection(self, loop, sock_fd, export_caps, import_count=0):
-        sock_fd = plash.filedesc.dup_and_wrap_fd(sock_fd.fileno())
-        return plash_core.cap_make_connection.make_conn2(sock_fd, import_count,
-                                                         export_caps)
+        return cap.make_c_connection(loop, sock_fd, export_caps, import_count)
 
     def test_sending_references_preserves_eq(self):
-        # C implementation does not yet have this property.
+        # The C implementation has this property only for C objects.
+        # A Python object gets a new C wrapper each time it is passed.
         pass
 
+    def test_sending_c_references_preserves_eq(self):
+        loop = self.make_event_loop()
+        sock1, sock2 = self.socketpair()
+        got = self._read_to_list(loop, sock1)
+        [imported] = self.make_connection(loop, sock2, [], 1)
+        sock3, sock4 = self.socketpair()
+        got2 = self._read_to_list(loop, sock3)
+        object1, object2 = self.make_connection(loop, sock4, [], 2)
+        imported.cap_invoke(("body", (object1, object1, object2), ()))
+        loop.run_awhile()
+        decoded = [cap.decode_pocp_message(data) for data in got]
+        self.assertEquals(
+            decoded, [("invoke", cap.encode_wire_id(cap.NAMESPACE_RECEIVER, 0),
+                       [cap.encode_wire_id(cap.NAMESPACE_SENDER, 0),
+                        cap.encode_wire_id(cap.NAMESPACE_SENDER, 0),
+                        cap.encode_wire_id(cap.NAMESPACE_SENDER, 1)], "body")])
+        # The shared ID stays valid until it has been dropped twice.
+        writer = plash.comms.stream.FDBufferedWriter(loop, sock1)
+        for unused in range(2):
+            writer.write(plash.comms.simple.make_message(
+                    cap.make_invoke_message(
+                        cap.encode_wire_id(cap.NAMESPACE_RECEIVER, 0),
+                        [], "body")))
+            writer.write(plash.comms.simple.make_message(
+                    cap.make_drop_message(
+                        cap.encode_wire_id(cap.NAMESPACE_RECEIVER, 0))))
+        loop.run_awhile()
+        decoded = [cap.decode_pocp_message(data) for data in got2]
+        self.assertEquals(
+            decoded,
+            [("invoke", cap.encode_wire_id(cap.NAMESPACE_RECEIVER, 0),
+              [], "body")] * 2)
+
     def test_receiving_references_preserves_eq(self):
         # C implementation does not yet have this property.
         pass
@@ -73,3 +105,25 @@ class CapProtocolCTests(cap_test.CapProtocolTestsMixin, testrunner.TestCase):
 
     def check_object_used_up(self, obj, used_up):
         pass
+
+
+class CapProtocolCEndToEndTests(cap_test.CapProtocolEndToEndTests):
+
+    @classmethod
+    def get_method_combinations(cls):
+        # The C implementation works only with Glib's event loop.
+        for methods in super(CapProtocolCEndToEndTests,
+                             cls).get_method_combinations():
+            if "setup_glib_event_loop" in methods:
+                yield methods
+
+    def tearDown(self):
+        super(CapProtocolCEndToEndTests, self).tearDown()
+        plash_core.cap_close_all_connections()
+
+    def make_connection(self, *args, **kwargs):
+        return cap.make_c_connection(*args, **kwargs)
+
+    def test_return_continuation_dropped(self):
+        # The C implementation returns "ECon" rather than "Fail".
+        pass
@@ -24,6 +24,7 @@ import unittest
 
 from plash.comms.event_loop import poll_fd
 import plash.comms.cap as cap
+import plash.comms.event_loop
 import plash.comms.event_loop_test
 import plash.comms.simple
 import plash.comms.stream
@@ -452,19 +453,22 @@ class CapProtocolTestsMixin(object):
 class CapProtocolPythonTests(CapProtocolTestsMixin, SocketPairTestCase):
 
     def make_connection(self, *args, **kwargs):
-        return cap.make_connection(*args, **kwargs)
+        return cap.make_python_connection(*args, **kwargs)
 
 
 class CapProtocolEndToEndTests(SocketPairTestCase):
 
     # End-to-end test: makes no assumptions about the protocol's encoding.
 
+    def make_connection(self, *args, **kwargs):
+        return cap.make_python_connection(*args, **kwargs)
+
     def test_sending_and_receiving(self):
         loop = self.make_event_loop()
         sock1, sock2 = self.socketpair()
         exported_objects = [CallLogger() for i in range(10)]
-        cap.make_connection(loop, sock1, exported_objects)
-        imported_objects = cap.make_connection(loop, sock2, [], 10)
+        self.make_connection(loop, sock1, exported_objects)
+        imported_objects = self.make_connection(loop, sock2, [], 10)
         # Should work for any sequence of valid indexes
         for index in (0, 1, 1, 2):
             msg = ("some data for the body", (), ())
@@ -484,8 +488,8 @@ class CapProtocolEndToEndTests(SocketPairTestCase):
         loop = self.make_event_loop()
         loop.once = loop.once_safely # Should really apply this for all tests
         sock1, sock2 = self.socketpair()
-        cap.make_connection(loop, sock1, [Object()])
-        [imported] = cap.make_connection(loop, sock2, [], 1)
+        self.make_connection(loop, sock1, [Object()])
+        [imported] = self.make_connection(loop, sock2, [], 1)
         result = imported.cap_call(("args body", (), ()))
         self.assertEquals(calls, [("args body", (), ())])
         self.assertEquals(result, ("result body", (), ()))
@@ -512,8 +516,8 @@ class CapProtocolEndToEndTests(SocketPairTestCase):
         loop = self.make_event_loop()
         loop.once = loop.once_safely # Should really apply this for all tests
         sock1, sock2 = self.socketpair()
-        [b_imported] = cap.make_connection(loop, sock1, [a], 1)
-        [a_imported] = cap.make_connection(loop, sock2, [b], 1)
+        [b_imported] = self.make_connection(loop, sock1, [a], 1)
+        [a_imported] = self.make_connection(loop, sock2, [b], 1)
         a.other = b_imported
         b.other = a_imported
         result = a_imported.cap_call(("body", (), ()))
@@ -533,12 +537,32 @@ class CapProtocolEndToEndTests(SocketPairTestCase):
         loop = self.make_event_loop()
         loop.once = loop.once_safely # Should really apply this for all tests
         sock1, sock2 = self.socketpair()
-        cap.make_connection(loop, sock1, [Object()])
-        [imported] = cap.make_connection(loop, sock2, [], 1)
+        self.make_connection(loop, sock1, [Object()])
+        [imported] = self.make_connection(loop, sock2, [], 1)
         result = imported.cap_call(("args body", (), ()))
         self.assertEquals(calls, [("args body", (), ())])
         self.assertEquals(result, ("Fail", (), ()))
 
 
+class MakeConnectionTest(unittest.TestCase):
+
+    def test_choosing_implementation(self):
+        self.assertFalse(cap.use_c_connection(
+                plash.comms.event_loop.EventLoop()))
+        glib_loop = plash.comms.event_loop.GlibEventLoop()
+        try:
+            old_value = os.environ.pop("PLASH_PYTHON_COMMS", None)
+            try:
+                self.assertTrue(cap.use_c_connection(glib_loop))
+                os.environ["PLASH_PYTHON_COMMS"] = "1"
+                self.assertFalse(cap.use_c_connection(glib_loop))
+            finally:
+                os.environ.pop("PLASH_PYTHON_COMMS", None)
+                if old_value is not None:
+                    os.environ["PLASH_PYTHON_COMMS"] = old_value
+        finally:
+            glib_loop.destroy()
+
+
 if __name__ == "__main__":
     unittest.main()
@@ -42,22 +42,38 @@ def make_message(data):
 
 class InputBuffer(object):
 
+    # Consumed data is not removed from the front of _buf straight
+    # away, because that copies the rest of the buffer.  Instead _offset
+    # is advanced, and the consumed data is discarded on the next add().
+
     def __init__(self):
         self._buf = ""
+        self._offset = 0
         self._callback = lambda: None
 
     def connect(self, callback):
         self._callback = callback
 
     def add(self, data):
+        if self._offset > 0:
+            self._buf = self._buf[self._offset:]
+            self._offset = 0
         self._buf += data
         self._callback()
 
     def get_buffer(self):
-        return self._buf
+        return self._buf[self._offset:]
 
     def remove_bytes(self, size):
-        self._buf = self._buf[size:]
+        assert size <= len(self._buf) - self._offset
+        self._offset += size
+
+    def take_message(self):
+        result = decode_message_at(self._buf, self._offset)
+        if result is None:
+            raise IncompleteMessageException()
+        body_data, self._offset = result
+        return body_data
 
 
 def decode_message(data):
@@ -73,7 +89,33 @@ def decode_message(data):
     return (body_data, message_size)
 
 
+def decode_message_at_python(data, offset):
+    """Returns (body_data, next_offset) for the message starting at
+    offset in data, or None if the message is not complete yet."""
+    if len(data) - offset < 12:
+        return None
+    tag, size, fds_count = struct.unpack("4sii", data[offset:offset+12])
+    if tag != "MSG!" or size < 0 or fds_count < 0:
+        raise ValueError("bad message header")
+    next_offset = offset + 12 + round_up_to_word(size)
+    if len(data) < next_offset:
+        return None
+    return (data[offset+12:offset+12+size], next_offset)
+
+
+# plash_core has a C version of this, which uses the framing code
+# from comms.c.  This module does not otherwise depend on plash_core,
+# so fall back to the Python version if it is not available.
+try:
+    from plash_core import comms_decode_message as decode_message_at_c
+except ImportError:
+    decode_message_at_c = None
+
+if decode_message_at_c is not None:
+    decode_message_at = decode_message_at_c
+else:
+    decode_message_at = decode_message_at_python
+
+
 def read_message(buf):
-    body_data, message_size = decode_message(buf.get_buffer())
-    buf.remove_bytes(message_size)
-    return body_data
+    return buf.take_message()
@@ -24,6 +24,16 @@ import plash.comms.simple
 
 class SimpleProtocolEncodingTest(unittest.TestCase):
 
+    decode_message_at = staticmethod(
+        plash.comms.simple.decode_message_at_python)
+
+    def setUp(self):
+        self._old_decode = plash.comms.simple.decode_message_at
+        plash.comms.simple.decode_message_at = self.decode_message_at
+
+    def tearDown(self):
+        plash.comms.simple.decode_message_at = self._old_decode
+
     def test_padding(self):
         for i in range(20):
             self.assertEquals((i + plash.comms.simple.pad_size(i)) % 4, 0)
@@ -48,6 +58,27 @@ class SimpleProtocolEncodingTest(unittest.TestCase):
             buf.add(char)
         self.assertEquals(got, ["hello", "character at a time"])
 
+    def test_decoding_at_offset(self):
+        data = ("xx" + plash.comms.simple.make_message("first") +
+                plash.comms.simple.make_message(""))
+        self.assertEquals(self.decode_message_at(data, 2),
+                          ("first", 2 + 12 + 8))
+        self.assertEquals(self.decode_message_at(data, 22), ("", len(data)))
+        self.assertEquals(self.decode_message_at(data, len(data)), None)
+        self.assertEquals(self.decode_message_at(data[:-1], 22), None)
+        self.assertEquals(self.decode_message_at(data[:10], 2), None)
+        self.assertRaises(ValueError,
+                          lambda: self.decode_message_at(data, 0))
+
+
+class SimpleProtocolEncodingCTest(SimpleProtocolEncodingTest):
+
+    decode_message_at = staticmethod(plash.comms.simple.decode_message_at_c)
+
+
+if plash.comms.simple.decode_message_at_c is None:
+    del SimpleProtocolEncodingCTest
+
 
 if __name__ == "__main__":
     unittest.main()
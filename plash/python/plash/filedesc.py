@@ -31,7 +31,20 @@ def dup_and_wrap_fd(fd):
     return wrap_fd(os.dup(fd))
 
 
-def ForwardFD(source_fd, dest_fd, buf_size=1024):
+def ForwardFD(source_fd, dest_fd, buf_size=None):
+    """Copies data from source_fd to dest_fd, taking ownership of both.
+    This uses the C forwarder, which moves data with splice() in large
+    chunks without calling back into Python, unless PLASH_PYTHON_COMMS
+    is set.  buf_size=None uses the C forwarder's default buffer size."""
+    if "PLASH_PYTHON_COMMS" in os.environ:
+        return ForwardFDPython(source_fd, dest_fd, buf_size or 1024)
+    if buf_size is None:
+        buf_size = 0
+    return plash_core.fd_forward(wrap_fd(source_fd), wrap_fd(dest_fd),
+                                 buf_size)
+
+
+def ForwardFDPython(source_fd, dest_fd, buf_size=1024):
     # TODO: take event_loop as an argument
     event_loop = plash.mainloop.event_loop
     return plash.comms.stream.FDForwarder(event_loop, wrap_fd(source_fd),
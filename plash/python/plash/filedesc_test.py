@@ -109,11 +109,11 @@ def mainloop():
     assert not plash_core.cap_server_exporting()
     plash.mainloop.run_server()
 
-def forward(fd):
+def forward(fd, forward_fd=plash.filedesc.ForwardFD, buf_size=2):
     pipe_read, pipe_write = os.pipe()
     def process():
         os.close(pipe_read)
-        plash.filedesc.ForwardFD(fd, pipe_write, buf_size=2)
+        forward_fd(fd, pipe_write, buf_size=buf_size)
         mainloop()
         os._exit(0)
     proc = Proc(process)
@@ -193,12 +193,27 @@ class GlibPollTests(unittest.TestCase):
             os.close(pipe_read)
 
 
+def read_all(fd):
+    got = []
+    while True:
+        buf = os.read(fd, 4096)
+        if len(buf) == 0:
+            break
+        got.append(buf)
+    return "".join(got)
+
+
 class ForwardTest(unittest.TestCase):
 
+    forward_fd = staticmethod(plash.filedesc.ForwardFD)
+
+    def forward(self, fd, **kwargs):
+        return forward(fd, forward_fd=self.forward_fd, **kwargs)
+
     def test_forwarding(self):
         pids = ProcSet()
         proc1, tmp_fd = echo("hello world")
-        proc2, fd = forward(tmp_fd)
+        proc2, fd = self.forward(tmp_fd)
         for p in [proc1, proc2]:
             pids.add(p.pid)
             p.start()
@@ -219,7 +234,7 @@ class ForwardTest(unittest.TestCase):
         pipe_read, pipe_write = os.pipe()
         os.write(pipe_write, "hello world")
         os.close(pipe_write)
-        proc, fd = forward(pipe_read)
+        proc, fd = self.forward(pipe_read)
         os.close(fd)
         pids.add(proc.pid)
         proc.start()
@@ -230,7 +245,7 @@ class ForwardTest(unittest.TestCase):
         # Input pipe stays open: not closed until test is finished,
         # and there is nothing to read from it.
         pipe_read, pipe_write = os.pipe()
-        proc, fd = forward(pipe_read)
+        proc, fd = self.forward(pipe_read)
         os.close(fd)
         pids.add(proc.pid)
         proc.start()
@@ -240,15 +255,56 @@ class ForwardTest(unittest.TestCase):
     def test_forwarding_dev_null(self):
         pids = ProcSet()
         read_fd = os.open("/dev/null", os.O_RDONLY)
-        proc, fd = forward(read_fd)
+        proc, fd = self.forward(read_fd)
         os.close(fd)
         pids.add(proc.pid)
         proc.start()
         pids.wait()
 
+    def test_forwarding_large_amount(self):
+        # This is bigger than the buffer sizes of the pipes and of the
+        # forwarder, so the forwarder has to wait for the reader.
+        data = "".join(chr(i % 251) for i in xrange(1024 * 1024))
+        pids = ProcSet()
+        proc1, tmp_fd = echo(data)
+        proc2, fd = self.forward(tmp_fd, buf_size=None)
+        for p in [proc1, proc2]:
+            pids.add(p.pid)
+            p.start()
+        got = read_all(fd)
+        self.assertEquals(len(got), len(data))
+        self.assertEquals(got, data)
+        pids.wait()
+        os.close(fd)
+
+    def test_flush(self):
+        source_read, source_write = os.pipe()
+        dest_read, dest_write = os.pipe()
+        forwarder = self.forward_fd(source_read, dest_write)
+        os.write(source_write, "some data")
+        flushed = []
+        forwarder.flush(lambda: flushed.append(True))
+        while len(flushed) == 0:
+            gobject.main_context_default().iteration()
+        self.assertEquals(os.read(dest_read, 100), "some data")
+        os.close(source_write)
+        mainloop()
+        del forwarder
+        self.assertEquals(os.read(dest_read, 100), "")
+        os.close(dest_read)
+
     # TODO: check that the forwarder does not block when the pipe's
     # reader is not reading
 
 
+class ForwardPythonTest(ForwardTest):
+
+    forward_fd = staticmethod(plash.filedesc.ForwardFDPython)
+
+    def forward(self, fd, buf_size=2):
+        return forward(fd, forward_fd=self.forward_fd,
+                       buf_size=buf_size or 1024)
+
+
 if __name__ == "__main__":
     unittest.main()
@@ -61,5 +61,5 @@ def run_server():
     exporting any object references.
     """
     while (plash_core.cap_server_exporting() or _reasons_count > 0 or
-           event_loop.is_listening()):
+           event_loop.is_listening() or plash_core.fd_forwarding()):
         gobject.main_context_default().iteration()
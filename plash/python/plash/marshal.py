@@ -280,6 +280,35 @@ class M_r_fsop_exec:
     def unpack_r(self, args):
         return self.unpack_a(args)
 
+class M_fsop_exec_preload:
+
+    def pack_a(self, filename, lib_path, cmd_args):
+        ref, args2 = tree_pack(cmd_args)
+        return format_pack(methods_by_name["fsop_exec_preload"]["code"],
+                           "ssi*", filename, lib_path, ref, args2)
+
+    def unpack_a(self, args):
+        (filename, lib_path, ref, args2) = format_unpack('ssi*', args)
+        return (filename, lib_path, tree_unpack(ref, args2))
+
+    def unpack_r(self, a):
+        return self.unpack_a(a)
+
+class M_r_fsop_exec_preload:
+
+    def pack_a(self, filename, argv, fds, lib_pathnames, lib_fds):
+        ref, args = tree_pack((argv, fds, lib_pathnames, lib_fds))
+        return format_pack(methods_by_name["r_fsop_exec_preload"]["code"],
+                           "si*", filename, ref, args)
+
+    def unpack_a(self, args):
+        filename, ref, args2 = format_unpack("si*", args)
+        argv, fds, lib_pathnames, lib_fds = tree_unpack(ref, args2)
+        return filename, argv, fds, lib_pathnames, lib_fds
+
+    def unpack_r(self, args):
+        return self.unpack_a(args)
+
 class M_misc:
 
     def unpack_r(self, args):
@@ -307,6 +336,8 @@ add_format('fsop_get_dir', 'S')
 add_format('fsop_get_root_dir', '')
 add_format('fsop_get_obj', 'S')
 add_format('fsop_log', 'S')
+add_format('fsop_stats', '')
+add_format('r_fsop_stats', 'S')
 
 # These correspond to Unix system calls:
 add_format('fsop_open', 'diiS')
@@ -337,6 +368,8 @@ add_format('fsop_connect', 'fS')
 add_format('fsop_bind', 'fS')
 add_format('fsop_exec', M_fsop_exec())
 add_format('r_fsop_exec', M_r_fsop_exec())
+add_format('fsop_exec_preload', M_fsop_exec_preload())
+add_format('r_fsop_exec_preload', M_r_fsop_exec_preload())
 
 # Common response messages
 add_format('okay', '')
@@ -345,6 +378,8 @@ add_format('r_cap', 'c')
 
 add_format('r_fsop_open', 'f')
 add_format('r_fsop_open_dir', 'fc')
+add_format('r_fsop_open_dir_nofd', 'c')
+add_format('r_fsop_open_dir_kernel', 'fc')
 
 # Files, directories and symlinks
 OBJT_FILE = 1
@@ -369,6 +404,8 @@ add_format('dir_list', '')
 add_format('r_dir_list', M_r_dir_list())
 add_format('dir_create_file', 'iiS')
 add_format('r_dir_create_file', 'f')
+add_format('dir_open_or_create', 'iiS')
+add_format('r_dir_open_or_create', 'f')
 add_format('dir_mkdir', 'iS')
 add_format('dir_symlink', 'sS')
 add_format('dir_rename', 'scS')
@@ -510,6 +547,8 @@ TAG_STRING = 1
 TAG_ARRAY = 2
 TAG_CAP = 3
 TAG_FD = 4
+TAG_STR_ARRAY = 5
+TAG_FD_MAP = 6
 
 
 class TreePacker(object):
@@ -583,6 +622,20 @@ def tree_unpack(ref, args):
         return caps[addr]
     elif type == TAG_FD:
         return fds[addr]
+    elif type == TAG_STR_ARRAY:
+        # Offset table followed by NUL-terminated strings
+        size = get_int(data, addr)
+        offsets = [get_int(data, addr + int_size * (i+1))
+                   for i in range(size + 1)]
+        start = addr + int_size * (size + 2)
+        return [data[start+offsets[i]:start+offsets[i+1]-1]
+                for i in range(size)]
+    elif type == TAG_FD_MAP:
+        # Table of FD numbers; the FDs are consecutive in the FD list
+        size = get_int(data, addr)
+        first_fd = get_int(data, addr + int_size)
+        return [[get_int(data, addr + int_size * (i+2)), fds[first_fd + i]]
+                for i in range(size)]
     else:
         raise UnpackError("Bad type code in reference: %i" % type)
 
@@ -678,6 +731,7 @@ add_method('fsop_copy', 'r_cap')
 add_method('fsop_get_root_dir', 'r_cap')
 #add_method('fsop_get_obj', ...)
 add_method('fsop_log', 'okay')
+add_method('fsop_stats', 'r_fsop_stats')
 
 #add_method('fsop_open', ...)
 add_method('fsop_stat', 'r_fsop_stat')
@@ -700,6 +754,7 @@ add_method('fsop_rmdir', 'okay')
 add_method('fsop_connect', 'okay')
 add_method('fsop_bind', 'okay')
 add_method('fsop_exec', 'r_fsop_exec')
+add_method('fsop_exec_preload', 'r_fsop_exec_preload')
 
 add_method('fsobj_type', 'r_fsobj_type')
 add_method('fsobj_stat', 'r_fsobj_stat')
@@ -712,6 +767,7 @@ add_method('file_socket_connect', 'okay')
 add_method('dir_traverse', 'r_dir_traverse')
 add_method('dir_list', 'r_dir_list')
 add_method('dir_create_file', 'r_dir_create_file')
+add_method('dir_open_or_create', 'r_dir_open_or_create')
 add_method('dir_mkdir', 'okay')
 add_method('dir_symlink', 'okay')
 add_method('dir_rename', 'okay')
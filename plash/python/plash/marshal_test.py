@@ -18,6 +18,7 @@
 # USA.
 
 import os
+import struct
 import unittest
 
 import plash.filedesc
@@ -61,6 +62,23 @@ class MarshalTest(unittest.TestCase):
         output = marshal.tree_unpack(ref, args_tuple)
         self.assertEquals(output, input)
 
+    def test_compact_tree_encoding(self):
+        # String arrays and FD maps, as packed by argmk_str_array()
+        # and argmk_fd_map() in C
+        fd1 = example_fd()
+        fd2 = example_fd()
+        blob = "foo\0barbaz\0"
+        data = (struct.pack("iiii", 2, 0, 4, len(blob)) + blob +
+                struct.pack("iiii", 2, 0, 10, 20))
+        args = (data, (), (fd1, fd2))
+        self.assertEquals(
+            marshal.tree_unpack(0 << 3 | marshal.TAG_STR_ARRAY, args),
+            ["foo", "barbaz"])
+        self.assertEquals(
+            marshal.tree_unpack((16 + len(blob)) << 3 | marshal.TAG_FD_MAP,
+                                args),
+            [[10, fd1], [20, fd2]])
+
 
 if __name__ == "__main__":
     unittest.main()
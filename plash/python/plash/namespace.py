@@ -55,6 +55,7 @@ m.add_format('make_read_only_proxy', 'c')
 m.add_format('dirstack_get_path', 'c')
 m.add_format('r_dirstack_get_path', 'S')
 m.add_format('make_log_from_fd', 'f')
+m.add_format('make_binary_log_from_fd', 'f')
 
 
 conn_maker = plash_core.make_conn_maker()
@@ -134,6 +135,10 @@ def make_log_from_fd(fd):
     return call(plash_core.make_log_from_fd, 'r_cap',
                 'make_log_from_fd', fd)
 
+def make_binary_log_from_fd(fd):
+    return call(plash_core.make_binary_log_from_fd, 'r_cap',
+                'make_binary_log_from_fd', fd)
+
 def dirstack_get_path(obj):
     return call(plash_core.dirstack_get_path, 'r_dirstack_get_path',
                 'dirstack_get_path', obj)
@@ -145,6 +145,7 @@ class ProcessSetup(object):
             "tmpdir": OptionWithSingleArg(self.grant_tmp_dir),
             "log": OptionNoTrailing(self.enable_logging),
             "log-file": OptionWithSingleArg(self.log_to_file),
+            "log-binary-file": OptionWithSingleArg(self.log_to_binary_file),
             "debug": OptionNoTrailing(self.debug),
             "pet-name": OptionWithSingleArg(self.set_pet_name),
             "powerbox": OptionNoTrailing(self.enable_powerbox),
@@ -309,6 +310,11 @@ class ProcessSetup(object):
             os.open(log_filename, os.O_WRONLY | os.O_CREAT | os.O_TRUNC))
         self.proc.logger = ns.make_log_from_fd(fd)
 
+    def log_to_binary_file(self, log_filename):
+        fd = plash_core.wrap_fd(
+            os.open(log_filename, os.O_WRONLY | os.O_CREAT | os.O_TRUNC))
+        self.proc.logger = ns.make_binary_log_from_fd(fd)
+
     def debug(self, args):
         raise BadArgException, "not implemented"
 
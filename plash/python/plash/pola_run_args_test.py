@@ -289,6 +289,11 @@ class TestEnvironment(unittest.TestCase):
         setup = pola_run_args.ProcessSetup(proc)
         setup.handle_args(["--log-file=%s" % self.make_temp_file("")])
 
+    def test_option_log_binary_file(self):
+        proc = plash.process.ProcessSpecWithNamespace()
+        setup = pola_run_args.ProcessSetup(proc)
+        setup.handle_args(["--log-binary-file=%s" % self.make_temp_file("")])
+
     def test_option_powerbox(self):
         proc = plash.process.ProcessSpecWithNamespace()
         setup = pola_run_args.ProcessSetup(proc)
@@ -18,22 +18,31 @@
 # USA.
 
 """
-Usage: plash-pkg-fetch <package-list-file>
+Usage: plash-pkg-fetch [-j N] <package-list-file>
 
 Takes a package list and ensures that the .debs it lists are locally
-available by downloading them.
+available by downloading them.  Up to N packages are downloaded at a
+time (default 4).
 """
 
+import getopt
 import os
+import Queue
 import re
+import shutil
 import subprocess
 import sys
+import threading
+import urllib
 
 import plash_pkg.config
 import plash_pkg.control
 import plash_pkg.utils
 
 
+default_jobs = 4
+
+
 def deb_filename(pkg):
     return "%(package)s_%(version)s_%(architecture)s_%(sha1)s.deb" % pkg
 
@@ -62,18 +71,106 @@ class PackageToDownload(object):
     def get_size(self):
         return int(self.pkg["size"])
 
-    def download(self):
-        print "getting %s %s" % (self.pkg["package"],
-                                 self.pkg["version"])
-        rc = subprocess.call(["curl", self.url, "-o", self.local_file])
-        assert rc == 0
-
-
-def main(args):
-    if len(args) != 1:
-        print __doc__
-        return 1
-    package_list = args[0]
+    def download(self, quiet=False):
+        # Download to a temporary name so that the cache never contains
+        # a partial .deb, even if we are interrupted.
+        temp_file = "%s.%i.tmp" % (self.local_file, os.getpid())
+        try:
+            if self.url.startswith("file://"):
+                # No need to start a process for copying from a local
+                # mirror.
+                shutil.copyfile(urllib.url2pathname(self.url[len("file://"):]),
+                                temp_file)
+            else:
+                # Without -f, curl saves an HTTP error page as the
+                # .deb and exits successfully.
+                args = ["curl", "-f", self.url, "-o", temp_file]
+                if quiet:
+                    # Progress meters are unreadable when several
+                    # downloads run at once.
+                    args.append("-sS")
+                rc = subprocess.call(args)
+                if rc != 0:
+                    raise Exception("curl failed with code %i: %s"
+                                    % (rc, self.url))
+            os.rename(temp_file, self.local_file)
+        except:
+            if os.path.exists(temp_file):
+                os.unlink(temp_file)
+            raise
+        self.done = True
+
+
+def download_concurrently(packages, jobs=default_jobs):
+    """Downloads the packages that are not present already, running up
+    to `jobs' downloads at a time.  This is a generator which yields
+    each package as soon as it is available locally, starting with
+    those that were present already, so that the caller can start
+    using a package while others are still downloading."""
+    to_get = []
+    for pkg in packages:
+        if pkg.done:
+            yield pkg
+        else:
+            to_get.append(pkg)
+    if len(to_get) == 0:
+        return
+
+    work = Queue.Queue()
+    results = Queue.Queue()
+    for pkg in to_get:
+        work.put(pkg)
+
+    def worker():
+        while True:
+            try:
+                pkg = work.get_nowait()
+            except Queue.Empty:
+                return
+            try:
+                pkg.download(quiet=True)
+            except Exception:
+                results.put((pkg, sys.exc_info()))
+            else:
+                results.put((pkg, None))
+
+    threads = [threading.Thread(target=worker)
+               for i in range(min(jobs, len(to_get)))]
+    for thread in threads:
+        thread.setDaemon(True)
+        thread.start()
+    try:
+        for i in range(len(to_get)):
+            # A get() without a timeout cannot be interrupted by
+            # Ctrl-C, so poll instead.
+            while True:
+                try:
+                    pkg, exc_info = results.get(timeout=0.5)
+                    break
+                except Queue.Empty:
+                    pass
+            if exc_info is not None:
+                raise exc_info[0], exc_info[1], exc_info[2]
+            # Print from this thread so that the messages from
+            # different downloads are not interleaved.
+            print "got %s %s" % (pkg.pkg["package"], pkg.pkg["version"])
+            yield pkg
+    finally:
+        # If we are stopping early because of an error, don't start
+        # any more downloads, but let those in progress finish so that
+        # they do not carry on in the background.
+        while True:
+            try:
+                work.get_nowait()
+            except Queue.Empty:
+                break
+        for thread in threads:
+            thread.join()
+
+
+def read_package_list(package_list):
+    """Returns the packages in the list that need to be fetched as
+    .debs."""
     packages = []
     fh = open(package_list, "r")
     try:
@@ -83,7 +180,12 @@ def main(args):
                 packages.append(PackageToDownload(fields))
     finally:
         fh.close()
+    return packages
 
+
+def confirm_download(packages):
+    """Lists the packages that need downloading and asks the user
+    whether to go ahead.  Returns whether to carry on."""
     total_size = 0
     remaining_size = 0
     to_get = 0
@@ -104,10 +206,29 @@ def main(args):
         print "download? [Yn] ",
         reply = sys.stdin.readline().rstrip()
         if not re.match("y?$", reply, re.I):
-            sys.exit(1)
-        for pkg in packages:
-            if not pkg.done:
-                pkg.download()
+            return False
+    return True
+
+
+def main(args):
+    try:
+        options, args = getopt.getopt(args, "j:", ["jobs="])
+    except getopt.GetoptError:
+        print __doc__
+        return 1
+    jobs = default_jobs
+    for opt, value in options:
+        if opt in ("-j", "--jobs"):
+            jobs = int(value)
+    if len(args) != 1:
+        print __doc__
+        return 1
+    packages = read_package_list(args[0])
+    if not confirm_download(packages):
+        return 1
+    for pkg in download_concurrently(packages, jobs):
+        pass
+    return 0
 
 
 if __name__ == "__main__":
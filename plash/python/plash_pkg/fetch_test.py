@@ -0,0 +1,131 @@
+# Copyright (C) 2008 Mark Seaborn
+#
+# This file is part of Plash.
+#
+# Plash is free software; you can redistribute it and/or modify it
+# under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation; either version 2.1 of
+# the License, or (at your option) any later version.
+#
+# Plash is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with Plash; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301,
+# USA.
+
+import os
+import shutil
+import tempfile
+import unittest
+
+import plash_pkg.config
+import plash_pkg.fetch
+import plash_pkg.unpack
+import plash_pkg.utils
+
+
+class TempCacheTestCase(unittest.TestCase):
+
+    def setUp(self):
+        self._temp_dir = tempfile.mkdtemp(prefix="plash-pkg-test")
+        self._old_cache_dir = os.environ.get("PLASH_PKG_CACHE_DIR")
+        os.environ["PLASH_PKG_CACHE_DIR"] = os.path.join(self._temp_dir,
+                                                         "cache")
+        os.mkdir(os.environ["PLASH_PKG_CACHE_DIR"])
+        self.mirror_dir = os.path.join(self._temp_dir, "mirror")
+        os.mkdir(self.mirror_dir)
+
+    def tearDown(self):
+        if self._old_cache_dir is None:
+            del os.environ["PLASH_PKG_CACHE_DIR"]
+        else:
+            os.environ["PLASH_PKG_CACHE_DIR"] = self._old_cache_dir
+        shutil.rmtree(self._temp_dir)
+
+    def make_pkg(self, name, data):
+        filename = "%s.deb" % name
+        plash_pkg.utils.write_file(os.path.join(self.mirror_dir, filename),
+                                   data)
+        return {"package": name, "version": "1.0", "architecture": "i386",
+                "sha1": plash_pkg.unpack.sha_of_file(
+                    os.path.join(self.mirror_dir, filename)).hexdigest(),
+                "size": str(len(data)),
+                "base-url": "file://%s" % self.mirror_dir,
+                "filename": filename}
+
+
+class DownloadTest(TempCacheTestCase):
+
+    def test_download_concurrently(self):
+        pkgs = [self.make_pkg("pkg%i" % i, "contents %i" % i)
+                for i in range(10)]
+        downloads = [plash_pkg.fetch.PackageToDownload(pkg) for pkg in pkgs]
+        got = list(plash_pkg.fetch.download_concurrently(downloads, jobs=3))
+        self.assertEquals(len(got), len(downloads))
+        self.assertEquals(set(got), set(downloads))
+        for pkg in pkgs:
+            deb_file = plash_pkg.unpack.DebCache().get_deb(pkg)
+            self.assertEquals(plash_pkg.utils.read_file(deb_file),
+                              "contents %s" % pkg["package"][3:])
+        # Everything is present now, so nothing needs downloading.
+        for pkg in pkgs:
+            self.assertTrue(plash_pkg.fetch.PackageToDownload(pkg).done)
+
+    def test_download_failure(self):
+        pkgs = [self.make_pkg("pkg%i" % i, "contents") for i in range(4)]
+        os.unlink(os.path.join(self.mirror_dir, pkgs[2]["filename"]))
+        downloads = [plash_pkg.fetch.PackageToDownload(pkg) for pkg in pkgs]
+        self.assertRaises(IOError, lambda: list(
+                plash_pkg.fetch.download_concurrently(downloads, jobs=2)))
+        # No partial files are left in the cache.
+        self.assertFalse(os.path.exists(downloads[2].local_file))
+        for leaf in os.listdir(plash_pkg.config.get_deb_cache_dir()):
+            self.assertTrue(leaf.endswith(".deb"), leaf)
+
+
+class ShareFilesTest(TempCacheTestCase):
+
+    def make_tree(self, name, files):
+        dir_path = os.path.join(self._temp_dir, name)
+        os.mkdir(dir_path)
+        for filename, data, mode in files:
+            plash_pkg.utils.write_file(os.path.join(dir_path, filename),
+                                       data)
+            os.chmod(os.path.join(dir_path, filename), mode)
+        return dir_path
+
+    def test_share_files(self):
+        file_cache = plash_pkg.unpack.FileCache()
+        dir1 = self.make_tree("tree1", [("a", "shared", 0644),
+                                        ("b", "only in tree1", 0644),
+                                        ("empty", "", 0644)])
+        dir2 = self.make_tree("tree2", [("a2", "shared", 0644),
+                                        ("c", "shared", 0755),
+                                        ("empty", "", 0644)])
+        plash_pkg.unpack.share_files(file_cache, dir1)
+        plash_pkg.unpack.share_files(file_cache, dir2)
+
+        def inode(path):
+            return os.stat(path).st_ino
+
+        self.assertEquals(inode(os.path.join(dir1, "a")),
+                          inode(os.path.join(dir2, "a2")))
+        # Files with different permissions can't share an inode.
+        self.assertNotEquals(inode(os.path.join(dir1, "a")),
+                             inode(os.path.join(dir2, "c")))
+        self.assertNotEquals(inode(os.path.join(dir1, "empty")),
+                             inode(os.path.join(dir2, "empty")))
+        self.assertEquals(plash_pkg.utils.read_file(os.path.join(dir2, "c")),
+                          "shared")
+        self.assertEquals(os.stat(os.path.join(dir2, "c")).st_mode & 0777,
+                          0755)
+        self.assertEquals(len(os.listdir(
+                    plash_pkg.config.get_file_cache_dir())), 2)
+
+
+if __name__ == "__main__":
+    unittest.main()
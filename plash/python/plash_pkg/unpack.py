@@ -18,16 +18,22 @@
 # USA.
 
 """
-Usage: plash-pkg-unpack <package-list> <dest-dir>
+Usage: plash-pkg-unpack [--fetch [-j N]] <package-list> <dest-dir>
 
 Unpacks the packages listed in <package-list> into <dest-dir>.
 Re-uses/shares file inodes by hard linking them from a cache
 directory.
+
+With --fetch, first downloads any .debs that are not present, N at a
+time (default 4), unpacking each into the cache as soon as it arrives.
 """
 
+import errno
+import getopt
 import os
 import sha
 import shutil
+import stat
 import subprocess
 
 import plash.env
@@ -85,10 +91,12 @@ class DebCache(object):
 
 
 class UnpackCache(object):
-    """Cache of unpacked package trees."""
+    """Cache of unpacked package trees.  If a file cache is given,
+    files in the trees are shared with it (see share_files())."""
 
-    def __init__(self, deb_cache):
+    def __init__(self, deb_cache, file_cache=None):
         self._deb_cache = deb_cache
+        self._file_cache = file_cache
         self._cache_dir = plash_pkg.config.get_unpack_cache_dir()
 
     def _unpack_deb(self, pkg, dest_dir):
@@ -112,6 +120,9 @@ class UnpackCache(object):
             os.mkdir(temp_dir)
             try:
                 self._unpack_deb(pkg, temp_dir)
+                if self._file_cache is not None:
+                    share_files(self._file_cache,
+                                os.path.join(temp_dir, "data"))
             except:
                 shutil.rmtree(temp_dir, ignore_errors=True)
                 raise
@@ -135,6 +146,42 @@ class FileCache(object):
         return os.path.join(self._cache_dir, file_hash)
 
 
+def share_files(file_cache, dir_path):
+    """Replaces the files in dir_path with hard links to files in the
+    file cache that have the same contents, so that a file that
+    appears in many packages is only stored once.  Files that are not
+    in the cache already are added to it.  Empty files are left alone,
+    since there would be nothing to save, and sharing them could run
+    into the filesystem's limit on the number of links to an inode."""
+    for dir_name, subdir_names, leaf_names in os.walk(dir_path):
+        for leaf in leaf_names:
+            filename = os.path.join(dir_name, leaf)
+            st = os.lstat(filename)
+            if (not stat.S_ISREG(st.st_mode) or st.st_size == 0 or
+                not st.st_mode & stat.S_IRUSR):
+                continue
+            cached = file_cache.get_file_by_hash(
+                sha_of_file(filename).hexdigest())
+            try:
+                os.link(filename, cached)
+            except OSError, exn:
+                if exn.errno != errno.EEXIST:
+                    raise
+                # Hard links share permissions, so we can only share
+                # with a cached copy that has the same mode.
+                cached_st = os.lstat(cached)
+                if (cached_st.st_ino != st.st_ino and
+                    cached_st.st_mode == st.st_mode):
+                    temp_file = "%s.tmp-link" % filename
+                    try:
+                        os.link(cached, temp_file)
+                    except OSError, exn:
+                        if exn.errno != errno.EMLINK:
+                            raise
+                    else:
+                        os.rename(temp_file, filename)
+
+
 def unpack_file_list(file_cache, dest_dir, ref):
     fh = open(file_cache.get_file_by_hash(ref), "r")
     for line in fh:
@@ -215,7 +262,30 @@ def fill_out_dpkg_state(unpack_cache, dest_dir, packages):
     fill_out_dpkg_lists(unpack_cache, dpkg_dir, packages)
 
 
+def fetch_and_unpack(unpack_cache, package_list, jobs):
+    """Downloads any missing .debs and unpacks each into the cache as
+    soon as it arrives, while the other downloads carry on."""
+    to_download = plash_pkg.fetch.read_package_list(package_list)
+    if not plash_pkg.fetch.confirm_download(to_download):
+        return False
+    for download in plash_pkg.fetch.download_concurrently(to_download, jobs):
+        unpack_cache.get_unpacked(download.pkg)
+    return True
+
+
 def main(args):
+    try:
+        options, args = getopt.getopt(args, "j:", ["fetch", "jobs="])
+    except getopt.GetoptError:
+        print __doc__
+        return 1
+    fetch = False
+    jobs = plash_pkg.fetch.default_jobs
+    for opt, value in options:
+        if opt == "--fetch":
+            fetch = True
+        elif opt in ("-j", "--jobs"):
+            jobs = int(value)
     if len(args) != 2:
         print __doc__
         return 1
@@ -223,7 +293,9 @@ def main(args):
     dest_dir = args[1]
     deb_cache = DebCache()
     file_cache = FileCache()
-    unpack_cache = UnpackCache(deb_cache)
+    unpack_cache = UnpackCache(deb_cache, file_cache)
+    if fetch and not fetch_and_unpack(unpack_cache, package_list, jobs):
+        return 1
     packages = read_control_file(package_list)
     os.mkdir(dest_dir)
     for pkg in packages:
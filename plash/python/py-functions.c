@@ -31,6 +31,7 @@
 #include "filesysobj-cow.h"
 #include "filesysobj-readonly.h"
 #include "cap-protocol.h"
+#include "comms.h"
 #include "fs-operations.h"
 #include "marshal.h"
 #include "marshal-pack.h"
@@ -81,6 +82,36 @@ static PyObject *plpy_cap_close_all_connections(PyObject *self, PyObject *args)
   return Py_None;
 }
 
+/* Framing for plash.comms.simple, using the same code as the C
+   implementation of the protocol.  Returns (data, next_offset) for
+   the message starting at `offset', or None if the message is not
+   complete yet. */
+static PyObject *plpy_comms_decode_message(PyObject *self, PyObject *args)
+{
+  const char *data;
+  int data_size, offset, size, fds_count, msg_size;
+  seqf_t block;
+  if(!PyArg_ParseTuple(args, "s#i", &data, &data_size, &offset))
+    return NULL;
+  if(offset < 0 || offset > data_size) {
+    PyErr_SetString(PyExc_ValueError, "offset out of range");
+    return NULL;
+  }
+  block.data = data + offset;
+  block.size = data_size - offset;
+  msg_size = comm_message_size(block, &size, &fds_count);
+  if(msg_size < 0) {
+    PyErr_SetString(PyExc_ValueError, "bad message header");
+    return NULL;
+  }
+  if(msg_size == 0 || msg_size > block.size) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+  return Py_BuildValue("(s#i)", block.data + COMM_HEADER_SIZE, size,
+		       offset + msg_size);
+}
+
 static PyObject *plpy_libc_reset_connection(PyObject *self, PyObject *args)
 {
   __typeof__(plash_libc_reset_connection) *reset_connection =
@@ -441,6 +472,22 @@ plpy_make_log_from_fd(cap_t obj1, region_t r, struct cap_args args,
   }
 }
 
+static void
+plpy_make_binary_log_from_fd(cap_t obj1, region_t r, struct cap_args args,
+			     struct cap_args *result)
+{
+  int fd;
+  if(pl_unpack(r, args, METHOD_MAKE_BINARY_LOG_FROM_FD, "f", &fd)) {
+    cap_t log_obj = make_binary_log_from_fd(fd);
+    plpy_close(fd);
+    *result = pl_pack(r, METHOD_R_CAP, "c", log_obj);
+  }
+  else {
+    *result = pl_pack(r, METHOD_FAIL_UNKNOWN_METHOD, "");
+    pl_args_free(&args);
+  }
+}
+
 static void
 plpy_dirstack_get_path(cap_t obj1, region_t r, struct cap_args args,
 		       struct cap_args *result)
@@ -481,6 +528,13 @@ cap_t wrap_function(void (*fun)(cap_t obj, region_t r, struct cap_args args,
 static PyMethodDef module_methods[] = {
   { "wrap_fd", plpy_wrap_fd_py, METH_VARARGS,
     "Create a Plash/Python FD object given an FD number." },
+  { "fd_forward", plpy_fd_forward, METH_VARARGS,
+    "Start copying data from one FD to another in the Glib event loop.\n"
+    "Takes source and destination FD objects and an optional buffer\n"
+    "size.  Returns an FDForwarder object." },
+  { "fd_forwarding", plpy_fd_forwarding, METH_NOARGS,
+    "Returns whether any FD forwarders are still running.  This is used\n"
+    "for determining whether the process can exit." },
 
   { "initial_dir", plpy_initial_dir, METH_VARARGS,
     "Get an initial real_dir object." },
@@ -500,6 +554,10 @@ static PyMethodDef module_methods[] = {
     "both processes will try to use the connection (if only to drop object\n"
     "references), likely leading to a protocol violation." },
 
+  { "comms_decode_message", plpy_comms_decode_message, METH_VARARGS,
+    "Decodes the message at the given offset in a string.  Returns\n"
+    "(data, next_offset), or None if the message is incomplete." },
+
   { "kernel_execve", plpy_libc_kernel_execve, METH_VARARGS,
     "Calls the kernel's execve() system call, avoiding interception by\n"
     "Plash's libc." },
@@ -522,6 +580,7 @@ void initplash_core(void)
 
   if(PyType_Ready(&plpy_fd_type) < 0) { return; }
   if(PyType_Ready(&plpy_obj_type) < 0) { return; }
+  if(PyType_Ready(&plpy_forwarder_type) < 0) { return; }
 
   plpy_init();
 
@@ -532,6 +591,8 @@ void initplash_core(void)
   PyModule_AddObject(mod, "FD", (PyObject *) &plpy_fd_type);
   Py_INCREF(&plpy_obj_type);
   PyModule_AddObject(mod, "Plash", (PyObject *) &plpy_obj_type);
+  Py_INCREF(&plpy_forwarder_type);
+  PyModule_AddObject(mod, "FDForwarder", (PyObject *) &plpy_forwarder_type);
 
   Py_INCREF(plpy_wrapper_class);
   PyModule_AddObject(mod, "Wrapper", (PyObject *) plpy_wrapper_class);
@@ -555,6 +616,7 @@ void initplash_core(void)
   ADD_FUNCTION("make_cow_dir", plpy_make_cow_dir);
   ADD_FUNCTION("make_read_only_proxy", plpy_make_read_only_proxy);
   ADD_FUNCTION("make_log_from_fd", plpy_make_log_from_fd);
+  ADD_FUNCTION("make_binary_log_from_fd", plpy_make_binary_log_from_fd);
   ADD_FUNCTION("cap_make_connection", plpy_make_conn2);
   ADD_FUNCTION("dirstack_get_path", plpy_dirstack_get_path);
 }
@@ -33,6 +33,13 @@ typedef struct {
   cap_t obj;
 } plpy_obj;
 
+struct fd_forwarder;
+
+typedef struct {
+  PyObject_HEAD;
+  struct fd_forwarder *fwd;
+} plpy_forwarder;
+
 struct plpy_pyobj {
   struct filesys_obj hdr;
   PyObject *obj;
@@ -40,6 +47,7 @@ struct plpy_pyobj {
 
 extern PyTypeObject plpy_fd_type;
 extern PyTypeObject plpy_obj_type;
+extern PyTypeObject plpy_forwarder_type;
 
 extern PyTypeObject *plpy_wrapper_class;
 extern PyTypeObject *plpy_pyobj_class;
@@ -64,6 +72,8 @@ void plpy_init(void);
 
 
 PyObject *plpy_wrap_fd_py(PyObject *self, PyObject *args);
+PyObject *plpy_fd_forward(PyObject *self, PyObject *args);
+PyObject *plpy_fd_forwarding(PyObject *self, PyObject *args);
 
 
 #endif
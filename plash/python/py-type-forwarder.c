@@ -0,0 +1,165 @@
+/* Copyright (C) 2008 Mark Seaborn
+
+   This file is part of Plash.
+
+   Plash is free software; you can redistribute it and/or modify it
+   under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 2.1 of
+   the License, or (at your option) any later version.
+
+   Plash is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with Plash; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301,
+   USA.  */
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <Python.h>
+
+#include "fd-forward.h"
+
+#include "py-plash.h"
+
+
+/* Wrapper for the C FD forwarder.  Forwarding carries on after the
+   wrapper is freed, as with FDForwarder in plash/comms/stream.py,
+   which is kept alive by the event loop. */
+
+
+PyObject *plpy_fd_forward(PyObject *self, PyObject *args)
+{
+  plpy_fd *source, *dest;
+  int buf_size = 0;
+  int source_fd, dest_fd, err;
+  struct fd_forwarder *fwd;
+  plpy_forwarder *wrapper;
+
+  if(!PyArg_ParseTuple(args, "O!O!|i",
+		       &plpy_fd_type, &source, &plpy_fd_type, &dest,
+		       &buf_size)) {
+    return NULL;
+  }
+  wrapper = (plpy_forwarder *)
+    plpy_forwarder_type.tp_alloc(&plpy_forwarder_type, 0);
+  if(!wrapper) {
+    return NULL;
+  }
+  /* The forwarder takes ownership of the FDs it is given. */
+  source_fd = dup(source->fd);
+  if(source_fd < 0) {
+    Py_DECREF(wrapper);
+    return PyErr_SetFromErrno(PyExc_OSError);
+  }
+  dest_fd = dup(dest->fd);
+  if(dest_fd < 0) {
+    plpy_close(source_fd);
+    Py_DECREF(wrapper);
+    return PyErr_SetFromErrno(PyExc_OSError);
+  }
+  fwd = fd_forward_make(source_fd, dest_fd, buf_size, &err);
+  if(!fwd) {
+    Py_DECREF(wrapper);
+    errno = err;
+    return PyErr_SetFromErrno(PyExc_OSError);
+  }
+  wrapper->fwd = fwd;
+  return (PyObject *) wrapper;
+}
+
+PyObject *plpy_fd_forwarding(PyObject *self, PyObject *args)
+{
+  return PyBool_FromLong(fd_forward_active_count() > 0);
+}
+
+
+static void plpy_forwarder_dealloc(plpy_forwarder *self)
+{
+  if(self->fwd) {
+    fd_forward_free(self->fwd);
+  }
+  self->ob_type->tp_free((PyObject *) self);
+}
+
+static void flush_callback(void *x)
+{
+  PyObject *callback = x;
+  PyObject *result = PyObject_CallObject(callback, NULL);
+  if(result) {
+    Py_DECREF(result);
+  }
+  else {
+    /* There is no caller to pass the exception to. */
+    PyErr_Print();
+  }
+  Py_DECREF(callback);
+}
+
+/* flush method: calls the callback once the data that is currently
+   available from the source has been written. */
+static PyObject *plpy_forwarder_flush(plpy_forwarder *self, PyObject *args)
+{
+  PyObject *callback;
+  if(!PyArg_ParseTuple(args, "O", &callback)) {
+    return NULL;
+  }
+  Py_INCREF(callback);
+  fd_forward_flush(self->fwd, flush_callback, callback);
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyMethodDef plpy_forwarder_object_methods[] = {
+  { "flush", (PyCFunction) plpy_forwarder_flush, METH_VARARGS,
+    "Calls the given function once pending data has been written."
+  },
+  {NULL}  /* Sentinel */
+};
+
+
+PyTypeObject plpy_forwarder_type = {
+  PyObject_HEAD_INIT(NULL)
+  0,                         /* ob_size */
+  "plash_core.FDForwarder",  /* tp_name */
+  sizeof(plpy_forwarder),    /* tp_basicsize */
+  0,                         /* tp_itemsize */
+  (destructor) plpy_forwarder_dealloc, /* tp_dealloc */
+  0,                         /* tp_print */
+  0,                         /* tp_getattr */
+  0,                         /* tp_setattr */
+  0,                         /* tp_compare */
+  0,                         /* tp_repr */
+  0,                         /* tp_as_number */
+  0,                         /* tp_as_sequence */
+  0,                         /* tp_as_mapping */
+  0,                         /* tp_hash  */
+  0,                         /* tp_call */
+  0,                         /* tp_str */
+  0,                         /* tp_getattro */
+  0,                         /* tp_setattro */
+  0,                         /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,        /* tp_flags */
+  "Copies data between file descriptors", /* tp_doc */
+  0,                         /* tp_traverse */
+  0,                         /* tp_clear */
+  0,                         /* tp_richcompare */
+  0,                         /* tp_weaklistoffset */
+  0,                         /* tp_iter */
+  0,                         /* tp_iternext */
+  plpy_forwarder_object_methods, /* tp_methods */
+  0,                         /* tp_members */
+  0,                         /* tp_getset */
+  0,                         /* tp_base */
+  0,                         /* tp_dict */
+  0,                         /* tp_descr_get */
+  0,                         /* tp_descr_set */
+  0,                         /* tp_dictoffset */
+  0,                         /* tp_init */
+  0,                         /* tp_alloc */
+  0                          /* tp_new */
+};
@@ -5,7 +5,8 @@ setup(name="plash", version="1.0",
       author='Mark Seaborn',
       author_email='mrs@mythic-beasts.com',
       url='http://plash.beasts.org',
-      py_modules=["plash.comms.cap",
+      py_modules=["plash.binlog",
+                  "plash.comms.cap",
                   "plash.comms.event_loop",
                   "plash.comms.simple",
                   "plash.comms.stream",
@@ -34,5 +35,6 @@ setup(name="plash", version="1.0",
                              libraries = ["plash_pic", "glib-2.0"],
                              sources = ["py-type-fd.c",
                                         "py-type-obj.c",
+                                        "py-type-forwarder.c",
                                         "py-functions.c"],
                              )])
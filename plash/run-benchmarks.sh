@@ -0,0 +1,9 @@
+#!/bin/bash
+
+set -e
+
+(cd python &&
+ mkdir -p lib &&
+ python setup.py install --install-platlib=lib)
+
+./run-uninstalled.sh sh -c 'cd tests && exec python benchmark.py "$@"' sh "$@"
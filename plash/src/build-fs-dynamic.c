@@ -24,6 +24,9 @@
 #include "filesysobj.h"
 #include "filesysobj-fab.h"
 #include "filesysobj-readonly.h"
+#include "filesysobj-real.h"
+#include "filesysobj-union.h"
+#include "filesysslot.h"
 #include "serialise.h"
 #include "build-fs.h"
 
@@ -84,6 +87,9 @@ struct comb_dir {
   struct filesys_obj hdr;
   struct node *node; /* only the `children' field will be accessed through this pointer */
   struct filesys_obj *dir; /* may be null */
+  /* Whether `dir' always refers to the same directory:  it came from a
+     read-only slot, or from a lookup in a stable comb_dir's `dir'. */
+  int stable;
 };
 
 void comb_dir_free(struct filesys_obj *obj1)
@@ -105,42 +111,188 @@ void comb_dir_mark(struct filesys_obj *obj1)
 int comb_dir_stat(struct filesys_obj *obj, struct stat *st, int *err)
 {
   struct comb_dir *dir = (void *) obj;
-  st->st_dev = FAB_OBJ_STAT_DEVICE;
-  st->st_ino = dir->node->inode;
-  st->st_mode = S_IFDIR | 0777;
-  st->st_nlink = 0; /* FIXME: this can be used to count the number of child directories */
-  st->st_uid = 0;
-  st->st_gid = 0;
-  st->st_rdev = 0;
-  st->st_size = 0;
-  st->st_blksize = 1024;
-  st->st_blocks = 0;
-  st->st_atime = 0;
-  st->st_mtime = 0;
-  st->st_ctime = 0;
+  *st = dir->node->stat;
   return 0;
 }
 
 /* Takes owning references.  `dir' may be null. */
-struct filesys_obj *make_comb_dir(struct node *node, struct filesys_obj *dir)
+struct filesys_obj *make_comb_dir(struct node *node, struct filesys_obj *dir,
+				  int stable)
 {
   struct comb_dir *n =
     filesys_obj_make(sizeof(struct comb_dir), &comb_dir_vtable);
   n->node = node;
   n->dir = dir;
+  n->stable = stable && dir;
   return (struct filesys_obj *) n;
 }
 
-/* Takes `node' as a non-owning reference.  `dir' is non-owning, may be null. */
+
+/* Compiling the tree for lookups.
+
+   Often a node's fabricated entries just repeat what is in the real
+   directory underneath.  For example, granting read-only access to
+   both /usr and /usr/lib attaches the same directory at /usr/lib a
+   second time.  We call such entries "pass-through".  When all of a
+   node's children are pass-through, object_of_node() returns the real
+   directory rather than wrapping it in a comb_dir, so later lookups
+   go straight to the real directory.
+
+   An entry is pass-through if it has no symlink, and either:
+    * it has a read-only slot whose object is the same as the real
+      directory's entry (same device and inode number, and the same
+      read-only wrapping), and its own children are pass-through; or
+    * it has no slot, the real directory's entry is a directory, and
+      its children are pass-through.
+   Nodes with no real directory underneath, or whose real directory
+   came from a writable slot (the contents of which can change), are
+   never collapsed.  So the check cannot grant access to anything that
+   the real directory does not already grant.
+
+   The results are cached in the nodes, as are sorted tables of
+   children for looking up entries, until the tree is next modified.
+   They are not rechecked when the real filesystem changes.  That is
+   safe because a collapsed node only exposes its read-only real
+   directory, which the grant underneath it already exposes in full.
+   The visible difference is that if an attached entry is later
+   replaced in the real directory, lookups see the new entry, as they
+   would through the enclosing grant, rather than the object that was
+   attached when the namespace was built. */
+
+static int sort_node_list_compare(const void *p1, const void *p2)
+{
+  return strcmp((*(struct node_list **) p1)->name,
+		(*(struct node_list **) p2)->name);
+}
+
+static int search_node_list_compare(const void *key, const void *p)
+{
+  return strcmp((const char *) key, (*(struct node_list **) p)->name);
+}
+
+/* Looks up a child of `node'.  Returns NULL if not present. */
+static struct node_list *node_child(struct node *node, const char *name)
+{
+  struct node_list **found;
+  if(!node->children) {
+    return NULL;
+  }
+  if(node->table_generation != fs_tree_generation) {
+    struct node_list *l;
+    int count = 0;
+    for(l = node->children; l; l = l->next) count++;
+    free(node->child_table);
+    node->child_table = amalloc(count * sizeof(struct node_list *));
+    count = 0;
+    for(l = node->children; l; l = l->next) node->child_table[count++] = l;
+    qsort(node->child_table, count, sizeof(struct node_list *),
+	  sort_node_list_compare);
+    node->child_count = count;
+    node->table_generation = fs_tree_generation;
+  }
+  found = bsearch(name, node->child_table, node->child_count,
+		  sizeof(struct node_list *), search_node_list_compare);
+  return found ? *found : NULL;
+}
+
+/* Removes read-only proxies, noting whether the object is read-only. */
+static struct filesys_obj *unwrap_read_only(struct filesys_obj *obj,
+					    int *read_only)
+{
+  struct filesys_obj *target;
+  *read_only = 0;
+  while((target = read_only_proxy_target(obj))) {
+    obj = target;
+    *read_only = 1;
+  }
+  if(real_obj_is_read_only(obj)) *read_only = 1;
+  return obj;
+}
+
+static int is_real_obj(struct filesys_obj *obj)
+{
+  return obj->vtable == &real_dir_vtable ||
+    obj->vtable == &real_file_vtable ||
+    obj->vtable == &real_symlink_vtable ||
+    real_obj_is_read_only(obj);
+}
+
+static int same_real_object(struct filesys_obj *obj1, struct filesys_obj *obj2)
+{
+  int read_only1, read_only2;
+  struct stat st1, st2;
+  int err;
+  obj1 = unwrap_read_only(obj1, &read_only1);
+  obj2 = unwrap_read_only(obj2, &read_only2);
+  return read_only1 == read_only2 &&
+    is_real_obj(obj1) && is_real_obj(obj2) &&
+    obj1->vtable->fsobj_type(obj1) == obj2->vtable->fsobj_type(obj2) &&
+    obj1->vtable->fsobj_stat(obj1, &st1, &err) >= 0 &&
+    obj2->vtable->fsobj_stat(obj2, &st2, &err) >= 0 &&
+    st1.st_dev == st2.st_dev &&
+    st1.st_ino == st2.st_ino;
+}
+
+static int node_passthrough(struct node *node, struct filesys_obj *real);
+
+/* Returns whether all of `node's children are pass-through with
+   respect to `dir', which must be stable. */
+static int children_passthrough(struct node *node, struct filesys_obj *dir)
+{
+  struct node_list *l;
+  if(node->passthrough_generation == fs_tree_generation) {
+    return node->children_passthrough;
+  }
+  node->children_passthrough = 1;
+  for(l = node->children; l; l = l->next) {
+    struct filesys_obj *real = dir->vtable->traverse(dir, l->name);
+    int ok = node_passthrough(l->node, real);
+    if(real) filesys_obj_free(real);
+    if(!ok) {
+      node->children_passthrough = 0;
+      break;
+    }
+  }
+  node->passthrough_generation = fs_tree_generation;
+  return node->children_passthrough;
+}
+
+/* `real' is the real directory's entry for `node', or NULL. */
+static int node_passthrough(struct node *node, struct filesys_obj *real)
+{
+  if(!real || node->symlink_dest) {
+    return 0;
+  }
+  if(node->attach_slot) {
+    struct filesys_obj *obj;
+    int ok;
+    if(!is_read_only_slot(node->attach_slot)) {
+      return 0;
+    }
+    obj = node->attach_slot->vtable->slot_get(node->attach_slot);
+    if(!obj) {
+      return 0;
+    }
+    ok = same_real_object(obj, real) &&
+      (!node->children || children_passthrough(node, obj));
+    filesys_obj_free(obj);
+    return ok;
+  }
+  return real->vtable->fsobj_type(real) == OBJT_DIR &&
+    children_passthrough(node, real);
+}
+
+/* Takes `node' as a non-owning reference.  `dir' is non-owning, may be null.
+   `dir_stable' says whether `dir' came from a stable comb_dir. */
 struct filesys_obj *object_of_node(struct node *node, struct filesys_obj *dir,
-				   int ensure_fabricated)
+				   int dir_stable, int ensure_fabricated)
 {
   if(node->symlink_dest) {
     /* FIXME? copying the destination is unnecessary */
     struct fab_symlink *sym =
       filesys_obj_make(sizeof(struct fab_symlink), &fab_symlink_vtable);
     sym->dest = dup_seqf(seqf_string(node->symlink_dest));
-    sym->inode = node->inode;
+    sym->stat = node->stat;
     return (struct filesys_obj *) sym;
   }
   else if(node->attach_slot) {
@@ -149,16 +301,26 @@ struct filesys_obj *object_of_node(struct node *node, struct filesys_obj *dir,
     /* FIXME: check if `obj' is not a dir; if so, pass null instead */
     struct filesys_obj *obj =
       node->attach_slot->vtable->slot_get(node->attach_slot);
+    int stable = is_read_only_slot(node->attach_slot);
     if(node->children || ensure_fabricated) {
+      if(obj && stable && !ensure_fabricated &&
+	 obj->vtable->fsobj_type(obj) == OBJT_DIR &&
+	 children_passthrough(node, obj)) {
+	return obj;
+      }
       node->hdr.refcount++;
-      return make_comb_dir(node, obj /* may be null */);
+      return make_comb_dir(node, obj /* may be null */, stable);
     }
     else return obj;
   }
   else {
+    if(dir && dir_stable && !ensure_fabricated &&
+       node_passthrough(node, dir)) {
+      return inc_ref(dir);
+    }
     node->hdr.refcount++;
     if(dir) inc_ref(dir);
-    return make_comb_dir(node, dir /* may be null */);
+    return make_comb_dir(node, dir /* may be null */, dir_stable);
   }
 }
 
@@ -166,8 +328,7 @@ struct filesys_obj *comb_dir_traverse(struct filesys_obj *obj1, const char *name
 {
   struct comb_dir *obj = (void *) obj1;
 
-  struct node_list *list_entry =
-    (void *) assoc((void *) obj->node->children, name);
+  struct node_list *list_entry = node_child(obj->node, name);
   if(list_entry) {
     struct filesys_obj *r;
     struct filesys_obj *subdir = 0;
@@ -178,7 +339,7 @@ struct filesys_obj *comb_dir_traverse(struct filesys_obj *obj1, const char *name
       /* FIXME: check if `subdir' is not a dir; if so, pass null instead */
       subdir = obj->dir->vtable->traverse(obj->dir, name);
     }
-    r = object_of_node(list_entry->node, subdir, 0);
+    r = object_of_node(list_entry->node, subdir, obj->stable, 0);
     if(subdir) filesys_obj_free(subdir);
     return r;
   }
@@ -192,11 +353,6 @@ struct filesys_obj *comb_dir_traverse(struct filesys_obj *obj1, const char *name
   }
 }
 
-struct dir_entry {
-  int inode, type;
-  seqf_t name;
-};
-
 static int sort_dir_entry_compare(const void *p1, const void *p2)
 {
   return seqf_compare(((struct dir_entry *) p1)->name,
@@ -207,33 +363,17 @@ int comb_dir_list(struct filesys_obj *obj1, region_t r, seqt_t *result, int *err
 {
   struct comb_dir *obj = (void *) obj1;
   int count1, count2;
-  seqt_t got;
-  seqf_t buf;
   struct dir_entry *array1, *array2;
-  int i;
 
   region_t r2 = region_make();
 
-  /* Get real directory listing. */
+  /* Get real directory listing.  This comes back sorted, and is
+     cached between calls when the directory has not changed. */
   if(obj->dir) {
-    count1 = obj->dir->vtable->list(obj->dir, r2, &got, err);
+    struct dir_stamp stamp;
+    int cacheable;
+    count1 = sorted_dir_list(r2, obj->dir, &array1, &stamp, &cacheable, err);
     if(count1 < 0) { region_free(r2); return -1; }
-    array1 = region_alloc(r2, count1 * sizeof(struct dir_entry));
-    buf = flatten(r, got);
-    for(i = 0; i < count1; i++) {
-      int inode, type;
-      seqf_t name;
-      int ok = 1;
-      m_int(&ok, &buf, &inode);
-      m_int(&ok, &buf, &type);
-      m_lenblock(&ok, &buf, &name);
-      if(ok) {
-	array1[i].inode = inode;
-	array1[i].type = type;
-	array1[i].name = name;
-      }
-      else { region_free(r2); *err = EIO; return -1; }
-    }
   }
   else {
     count1 = 0;
@@ -256,7 +396,7 @@ int comb_dir_list(struct filesys_obj *obj1, region_t r, seqt_t *result, int *err
       /* Check whether entry is a full slot. */
       if(list->node->symlink_dest || list->node->children) {
 	/* Filling out these is optional. */
-	inode = list->node->inode;
+	inode = list->node->stat.st_ino;
 	type = list->node->symlink_dest ? DT_LNK : DT_DIR;
       }
       else if(list->node->attach_slot) {
@@ -291,8 +431,7 @@ int comb_dir_list(struct filesys_obj *obj1, region_t r, seqt_t *result, int *err
     }
   }
 
-  /* Sort the sequences to make it easy to merge them. */
-  qsort(array1, count1, sizeof(struct dir_entry), sort_dir_entry_compare);
+  /* Sort the fabricated entries to make it easy to merge them. */
   qsort(array2, count2, sizeof(struct dir_entry), sort_dir_entry_compare);
 
   /* Merge the two sequences. */
@@ -349,8 +488,7 @@ int comb_dir_list(struct filesys_obj *obj1, region_t r, seqt_t *result, int *err
 int comb_dir_get_slot(struct comb_dir *obj, const char *name,
 		      struct filesys_obj **slot, int *err)
 {
-  struct node_list *list_entry =
-    (void *) assoc((void *) obj->node->children, name);
+  struct node_list *list_entry = node_child(obj->node, name);
   if(list_entry) {
     struct node *node = list_entry->node;
     if(node->symlink_dest) {
@@ -391,6 +529,17 @@ int comb_dir_create_file(struct filesys_obj *obj1, const char *name,
     default: return -1;
   }
 }
+/* Entries that are not attached in the tree are passed straight to
+   `dir', so that it can do this in one step. */
+int comb_dir_open_or_create(struct filesys_obj *obj1, const char *name,
+			    int flags, int mode, int *err)
+{
+  struct comb_dir *obj = (void *) obj1;
+  if(obj->dir && !node_child(obj->node, name)) {
+    return obj->dir->vtable->open_or_create(obj->dir, name, flags, mode, err);
+  }
+  return generic_open_or_create(obj1, name, flags, mode, err);
+}
 int comb_dir_mkdir(struct filesys_obj *obj1, const char *name,
 		   int mode, int *err)
 {
@@ -445,64 +594,47 @@ int comb_dir_socket_bind(struct filesys_obj *obj1, const char *name,
   }
 }
 
-/* This works when both directories are comb_dirs, and when the slots in
-   both directories belong to the backing directories.
-   In that case, this drops through to calling rename() on the backing
-   directories. */
+/* Returns the directory that really holds the entry `leaf' of `dir'.
+   For a combined directory in which `leaf' is not attached in the
+   tree, that is the directory it falls back to.  Otherwise it is
+   `dir' itself.  Returns a borrowed reference. */
+struct filesys_obj *comb_dir_entry_dir(struct filesys_obj *dir,
+				       const char *leaf)
+{
+  while(dir->vtable == &comb_dir_vtable) {
+    struct comb_dir *obj = (void *) dir;
+    if(!obj->dir || node_child(obj->node, leaf)) break;
+    dir = obj->dir;
+  }
+  return dir;
+}
+
+/* These work when the entries at both ends belong to the backing
+   directories rather than to the tree.  In that case, they drop
+   through to calling rename() or link() on the backing directories,
+   whether the other end is a combined directory or not. */
 int comb_dir_rename(struct filesys_obj *obj1, const char *leaf,
 		    struct filesys_obj *dest_dir, const char *dest_leaf, int *err)
 {
-  struct comb_dir *obj = (void *) obj1;
-  if(dest_dir->vtable == &comb_dir_vtable) {
-    struct comb_dir *dest_obj = (void *) dest_dir;
-
-    if(obj->dir && dest_obj->dir) {
-      struct node_list *list_entry =
-	(void *) assoc((void *) obj->node->children, leaf);
-
-      if(!list_entry) {
-	struct node_list *dest_list_entry =
-	  (void *) assoc((void *) dest_obj->node->children, dest_leaf);
-
-	if(!dest_list_entry) {
-	  return obj->dir->vtable->rename(obj->dir, leaf,
-					  dest_obj->dir, dest_leaf, err);
-	}
-      }
-    }
+  struct filesys_obj *src = comb_dir_entry_dir(obj1, leaf);
+  struct filesys_obj *dest = comb_dir_entry_dir(dest_dir, dest_leaf);
+  if(src->vtable == &comb_dir_vtable || dest->vtable == &comb_dir_vtable) {
+    *err = EACCES;
+    return -1;
   }
-  *err = EACCES;
-  return -1;
+  return src->vtable->rename(src, leaf, dest, dest_leaf, err);
 }
 
-/* This works when both directories are comb_dirs, and when the slots in
-   both directories belong to the backing directories.
-   In that case, this drops through to calling link() on the backing
-   directories. */
 int comb_dir_link(struct filesys_obj *obj1, const char *leaf,
 		  struct filesys_obj *dest_dir, const char *dest_leaf, int *err)
 {
-  struct comb_dir *obj = (void *) obj1;
-  if(dest_dir->vtable == &comb_dir_vtable) {
-    struct comb_dir *dest_obj = (void *) dest_dir;
-
-    if(obj->dir && dest_obj->dir) {
-      struct node_list *list_entry =
-	(void *) assoc((void *) obj->node->children, leaf);
-
-      if(!list_entry) {
-	struct node_list *dest_list_entry =
-	  (void *) assoc((void *) dest_obj->node->children, dest_leaf);
-
-	if(!dest_list_entry) {
-	  return obj->dir->vtable->link(obj->dir, leaf,
-					dest_obj->dir, dest_leaf, err);
-	}
-      }
-    }
+  struct filesys_obj *src = comb_dir_entry_dir(obj1, leaf);
+  struct filesys_obj *dest = comb_dir_entry_dir(dest_dir, dest_leaf);
+  if(src->vtable == &comb_dir_vtable || dest->vtable == &comb_dir_vtable) {
+    *err = EACCES;
+    return -1;
   }
-  *err = EACCES;
-  return -1;
+  return src->vtable->link(src, leaf, dest, dest_leaf, err);
 }
 
 
@@ -513,7 +645,23 @@ struct filesys_obj *fs_make_root(struct node *node)
      directory that is returned here, even if, when this function is
      called, the root node has a directory attached to it with nothing
      attached below.  So we set the flag to true. */
-  return object_of_node(node, 0 /* dir */, 1 /* ensure_fabricated */);
+  return object_of_node(node, 0 /* dir */, 0 /* dir_stable */,
+			1 /* ensure_fabricated */);
+}
+
+/* If `obj' is a combined directory that has nothing attached below
+   it, so that it behaves exactly like the directory it falls back to,
+   returns that directory as an owning reference.  Otherwise returns
+   null. */
+struct filesys_obj *comb_dir_passthrough(struct filesys_obj *obj1)
+{
+  struct comb_dir *obj = (void *) obj1;
+  if(obj1->vtable == &comb_dir_vtable &&
+     !obj->node->children &&
+     obj->dir) {
+    return inc_ref(obj->dir);
+  }
+  return NULL;
 }
 
 #include "out-vtable-build-fs-dynamic.h"
@@ -31,7 +31,7 @@ struct filesys_obj *fs_build_fs(struct node *node)
     struct fab_symlink *sym =
       filesys_obj_make(sizeof(struct fab_symlink), &fab_symlink_vtable);
     sym->dest = dup_seqf(seqf_string(node->symlink_dest));
-    sym->inode = node->inode;
+    sym->stat = node->stat;
     return make_read_only_slot((struct filesys_obj *) sym);
   }
   else if(node->attach_slot) {
@@ -51,7 +51,7 @@ struct filesys_obj *fs_build_fs(struct node *node)
     }
     dir = filesys_obj_make(sizeof(struct s_fab_dir), &s_fab_dir_vtable);
     dir->entries = nlist;
-    dir->inode = node->inode;
+    dir->stat = node->stat;
     return make_read_only_slot((struct filesys_obj *) dir);
   }
 }
@@ -32,18 +32,31 @@
 #define LOG stderr
 
 
-int next_inode = 1;
+int fs_tree_generation = 0;
 
-struct node *fs_make_empty_node()
+/* Takes an owning reference to `inodes'. */
+static struct node *make_node(struct fab_inode_space *inodes)
 {
   struct node *n = filesys_obj_make(sizeof(struct node), &node_vtable);
-  n->inode = next_inode++;
+  n->inodes = inodes;
+  fab_stat_init(&n->stat, inodes->dev, fab_inode_alloc(inodes),
+		S_IFDIR | 0777, 0);
   n->symlink_dest = 0;
   n->attach_slot = 0;
   n->children = 0;
+  n->table_generation = -1;
+  n->child_count = 0;
+  n->child_table = NULL;
+  n->passthrough_generation = -1;
   return n;
 }
 
+/* Creates the root node of a new namespace. */
+struct node *fs_make_empty_node()
+{
+  return make_node(fab_inode_space_make());
+}
+
 fs_node_t fs_node_upcast(cap_t obj)
 {
   return obj->vtable == &node_vtable ? (fs_node_t) obj : NULL;
@@ -63,6 +76,8 @@ void node_free(struct filesys_obj *obj)
 
   if(node->symlink_dest) free(node->symlink_dest);
   if(node->attach_slot) filesys_obj_free(node->attach_slot);
+  free(node->child_table);
+  fab_inode_space_free(node->inodes);
 }
 
 #ifdef GC_DEBUG
@@ -86,10 +101,12 @@ struct node *tree_traverse(struct node *node, const char *name)
   if(!list_entry) {
     list_entry = amalloc(sizeof(struct node_list));
     list_entry->name = strdup(name);
-    list_entry->node = fs_make_empty_node();
+    node->inodes->refcount++;
+    list_entry->node = make_node(node->inodes);
     /* Insert into the current node */
     list_entry->next = node->children;
     node->children = list_entry;
+    fs_tree_generation++;
   }
   return list_entry->node;
 }
@@ -151,6 +168,7 @@ int attach_ro_obj(struct node *node, cap_t obj)
     replaced = 1;
   }
   node->attach_slot = make_read_only_slot(make_read_only_proxy(obj));
+  fs_tree_generation++;
   return replaced;
 }
 
@@ -163,6 +181,7 @@ int attach_rw_slot(struct node *node, struct filesys_obj *obj)
     replaced = 1;
   }
   node->attach_slot = obj;
+  fs_tree_generation++;
   return replaced;
 }
 
@@ -397,6 +416,9 @@ int fs_resolve_populate_aux
 	   Furthermore, a client can't modify/delete the symlink. */
 	if(next_node->symlink_dest) free(next_node->symlink_dest);
 	next_node->symlink_dest = strdup_seqf(link_dest);
+	fab_stat_init(&next_node->stat, next_node->stat.st_dev,
+		      next_node->stat.st_ino, S_IFLNK | 0777, link_dest.size);
+	fs_tree_generation++;
 	
 	if(flags & FS_FOLLOW_SYMLINKS) {
 	  int rc = fs_resolve_populate_aux(r, root, dirstack,
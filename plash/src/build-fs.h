@@ -61,6 +61,9 @@ int fs_resolve_populate
    seqf_t filename, int flags, int *err);
 
 struct filesys_obj *fs_make_root(fs_node_t node);
+struct filesys_obj *comb_dir_passthrough(struct filesys_obj *obj);
+struct filesys_obj *comb_dir_entry_dir(struct filesys_obj *dir,
+				       const char *leaf);
 
 static inline void free_node(struct node *node) {
   filesys_obj_free((cap_t) node);
@@ -82,7 +85,11 @@ fs_node_t fs_node_upcast(cap_t obj);
 DECLARE_VTABLE(node_vtable);
 struct node {
   struct filesys_obj hdr;
-  int inode; /* Inode number to use for fabricated symlinks and directories */
+  /* Shared by all the nodes of a namespace. */
+  struct fab_inode_space *inodes;
+  /* Stat record to use for the fabricated symlink or directory.
+     Precomputed because the device and inode numbers never change. */
+  struct stat stat;
 
   /* Symlink:  malloc'd block.  May be null.  If this is used, the
      other parameters are ignored. */
@@ -100,6 +107,14 @@ struct node {
 
   /* May be empty (ie. null) */
   struct node_list *children;
+
+  /* Cached by build-fs-dynamic.c; valid while the generation number
+     matches fs_tree_generation. */
+  int table_generation;
+  int child_count;
+  struct node_list **child_table; /* malloc'd; sorted by name */
+  int passthrough_generation;
+  int children_passthrough;
 };
 
 struct node_list {
@@ -108,5 +123,8 @@ struct node_list {
   struct node_list *next;
 };
 
+/* Incremented whenever a tree is modified. */
+extern int fs_tree_generation;
+
 
 #endif
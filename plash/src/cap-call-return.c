@@ -17,6 +17,10 @@
    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301,
    USA.  */
 
+#ifdef ENABLE_LOGGING
+#include <sys/time.h>
+#endif
+
 #include "region.h"
 #include "filesysobj.h"
 #include "cap-protocol.h"
@@ -46,6 +50,11 @@ void generic_obj_call(struct filesys_obj *obj, region_t r1,
 		      struct cap_args args, struct cap_args *result)
 {
   struct return_state *state = amalloc(sizeof(struct return_state));
+#ifdef ENABLE_LOGGING
+  int tracing = cap_trace_enabled;
+  struct timeval start, end;
+  if(tracing) gettimeofday(&start, NULL);
+#endif
   state->r = r1;
   state->returned = 0;
   state->result = result;
@@ -67,6 +76,13 @@ void generic_obj_call(struct filesys_obj *obj, region_t r1,
     if(!cap_run_server_step()) { assert(0); }
   }
   free(state);
+#ifdef ENABLE_LOGGING
+  if(tracing) {
+    gettimeofday(&end, NULL);
+    cap_trace_call(obj, (end.tv_sec - start.tv_sec) * 1000000L +
+		   (end.tv_usec - start.tv_usec));
+  }
+#endif
 }
 
 void local_obj_invoke(struct filesys_obj *obj, struct cap_args args)
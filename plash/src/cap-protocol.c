@@ -19,8 +19,11 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <signal.h>
 
 #ifdef PLASH_GLIB
 #include <glib.h>
@@ -85,6 +88,12 @@
 struct export_entry {
   char used;
   char single_use;
+  /* Number of references the other end holds: one for each time the
+     object was sent, less the "Drop"s received.  Single-use entries
+     are never shared, so this is always 1 for them. */
+  int refs;
+  /* Next entry in the same export_hash bucket, or -1. */
+  int hash_next;
   union {
     cap_t cap; /* owning reference */
     int next; /* may be equal to export_size */
@@ -97,6 +106,20 @@ struct connection_list {
   struct connection *prev, *next;
 };
 
+/* Counters kept by the tracer; see cap_trace_enable(). */
+struct conn_stats {
+  unsigned long msgs_in, msgs_out;
+  unsigned long bytes_in, bytes_out;
+  unsigned long fds_in, fds_out;
+  int export_high_water;
+  unsigned long exports_reused; /* Sends that reused an export entry */
+  unsigned long compactions;
+  /* Round trips made by generic_obj_call() on imported objects */
+  unsigned long calls;
+  unsigned long call_us_total;
+  long call_us_max;
+};
+
 struct connection {
   /* Must come first. */
   struct connection_list l;
@@ -120,10 +143,20 @@ struct connection {
   int export_count; /* number of export entries with `used' set */
   /* This starts a linked list of free slots: */
   int export_next; /* may be equal to export_size */
+  /* Maps exported objects to their IDs, so that an object that is
+     sent many times takes up one slot.  The buckets contain indexes
+     into `export', chained through hash_next, or -1. */
+  int *export_hash;
+  int export_hash_size; /* a power of 2 */
+  int export_top; /* 1 + the highest slot in use */
+  /* Slots freed since the table was last compacted */
+  int export_frees;
 
   /* Number of remote_objects referring to this connection. */
   int import_count;
 
+  struct conn_stats stats;
+
 #ifdef PLASH_GLIB
   GIOChannel *g_channel;
   int watch_id;
@@ -139,6 +172,10 @@ struct c_server_state {
   /* Arguments to select(): */
   int max_fd;
   fd_set set;
+
+  /* Tracer counters summed over connections that have been shut down */
+  struct conn_stats closed_stats;
+  int closed_count;
 };
 
 static struct c_server_state server_state =
@@ -164,6 +201,21 @@ struct cap_seq caps_empty = { 0, 0 };
 
 static void listen_on_connection(struct connection *conn);
 
+int (*cap_server_timer_hook)(void) = NULL;
+
+
+/* The tracer records traffic on each connection.  It is off by default,
+   and is only compiled in where logging is (not in ld.so). */
+#ifdef ENABLE_LOGGING
+int cap_trace_enabled = 0;
+static volatile sig_atomic_t trace_dump_requested = 0;
+#define TRACE(stmt) do { if(cap_trace_enabled) { stmt; } } while(0)
+static void trace_check_dump(void);
+#else
+#define TRACE(stmt) do { } while(0)
+#define trace_check_dump() do { } while(0)
+#endif
+
 
 /* Sets up the arguments to select().  Needs to be called every time the
    process list is changed. */
@@ -179,6 +231,26 @@ static void init_fd_set(struct c_server_state *state)
   }
 }
 
+#ifdef ENABLE_LOGGING
+static void add_conn_stats(struct conn_stats *sum, struct conn_stats *st)
+{
+  sum->msgs_in += st->msgs_in;
+  sum->msgs_out += st->msgs_out;
+  sum->bytes_in += st->bytes_in;
+  sum->bytes_out += st->bytes_out;
+  sum->fds_in += st->fds_in;
+  sum->fds_out += st->fds_out;
+  if(sum->export_high_water < st->export_high_water)
+    sum->export_high_water = st->export_high_water;
+  sum->exports_reused += st->exports_reused;
+  sum->compactions += st->compactions;
+  sum->calls += st->calls;
+  sum->call_us_total += st->call_us_total;
+  if(sum->call_us_max < st->call_us_max)
+    sum->call_us_max = st->call_us_max;
+}
+#endif
+
 static void shut_down_connection(struct connection *conn)
 {
   int i;
@@ -186,6 +258,8 @@ static void shut_down_connection(struct connection *conn)
   int export_size = conn->export_size;
   assert(conn->comm); /* Connection should not have been shut down already */
 
+  free(conn->export_hash);
+
 #ifdef PLASH_GLIB
   g_io_channel_unref(conn->g_channel);
   int removed_ok = g_source_remove(conn->watch_id);
@@ -204,6 +278,9 @@ static void shut_down_connection(struct connection *conn)
 
   server_state.total_export_count -= conn->export_count;
 
+  TRACE(add_conn_stats(&server_state.closed_stats, &conn->stats);
+	server_state.closed_count++);
+
   if(conn->import_count > 0) {
     /* Mark connection as shut down (but we don't deallocate it yet). */
     conn->comm = 0;
@@ -215,6 +292,9 @@ static void shut_down_connection(struct connection *conn)
     conn->export_size = 0;
     conn->export_count = 0;
     conn->export_next = 0;
+    conn->export_hash = 0;
+    conn->export_hash_size = 0;
+    conn->export_top = 0;
 #ifdef PLASH_GLIB
     conn->g_channel = NULL;
     conn->watch_id = -1;
@@ -254,6 +334,52 @@ static void violation(struct connection *conn, seqf_t msg)
 #endif
 }
 
+static int *export_hash_bucket(struct connection *conn, cap_t obj)
+{
+  unsigned long h = (unsigned long) obj >> 4;
+  h *= 2654435761UL;
+  return &conn->export_hash[(h >> 8) & (conn->export_hash_size - 1)];
+}
+
+/* Resizes the hash table to suit the export table's size, and
+   re-enters all the shareable entries. */
+static void rebuild_export_hash(struct connection *conn)
+{
+  int i;
+  int size = 8;
+  while(size < conn->export_size) size *= 2;
+  free(conn->export_hash);
+  conn->export_hash = amalloc(size * sizeof(int));
+  conn->export_hash_size = size;
+  for(i = 0; i < size; i++) conn->export_hash[i] = -1;
+  for(i = 0; i < conn->export_size; i++) {
+    if(conn->export[i].used && !conn->export[i].single_use) {
+      int *bucket = export_hash_bucket(conn, conn->export[i].x.cap);
+      conn->export[i].hash_next = *bucket;
+      *bucket = i;
+    }
+  }
+}
+
+/* Returns the ID an object is already exported with, or -1. */
+static int export_hash_lookup(struct connection *conn, cap_t obj)
+{
+  int id = *export_hash_bucket(conn, obj);
+  while(id >= 0 && conn->export[id].x.cap != obj)
+    id = conn->export[id].hash_next;
+  return id;
+}
+
+static void export_hash_remove(struct connection *conn, int id)
+{
+  int *p = export_hash_bucket(conn, conn->export[id].x.cap);
+  while(*p != id) {
+    assert(*p >= 0);
+    p = &conn->export[*p].hash_next;
+  }
+  *p = conn->export[id].hash_next;
+}
+
 /* Ensure that the export table has at least one free slot.
    If it needs resizing, it will give it `slack' new free slots. */
 static void resize_export_table(struct connection *conn, int slack)
@@ -273,10 +399,59 @@ static void resize_export_table(struct connection *conn, int slack)
     free(conn->export);
     conn->export = export_new;
     conn->export_size = new_size;
+    if(conn->export_hash_size < new_size) rebuild_export_hash(conn);
   }
   assert(conn->export_next < conn->export_size);
 }
 
+/* IDs can't be renumbered, because the other end holds them, so the
+   table can only shrink when the top end of it is free.  Compaction
+   sorts the free list so that low slots get reused first, letting
+   the top end drain, and then trims whatever is free at the top.
+   This is done once enough slots have been freed to pay for the
+   cost of scanning the table, or once the top half of the table has
+   emptied. */
+#define EXPORT_TABLE_MIN_COMPACT 64
+
+static void maybe_compact_export_table(struct connection *conn)
+{
+  int i, new_size;
+  int top = conn->export_top;
+  int *next;
+  if(conn->export_size < EXPORT_TABLE_MIN_COMPACT)
+    return;
+  if(conn->export_frees < conn->export_size / 2 &&
+     top >= conn->export_size / 2)
+    return;
+  conn->export_frees = 0;
+
+  new_size = conn->export_size;
+  if(top < new_size / 2) {
+    /* Leave some room above the top entry. */
+    new_size = top + top / 2;
+    if(new_size < EXPORT_TABLE_MIN_COMPACT / 2)
+      new_size = EXPORT_TABLE_MIN_COMPACT / 2;
+  }
+  if(new_size < conn->export_size) {
+    struct export_entry *export_new =
+      amalloc(new_size * sizeof(struct export_entry));
+    memcpy(export_new, conn->export, new_size * sizeof(struct export_entry));
+    free(conn->export);
+    conn->export = export_new;
+    conn->export_size = new_size;
+    rebuild_export_hash(conn);
+  }
+  next = &conn->export_next;
+  for(i = 0; i < conn->export_size; i++) {
+    if(!conn->export[i].used) {
+      *next = i;
+      next = &conn->export[i].x.next;
+    }
+  }
+  *next = conn->export_size;
+  TRACE(conn->stats.compactions++);
+}
+
 /* Returns non-zero if the connection is invalid on exit. */
 static int decr_import_count(struct connection *conn)
 {
@@ -326,6 +501,8 @@ void remote_obj_free(struct filesys_obj *obj1)
 	      cat2(r, mk_string(r, "Drop"),
 		   mk_int(r, CAPP_WIRE_ID(CAPP_NAMESPACE_RECEIVER, obj->id))),
 	      fds_empty);
+    TRACE(conn->stats.msgs_out++;
+	  conn->stats.bytes_out += 4 + sizeof(int));
     region_free(r);
   }
 }
@@ -439,7 +616,15 @@ void remote_obj_invoke(struct filesys_obj *obj, struct cap_args args)
       caps[i] = CAPP_WIRE_ID(CAPP_NAMESPACE_RECEIVER, id);
     }
     else {
-      int id;
+      int id = -1;
+      if(!c->vtable->single_use) id = export_hash_lookup(conn, c);
+      if(id >= 0) {
+	/* The other end will send a "Drop" for each copy. */
+	conn->export[id].refs++;
+	TRACE(conn->stats.exports_reused++);
+	caps[i] = CAPP_WIRE_ID(CAPP_NAMESPACE_SENDER, id);
+	continue;
+      }
       resize_export_table(conn, (args.caps.size - i) + 5);
       id = conn->export_next;
       conn->export_next = conn->export[id].x.next;
@@ -447,7 +632,14 @@ void remote_obj_invoke(struct filesys_obj *obj, struct cap_args args)
       server_state.total_export_count++;
       conn->export[id].used = 1;
       conn->export[id].single_use = c->vtable->single_use;
+      conn->export[id].refs = 1;
       conn->export[id].x.cap = c;
+      if(conn->export_top <= id) conn->export_top = id + 1;
+      if(!c->vtable->single_use) {
+	int *bucket = export_hash_bucket(conn, c);
+	conn->export[id].hash_next = *bucket;
+	*bucket = id;
+      }
       c->refcount++; /* this is decremented later */
       caps[i] = CAPP_WIRE_ID(c->vtable->single_use
 			     ? CAPP_NAMESPACE_SENDER_SINGLE_USE
@@ -462,6 +654,12 @@ void remote_obj_invoke(struct filesys_obj *obj, struct cap_args args)
 		 args.data),
 	    args.fds);
   region_free(r);
+  TRACE(conn->stats.msgs_out++;
+	conn->stats.bytes_out +=
+	  4 + (2 + args.caps.size) * sizeof(int) + args.data.size;
+	conn->stats.fds_out += args.fds.count;
+	if(conn->stats.export_high_water < conn->export_count)
+	  conn->stats.export_high_water = conn->export_count);
 
   if(dest->single_use) {
     decr_import_count(conn);
@@ -517,12 +715,19 @@ static cap_t lookup_id(struct connection *conn, int full_id)
    single-use capability. */
 static void remove_exported_id(struct connection *conn, int id)
 {
+  if(!conn->export[id].single_use) export_hash_remove(conn, id);
   conn->export[id].x.next = conn->export_next;
   conn->export[id].used = 0;
   conn->export_next = id;
   assert(conn->export_count > 0);
   conn->export_count--;
   server_state.total_export_count--;
+  if(id + 1 == conn->export_top) {
+    while(conn->export_top > 0 && !conn->export[conn->export_top - 1].used)
+      conn->export_top--;
+  }
+  conn->export_frees++;
+  maybe_compact_export_table(conn);
   /* Shutting down will free the export table, but not the object that
      was just removed from the export table, which becomes owned by
      the caller. */
@@ -664,6 +869,7 @@ static void handle_msg(struct connection *conn, seqf_t data_orig, fds_t fds)
         case CAPP_NAMESPACE_RECEIVER:
 	  if(0 <= id && id < conn->export_size && conn->export[id].used) {
 	    cap_t c = conn->export[id].x.cap;
+	    if(--conn->export[id].refs > 0) return;
 	    remove_exported_id(conn, id);
 	    /* This needs to be done last because it may call arbitrary
 	       finalisation code which may render `conn' invalid. */
@@ -750,6 +956,8 @@ cap_t *cap_make_connection(region_t r, int sock_fd,
   conn->comm = comm_init(sock_fd);
   conn->sock_fd = sock_fd;
   conn->ready_to_read = 0;
+  memset(&conn->stats, 0, sizeof(conn->stats));
+  conn->stats.export_high_water = export.size;
 
   conn->export_size = export.size;
   conn->export_count = export.size;
@@ -759,8 +967,13 @@ cap_t *cap_make_connection(region_t r, int sock_fd,
     filesys_obj_check(export.caps[i]);
     conn->export[i].used = 1;
     conn->export[i].single_use = 0;
+    conn->export[i].refs = 1;
     conn->export[i].x.cap = inc_ref(export.caps[i]);
   }
+  conn->export_hash = NULL;
+  conn->export_top = export.size;
+  conn->export_frees = 0;
+  rebuild_export_hash(conn);
 
   /* Insert into list of connections. */
   conn->l.head = 0;
@@ -811,6 +1024,8 @@ static void listen_on_connection(struct connection *conn)
 {
   int r, err;
 
+  trace_check_dump();
+
   server_state.total_ready_to_read -= conn->ready_to_read;
   conn->ready_to_read = 0;
 
@@ -851,6 +1066,9 @@ static void listen_on_connection(struct connection *conn)
     while(conn->comm) {
       r = comm_try_get(conn->comm, &msg, &fds);
       if(r != COMM_AVAIL) break;
+      TRACE(conn->stats.msgs_in++;
+	    conn->stats.bytes_in += msg.size;
+	    conn->stats.fds_in += fds.count);
       handle_msg(conn, msg, fds);
     }
     decr_import_count(conn);
@@ -867,6 +1085,7 @@ static void listen_on_connection(struct connection *conn)
 int cap_run_server_step()
 {
   struct c_server_state *state = &server_state;
+  trace_check_dump();
   if(state->list.next->l.head) return 0;
 
   /*
@@ -880,9 +1099,12 @@ int cap_run_server_step()
   listen_on_connection(state->list.next);
   return 1;
 #else
+  int timeout_ms = cap_server_timer_hook ? cap_server_timer_hook() : -1;
+
   /* See if there is only one active connection.  If so, we don't need
-     to use select(), and we save a system call. */
-  if(state->list.next->l.next->l.head) {
+     to use select(), and we save a system call.  We do need select()
+     if there is a timeout, though. */
+  if(state->list.next->l.next->l.head && timeout_ms < 0) {
 #ifdef DO_LOG
     if(MOD_DEBUG) {
       PRINT_PID;
@@ -897,6 +1119,7 @@ int cap_run_server_step()
     if(state->total_ready_to_read == 0) {
       int result;
       fd_set read_fds = state->set;
+      struct timeval timeout;
 
 #ifdef DO_LOG
       if(MOD_DEBUG) {
@@ -904,9 +1127,14 @@ int cap_run_server_step()
 	fprintf(LOG, MOD_MSG _("run_server_step: calling select()\n"));
       }
 #endif
-      result = select(state->max_fd, &read_fds, 0, 0, 0 /* &timeout */);
+      timeout.tv_sec = timeout_ms / 1000;
+      timeout.tv_usec = (timeout_ms % 1000) * 1000;
+      result = select(state->max_fd, &read_fds, 0, 0,
+		      timeout_ms >= 0 ? &timeout : NULL);
       if(result < 0 && errno == EINTR) return 1;
       if(result < 0) { perror("select"); return 0; }
+      /* On timeout, the hook gets called on the next step. */
+      if(result == 0) return 1;
 
       for(conn = state->list.next;
 	  !conn->l.head && result > 0;
@@ -1092,6 +1320,97 @@ void cap_print_connections_info(FILE *fp)
     }
   }
 }
+
+/* Switches the tracer on or off.  Switching it on does not reset the
+   counts gathered earlier. */
+void cap_trace_enable(int enable)
+{
+  cap_trace_enabled = enable;
+}
+
+/* Called by generic_obj_call() with the time a call took. */
+void cap_trace_call(cap_t obj, long us)
+{
+  if(obj->vtable == &remote_obj_vtable) {
+    struct connection *conn = ((struct remote_obj *) obj)->conn;
+    if(conn) {
+      conn->stats.calls++;
+      conn->stats.call_us_total += us;
+      if(conn->stats.call_us_max < us) conn->stats.call_us_max = us;
+    }
+  }
+}
+
+static void print_conn_stats(FILE *fp, struct conn_stats *st)
+{
+  fprintf(fp, "in: %lu msgs, %lu bytes, %lu fds; "
+	  "out: %lu msgs, %lu bytes, %lu fds; "
+	  "export high water: %i, reused: %lu, compactions: %lu",
+	  st->msgs_in, st->bytes_in, st->fds_in,
+	  st->msgs_out, st->bytes_out, st->fds_out,
+	  st->export_high_water, st->exports_reused, st->compactions);
+  if(st->calls > 0) {
+    fprintf(fp, "; calls: %lu, avg %luus, max %lius",
+	    st->calls, st->call_us_total / st->calls, st->call_us_max);
+  }
+}
+
+void cap_print_trace_info(FILE *fp)
+{
+  struct connection *conn;
+  fprintf(fp, "cap-protocol trace (%s), pid %i:\n",
+	  cap_trace_enabled ? "on" : "off", getpid());
+  for(conn = server_state.list.next; !conn->l.head; conn = conn->l.next) {
+    fprintf(fp, "  %i/`%s' (fd %i, exports %i of %i): ",
+	    conn->conn_id, conn->name, conn->sock_fd,
+	    conn->export_count, conn->export_size);
+    print_conn_stats(fp, &conn->stats);
+    fprintf(fp, "\n");
+  }
+  if(server_state.closed_count > 0) {
+    fprintf(fp, "  %i closed connections: ", server_state.closed_count);
+    print_conn_stats(fp, &server_state.closed_stats);
+    fprintf(fp, "\n");
+  }
+}
+
+/* The dump is requested from a signal handler but printed from the
+   event loop, where it is safe to use stdio. */
+static void trace_check_dump(void)
+{
+  if(trace_dump_requested) {
+    trace_dump_requested = 0;
+    cap_print_trace_info(stderr);
+  }
+}
+
+#ifndef IN_LIBC
+static void trace_signal_handler(int sig)
+{
+  if(cap_trace_enabled) {
+    trace_dump_requested = 1;
+  }
+  else {
+    cap_trace_enabled = 1;
+  }
+}
+
+/* For servers: the first SIGUSR2 switches the tracer on, and later ones
+   print the counts to stderr.  The tracer also starts on if
+   PLASH_CAP_TRACE is set.  SA_RESTART is not used, so that a server
+   blocked waiting for a message wakes up to print the dump. */
+void cap_trace_install_signal_handler(void)
+{
+  struct sigaction act;
+  if(getenv("PLASH_CAP_TRACE")) {
+    cap_trace_enabled = 1;
+  }
+  memset(&act, 0, sizeof(act));
+  act.sa_handler = trace_signal_handler;
+  sigemptyset(&act.sa_mask);
+  sigaction(SIGUSR2, &act, NULL);
+}
+#endif
 #endif
 
 
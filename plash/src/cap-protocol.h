@@ -34,10 +34,25 @@ void cap_run_server(void);
 int cap_server_exporting(void);
 /* Returns 0 when there are no connections left to handle: */
 int cap_run_server_step(void);
+/* If set, cap_run_server_step() calls this before waiting for messages.
+   It can do any work that is due, and returns the number of
+   milliseconds the server may wait before calling it again, or -1 for
+   no limit.  The binary log uses this to write out buffered records. */
+extern int (*cap_server_timer_hook)(void);
 void cap_close_all_connections(void);
 
 void cap_print_connections_info(FILE *fp);
 
+#ifdef ENABLE_LOGGING
+extern int cap_trace_enabled;
+void cap_trace_enable(int enable);
+void cap_trace_call(cap_t obj, long us);
+void cap_print_trace_info(FILE *fp);
+#ifndef IN_LIBC
+void cap_trace_install_signal_handler(void);
+#endif
+#endif
+
 #ifdef GC_DEBUG
 void cap_mark_exported_objects(void);
 #endif
@@ -18,6 +18,7 @@
    USA.  */
 
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -280,6 +281,25 @@ int comm_read(struct comm *comm, int *err)
   return 1;
 }
 
+/* Reads the header of the message at the start of `block'.  Returns
+   the size of the whole message, including the header and padding,
+   and fills out `data_size' and `fds_count'.  The message's data
+   follows the header.  Returns 0 if `block' is shorter than a header,
+   or -1 if it does not start with a valid header.  This is also used
+   by the Python module's framing code. */
+int comm_message_size(seqf_t block, int *data_size, int *fds_count)
+{
+  int ok = 1;
+  if(block.size < COMM_HEADER_SIZE) return 0;
+  m_str(&ok, &block, "MSG!");
+  m_int(&ok, &block, data_size);
+  m_int(&ok, &block, fds_count);
+  if(!ok || *data_size < 0 || *fds_count < 0 ||
+     *data_size > INT_MAX - COMM_HEADER_SIZE - 3) return -1;
+  assert(sizeof(int) == 4); /* FIXME */
+  return COMM_HEADER_SIZE + ((*data_size + 3) & ~3);
+}
+
 /* Returns <0 if an error occurred;
    COMM_END at the end of the stream;
    COMM_AVAIL if a message was available (it's removed from the buffer in
@@ -288,22 +308,15 @@ int comm_read(struct comm *comm, int *err)
    COMM_UNAVAIL if the buffer doesn't contain a full message. */
 int comm_try_get(struct comm *comm, seqf_t *result_data, fds_t *result_fds)
 {
-  int header_size = 12;
-  seqf_t block_orig = { comm->buf + comm->pos, comm->got };
-  seqf_t block = block_orig;
+  seqf_t block = { comm->buf + comm->pos, comm->got };
   int size, size_fds;
-  int ok = 1;
-  m_str(&ok, &block, "MSG!");
-  m_int(&ok, &block, &size);
-  m_int(&ok, &block, &size_fds);
-  if(ok) {
-    int size_align = (size + 3) & ~3;
-    assert(sizeof(int) == 4); /* FIXME */
-    if(block.size >= size_align && comm->fds_got >= size_fds) {
-      seqf_t got_data = { block.data, size };
+  int msg_size = comm_message_size(block, &size, &size_fds);
+  if(msg_size > 0) {
+    if(comm->got >= msg_size && comm->fds_got >= size_fds) {
+      seqf_t got_data = { block.data + COMM_HEADER_SIZE, size };
       fds_t got_fds = { comm->fds_buf + comm->fds_pos, size_fds };
-      comm->pos += header_size + size_align;
-      comm->got -= header_size + size_align;
+      comm->pos += msg_size;
+      comm->got -= msg_size;
       comm->fds_pos += size_fds;
       comm->fds_got -= size_fds;
       *result_data = got_data;
@@ -311,7 +324,7 @@ int comm_try_get(struct comm *comm, seqf_t *result_data, fds_t *result_fds)
       return COMM_AVAIL;
     }
     else {
-      comm_resize(comm, 100, header_size + size_align);
+      comm_resize(comm, 100, msg_size);
       /* Resizing the FDs buffer here isn't actually very useful, because
 	 by the time we've received the header, recvmsg would have already
 	 tried to send the FDs and so would have overflowed the buffer. */
@@ -320,8 +333,8 @@ int comm_try_get(struct comm *comm, seqf_t *result_data, fds_t *result_fds)
     }
   }
   else {
-    assert(block_orig.size < header_size); /* otherwise we're out of sync with the sender */
-    comm_resize(comm, 100, header_size);
+    assert(msg_size == 0); /* otherwise we're out of sync with the sender */
+    comm_resize(comm, 100, COMM_HEADER_SIZE);
     return COMM_UNAVAIL;
   }
 }
@@ -41,9 +41,13 @@ struct comm {
 #define COMM_AVAIL 1
 #define COMM_UNAVAIL 2
 
+/* "MSG!", data size, FD count */
+#define COMM_HEADER_SIZE 12
+
 struct comm *comm_init(int sock);
 void comm_free(struct comm *comm);
 int comm_read(struct comm *comm, int *err);
+int comm_message_size(seqf_t block, int *data_size, int *fds_count);
 int comm_try_get(struct comm *comm, seqf_t *result_data, fds_t *result_fds);
 int comm_get(struct comm *comm, seqf_t *result_data, fds_t *result_fds);
 int comm_send(region_t r, int sock, seqt_t msg, fds_t fds);
@@ -20,10 +20,15 @@
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdlib.h>
+#include <elf.h>
+#include <link.h>
+#include <sys/stat.h>
 
 #include "region.h"
 #include "filesysobj.h"
 #include "resolve-filename.h"
+#include "exec.h"
 
 
 /* This function for opening executable files can generate a couple of
@@ -65,6 +70,137 @@ int open_executable_file(struct filesys_obj *obj, seqf_t cmd_filename, int *err)
 }
 
 
+/* The result of parsing the start of an executable file. */
+struct script_header {
+  int is_script; /* Whether the file starts with "#!" */
+  int err; /* Non-zero if the "#!" line is malformed */
+  seqf_t interp; /* Interpreter filename */
+  seqf_t arg; /* Optional argument to the interpreter; may be empty */
+};
+
+static void parse_script_header(const char *buf, int got,
+				struct script_header *h)
+{
+  int icmd_start, icmd_end;
+  int arg_start, arg_end;
+  int i = 2;
+
+  h->is_script = FALSE;
+  h->err = 0;
+  h->interp = seqf_empty;
+  h->arg = seqf_empty;
+
+  /* No whitespace is allowed before the "#!" */
+  if(!(got >= 2 && buf[0] == '#' && buf[1] == '!')) return;
+  h->is_script = TRUE;
+
+  /* Parse the #! line to find the interpreter filename, and an
+     optional argument for it. */
+  while(i < got && buf[i] == ' ') i++; /* Skip spaces */
+  if(i >= got) { h->err = EINVAL; return; }
+  icmd_start = i;
+  while(i < got && buf[i] != ' ' && buf[i] != '\n') i++; /* Skip to space */
+  if(i >= got) { h->err = EINVAL; return; }
+  icmd_end = i;
+  while(i < got && buf[i] == ' ') i++; /* Skip spaces */
+  if(i >= got) { h->err = EINVAL; return; }
+  arg_start = i;
+  while(i < got && buf[i] != '\n') i++; /* Skip to end of line */
+  if(i >= got) { h->err = EINVAL; return; }
+  arg_end = i;
+
+  h->interp.data = buf + icmd_start;
+  h->interp.size = icmd_end - icmd_start;
+  h->arg.data = buf + arg_start;
+  h->arg.size = arg_end - arg_start;
+}
+
+
+/* Cache of parsed headers of executable files, so that exec'ing the
+   same file repeatedly (as shell scripts tend to do) does not involve
+   reading it each time.  Entries are keyed on the file's identity
+   rather than its pathname, so they do not depend on the namespace.
+   They are revalidated by checking that the file's size, mtime and
+   ctime are unchanged, using one fstat() call on the opened file. */
+#define SCRIPT_CACHE_SIZE 64
+
+struct script_cache_entry {
+  int used;
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime, ctime;
+  struct script_header header; /* Strings are in `data' */
+  char *data; /* Allocated with malloc() */
+};
+
+static struct script_cache_entry script_cache[SCRIPT_CACHE_SIZE];
+
+static struct script_cache_entry *script_cache_slot(struct stat *st)
+{
+  return &script_cache[(st->st_ino ^ st->st_dev) % SCRIPT_CACHE_SIZE];
+}
+
+static int script_cache_lookup(struct stat *st, struct script_header *h)
+{
+  struct script_cache_entry *e = script_cache_slot(st);
+  if(e->used &&
+     e->dev == st->st_dev &&
+     e->ino == st->st_ino &&
+     e->size == st->st_size &&
+     e->mtime.tv_sec == st->st_mtim.tv_sec &&
+     e->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+     e->ctime.tv_sec == st->st_ctim.tv_sec &&
+     e->ctime.tv_nsec == st->st_ctim.tv_nsec) {
+    *h = e->header;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+static void script_cache_add(struct stat *st, struct script_header *h)
+{
+  struct script_cache_entry *e = script_cache_slot(st);
+  char *data = malloc(h->interp.size + h->arg.size + 1);
+  if(!data) return;
+  if(e->used) free(e->data);
+  memcpy(data, h->interp.data, h->interp.size);
+  memcpy(data + h->interp.size, h->arg.data, h->arg.size);
+  e->used = TRUE;
+  e->dev = st->st_dev;
+  e->ino = st->st_ino;
+  e->size = st->st_size;
+  e->mtime = st->st_mtim;
+  e->ctime = st->st_ctim;
+  e->data = data;
+  e->header = *h;
+  e->header.interp.data = data;
+  e->header.arg.data = data + h->interp.size;
+}
+
+/* Reads the start of the executable, or gets the result from the
+   cache.  Returns -1 if there's an error. */
+static int read_script_header(int exec_fd, char *buf, int buf_size,
+			      struct script_header *h, int *err)
+{
+  struct stat st;
+  int cacheable = fstat(exec_fd, &st) >= 0 && S_ISREG(st.st_mode);
+  int got = 0;
+
+  if(cacheable && script_cache_lookup(&st, h)) return 0;
+
+  while(got < buf_size) {
+    int x = read(exec_fd, buf + got, buf_size - got);
+    if(x < 0) { *err = errno; return -1; }
+    if(x == 0) break;
+    got += x;
+  }
+  parse_script_header(buf, got, h);
+  if(cacheable) script_cache_add(&st, h);
+  return 0;
+}
+
+
 /* Checks for executables that are scripts using the `#!' syntax. */
 /* This is not done recursively.  If there's a script that says it should
    be executed using another script, that won't work.  This is the
@@ -90,44 +226,22 @@ int exec_for_scripts
    int *err)
 {
   char buf[1024];
-  int got = 0;
-  
-  while(got < sizeof(buf)) {
-    int x = read(exec_fd, buf + got, sizeof(buf) - got);
-    if(x < 0) { *err = errno; return -1; }
-    if(x == 0) break;
-    got += x;
+  struct script_header h;
+
+  if(read_script_header(exec_fd, buf, sizeof(buf), &h, err) < 0) {
+    close(exec_fd);
+    return -1;
   }
 
-  /* No whitespace is allowed before the "#!" */
-  if(got >= 2 && buf[0] == '#' && buf[1] == '!') {
-    int icmd_start, icmd_end;
-    int arg_start, arg_end;
-    int i = 2;
-    seqf_t icmd;
+  if(h.is_script) {
+    seqf_t icmd = h.interp;
     region_t r2;
     struct filesys_obj *obj;
 
     close(exec_fd);
-
-    /* Parse the #! line to find the interpreter filename, and an
-       optional argument for it. */
-    while(i < got && buf[i] == ' ') i++; /* Skip spaces */
-    if(i >= got) { *err = EINVAL; return -1; }
-    icmd_start = i;
-    while(i < got && buf[i] != ' ' && buf[i] != '\n') i++; /* Skip to space */
-    if(i >= got) { *err = EINVAL; return -1; }
-    icmd_end = i;
-    while(i < got && buf[i] == ' ') i++; /* Skip spaces */
-    if(i >= got) { *err = EINVAL; return -1; }
-    arg_start = i;
-    while(i < got && buf[i] != '\n') i++; /* Skip to end of line */
-    if(i >= got) { *err = EINVAL; return -1; }
-    arg_end = i;
+    if(h.err) { *err = h.err; return -1; }
 
     /* Deal with the interpreter executable's filename. */
-    icmd.data = buf + icmd_start;
-    icmd.size = icmd_end - icmd_start;
     if(exec_fd_out) {
       int fd;
       r2 = region_make();
@@ -146,12 +260,11 @@ int exec_for_scripts
       *exec_filename_out = region_strdup_seqf(r, icmd);
     }
 
-    if(arg_end > arg_start) {
-      seqf_t arg = { buf + arg_start, arg_end - arg_start };
+    if(h.arg.size > 0) {
       int i;
       const char **argv2 = region_alloc(r, (argc + 2) * sizeof(char *));
       argv2[0] = region_strdup_seqf(r, icmd);
-      argv2[1] = region_strdup_seqf(r, arg);
+      argv2[1] = region_strdup_seqf(r, h.arg);
       argv2[2] = cmd;
       for(i = 1; i < argc; i++) argv2[i+2] = argv[i];
       *argc_out = argc + 2;
@@ -172,6 +285,8 @@ int exec_for_scripts
   else {
     /* Assume an ELF executable. */
     if(exec_fd_out) {
+      /* We might not have read from the FD. */
+      lseek(exec_fd, 0, SEEK_SET);
       *exec_fd_out = exec_fd;
     }
     else {
@@ -247,3 +362,319 @@ int resolve_executable_name(region_t r,
     return -1; /* Not found */
   }
 }
+
+
+/* Preloading libraries for ld.so */
+
+/* When ld.so starts a dynamically-linked program, it searches for and
+   opens each library in the program's DT_NEEDED closure, and every
+   open() -- including the ones that fail while searching a path -- is
+   a request to the server.  To save these round trips, the server can
+   work out the pathnames that ld.so will try and open them in advance.
+   The result is a table of pathnames with a FD for each, or -1 where
+   the pathname does not exist.  This does not have to match ld.so's
+   search exactly:  ld.so only consults the table for pathnames it was
+   going to open anyway, and asks the server about any others. */
+
+#define PRELOAD_MAX_ENTRIES 128
+#define PRELOAD_MAX_FDS 64
+#define PRELOAD_DEFAULT_PATH "/lib:/usr/lib"
+
+struct elf_deps {
+  int needed_count;
+  const char **needed;
+  const char *rpath, *runpath; /* May be NULL */
+};
+
+struct preload_state {
+  struct filesys_obj *root;
+  struct dir_stack *cwd;
+  int machine;
+  int fds_used;
+  struct exec_preload *result;
+};
+
+/* Reads a NUL-terminated string from the file.  Returns NULL on error. */
+static const char *elf_read_string(region_t r, int fd, off_t offset)
+{
+  char buf[256];
+  ssize_t got = pread(fd, buf, sizeof(buf), offset);
+  if(got > 0 && memchr(buf, 0, got))
+    return region_strdup(r, buf);
+  return NULL;
+}
+
+/* Converts an address to a file offset using the PT_LOAD segments. */
+static int elf_addr_to_offset(ElfW(Phdr) *phdrs, int phnum, ElfW(Addr) addr,
+			      off_t *offset)
+{
+  int i;
+  for(i = 0; i < phnum; i++) {
+    if(phdrs[i].p_type == PT_LOAD &&
+       phdrs[i].p_vaddr <= addr &&
+       addr < phdrs[i].p_vaddr + phdrs[i].p_filesz) {
+      *offset = addr - phdrs[i].p_vaddr + phdrs[i].p_offset;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/* Reads the DT_NEEDED, DT_RPATH and DT_RUNPATH entries of an ELF file.
+   Returns -1 if the file is not an ELF file of this machine's class,
+   or not for the machine `*machine' (if non-zero). */
+static int elf_read_deps(region_t r, int fd, int *machine,
+			 struct elf_deps *deps)
+{
+  ElfW(Ehdr) ehdr;
+  ElfW(Phdr) phdrs[64];
+  ElfW(Dyn) *dyn;
+  int dyn_count = 0;
+  int i;
+  ElfW(Addr) strtab = 0;
+  off_t strtab_offset;
+  int rpath = -1, runpath = -1;
+
+  deps->needed_count = 0;
+  deps->needed = NULL;
+  deps->rpath = NULL;
+  deps->runpath = NULL;
+
+  if(pread(fd, &ehdr, sizeof(ehdr), 0) != sizeof(ehdr) ||
+     memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 ||
+     ehdr.e_ident[EI_CLASS] != (sizeof(void *) == 8 ? ELFCLASS64 : ELFCLASS32) ||
+     ehdr.e_phentsize != sizeof(ElfW(Phdr)) ||
+     ehdr.e_phnum > sizeof(phdrs) / sizeof(phdrs[0]))
+    return -1;
+  if(*machine == 0)
+    *machine = ehdr.e_machine;
+  else if(ehdr.e_machine != *machine)
+    return -1;
+  if(pread(fd, phdrs, ehdr.e_phnum * sizeof(ElfW(Phdr)), ehdr.e_phoff) !=
+     ehdr.e_phnum * sizeof(ElfW(Phdr)))
+    return -1;
+
+  for(i = 0; i < ehdr.e_phnum; i++) {
+    if(phdrs[i].p_type == PT_DYNAMIC) {
+      dyn_count = phdrs[i].p_filesz / sizeof(ElfW(Dyn));
+      if(dyn_count > 1024) return -1;
+      dyn = region_alloc(r, dyn_count * sizeof(ElfW(Dyn)));
+      if(pread(fd, dyn, dyn_count * sizeof(ElfW(Dyn)), phdrs[i].p_offset) !=
+	 dyn_count * sizeof(ElfW(Dyn)))
+	return -1;
+      break;
+    }
+  }
+  /* Statically linked */
+  if(dyn_count == 0) return 0;
+
+  deps->needed = region_alloc(r, dyn_count * sizeof(char *));
+  for(i = 0; i < dyn_count && dyn[i].d_tag != DT_NULL; i++) {
+    switch(dyn[i].d_tag) {
+      case DT_STRTAB: strtab = dyn[i].d_un.d_ptr; break;
+      case DT_RPATH: rpath = i; break;
+      case DT_RUNPATH: runpath = i; break;
+    }
+  }
+  if(elf_addr_to_offset(phdrs, ehdr.e_phnum, strtab, &strtab_offset) < 0)
+    return -1;
+  for(i = 0; i < dyn_count && dyn[i].d_tag != DT_NULL; i++) {
+    if(dyn[i].d_tag == DT_NEEDED) {
+      const char *name =
+	elf_read_string(r, fd, strtab_offset + dyn[i].d_un.d_val);
+      if(!name) return -1;
+      deps->needed[deps->needed_count++] = name;
+    }
+  }
+  if(rpath >= 0)
+    deps->rpath = elf_read_string(r, fd, strtab_offset + dyn[rpath].d_un.d_val);
+  if(runpath >= 0)
+    deps->runpath =
+      elf_read_string(r, fd, strtab_offset + dyn[runpath].d_un.d_val);
+  return 0;
+}
+
+/* Looks up `pathname' in the table, adding it if it is not there
+   already.  Returns the index of the entry, or -1 if it could not be
+   added. */
+static int preload_entry(region_t r, struct preload_state *st,
+			 const char *pathname)
+{
+  struct exec_preload *result = st->result;
+  struct filesys_obj *obj;
+  int i, fd, err;
+
+  for(i = 0; i < result->count; i++) {
+    if(!strcmp(result->pathnames[i], pathname)) return i;
+  }
+  /* The table is passed on in an environment variable, using ':' as
+     a separator.  Only absolute pathnames mean the same thing to ld.so
+     later on. */
+  if(result->count >= PRELOAD_MAX_ENTRIES ||
+     pathname[0] != '/' || strchr(pathname, ':')) return -1;
+
+  {
+    region_t r2 = region_make();
+    obj = resolve_file(r2, st->root, st->cwd, seqf_string(pathname),
+		       SYMLINK_LIMIT, FALSE /* nofollow */, &err);
+    region_free(r2);
+  }
+  if(obj) {
+    if(st->fds_used < PRELOAD_MAX_FDS &&
+       obj->vtable->fsobj_type(obj) == OBJT_FILE)
+      fd = obj->vtable->open(obj, O_RDONLY, &err);
+    else
+      fd = -1;
+    filesys_obj_free(obj);
+    if(fd < 0) return -1;
+    st->fds_used++;
+  }
+  else if(err == ENOENT) {
+    fd = -1;
+  }
+  else return -1;
+
+  i = result->count++;
+  result->pathnames[i] = region_strdup(r, pathname);
+  result->fds[i] = fd;
+  return i;
+}
+
+/* Tries `name' in each directory in the colon-separated list `path'.
+   A leading "$ORIGIN" in a directory is replaced by `origin'.  Returns
+   the index of the entry for the first pathname that exists, or -1. */
+static int preload_search_path(region_t r, struct preload_state *st,
+			       const char *path, const char *origin,
+			       const char *name)
+{
+  seqf_t rest, dir;
+  if(!path) return -1;
+  rest = seqf_string(path);
+  while(parse_path(rest, &dir, &rest)) {
+    const char *d = region_strdup_seqf(r, dir);
+    int i;
+    if(!strncmp(d, "$ORIGIN", 7))
+      d = flatten_str(r, cat2(r, mk_string(r, origin), mk_string(r, d + 7)));
+    else if(!strncmp(d, "${ORIGIN}", 9))
+      d = flatten_str(r, cat2(r, mk_string(r, origin), mk_string(r, d + 9)));
+    /* Other substitutions, such as $LIB and $PLATFORM, are not handled. */
+    if(strchr(d, '$')) continue;
+
+    i = preload_entry(r, st, flatten_str(r, mk_printf(r, "%s/%s", d, name)));
+    if(i >= 0 && st->result->fds[i] >= 0) return i;
+  }
+  return -1;
+}
+
+static const char *dirname_of(region_t r, const char *pathname)
+{
+  const char *slash = strrchr(pathname, '/');
+  if(!slash) return ".";
+  if(slash == pathname) return "/";
+  {
+    seqf_t dir = { pathname, slash - pathname };
+    return region_strdup_seqf(r, dir);
+  }
+}
+
+/* Adds the libraries needed by an object to the table, following the
+   same search order as ld.so:  DT_RPATH (of the object, then the
+   executable) if there is no DT_RUNPATH, then LD_LIBRARY_PATH, then
+   DT_RUNPATH, then the default directories.  (/etc/ld.so.cache is not
+   consulted, so libraries found only through it are not preloaded.)
+   Appends the table indexes of newly-found libraries to `queue'. */
+static void preload_needed(region_t r, struct preload_state *st,
+			   struct elf_deps *deps, struct elf_deps *exe_deps,
+			   const char *origin, const char *lib_path,
+			   const char **seen, int *seen_count,
+			   int *queue, int *queue_count)
+{
+  int i, j;
+  for(i = 0; i < deps->needed_count; i++) {
+    const char *name = deps->needed[i];
+    int index = -1;
+
+    for(j = 0; j < *seen_count; j++) {
+      if(!strcmp(seen[j], name)) break;
+    }
+    if(j < *seen_count || *seen_count >= PRELOAD_MAX_ENTRIES) continue;
+    seen[(*seen_count)++] = name;
+
+    if(strchr(name, '/')) {
+      index = preload_entry(r, st, name);
+      if(index >= 0 && st->result->fds[index] < 0) index = -1;
+    }
+    else {
+      if(!deps->runpath) {
+	index = preload_search_path(r, st, deps->rpath, origin, name);
+	if(index < 0 && exe_deps != deps)
+	  index = preload_search_path(r, st, exe_deps->rpath, origin, name);
+      }
+      if(index < 0)
+	index = preload_search_path(r, st, lib_path, origin, name);
+      if(index < 0)
+	index = preload_search_path(r, st, deps->runpath, origin, name);
+      if(index < 0)
+	index = preload_search_path(r, st, PRELOAD_DEFAULT_PATH, origin, name);
+    }
+    if(index >= 0) {
+      for(j = 0; j < *queue_count; j++) {
+	if(queue[j] == index) break;
+      }
+      if(j == *queue_count) queue[(*queue_count)++] = index;
+    }
+  }
+}
+
+/* Fills out `result' with the libraries that ld.so will need in order
+   to run `executable', which is looked up in the given namespace.
+   `lib_path' is the process's LD_LIBRARY_PATH, or NULL.  The caller
+   takes ownership of the FDs in the result. */
+void exec_preload_libraries(region_t r,
+			    struct filesys_obj *root, struct dir_stack *cwd,
+			    const char *executable, const char *lib_path,
+			    struct exec_preload *result)
+{
+  struct preload_state st;
+  struct elf_deps exe_deps;
+  struct filesys_obj *obj;
+  const char **seen;
+  int seen_count = 0;
+  int *queue;
+  int queue_count = 0, i;
+  int fd, err;
+
+  result->count = 0;
+  result->pathnames = region_alloc(r, PRELOAD_MAX_ENTRIES * sizeof(char *));
+  result->fds = region_alloc(r, PRELOAD_MAX_ENTRIES * sizeof(int));
+  st.root = root;
+  st.cwd = cwd;
+  st.machine = 0;
+  st.fds_used = 0;
+  st.result = result;
+
+  obj = resolve_file(r, root, cwd, seqf_string(executable), SYMLINK_LIMIT,
+		     FALSE /* nofollow */, &err);
+  if(!obj) return;
+  fd = obj->vtable->open(obj, O_RDONLY, &err);
+  filesys_obj_free(obj);
+  if(fd < 0) return;
+  i = elf_read_deps(r, fd, &st.machine, &exe_deps);
+  close(fd);
+  if(i < 0) return;
+
+  seen = region_alloc(r, PRELOAD_MAX_ENTRIES * sizeof(char *));
+  queue = region_alloc(r, PRELOAD_MAX_ENTRIES * sizeof(int));
+  preload_needed(r, &st, &exe_deps, &exe_deps, dirname_of(r, executable),
+		 lib_path, seen, &seen_count, queue, &queue_count);
+  for(i = 0; i < queue_count; i++) {
+    int index = queue[i];
+    struct elf_deps deps;
+    /* pread() leaves the FD's offset at the start for ld.so. */
+    if(elf_read_deps(r, result->fds[index], &st.machine, &deps) < 0)
+      continue;
+    preload_needed(r, &st, &deps, &exe_deps,
+		   dirname_of(r, result->pathnames[index]),
+		   lib_path, seen, &seen_count, queue, &queue_count);
+  }
+}
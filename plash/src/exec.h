@@ -37,4 +37,17 @@ int resolve_executable_name(region_t r,
 			    const char **result);
 
 
+/* Libraries that the server has opened in advance for ld.so. */
+struct exec_preload {
+  int count;
+  const char **pathnames;
+  int *fds; /* -1 if the pathname does not exist */
+};
+
+void exec_preload_libraries(region_t r,
+			    struct filesys_obj *root, struct dir_stack *cwd,
+			    const char *executable, const char *lib_path,
+			    struct exec_preload *result);
+
+
 #endif
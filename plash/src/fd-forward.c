@@ -0,0 +1,452 @@
+/* Copyright (C) 2008 Mark Seaborn
+
+   This file is part of Plash.
+
+   Plash is free software; you can redistribute it and/or modify it
+   under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 2.1 of
+   the License, or (at your option) any later version.
+
+   Plash is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with Plash; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301,
+   USA.  */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <glib.h>
+
+#include "region.h"
+#include "fd-forward.h"
+
+
+/* The kernel's default pipe size is 64k.  Unprivileged processes can
+   raise it to 1M by default, so this will normally be granted. */
+#define FD_FORWARD_DEFAULT_SIZE (256 * 1024)
+
+
+struct flush_request {
+  /* The callback is due once total_written reaches this. */
+  long long target;
+  void (*f)(void *x);
+  void *x;
+  struct flush_request *next;
+};
+
+struct fd_forwarder {
+  int refs;
+  int source_fd; /* -1 after end-of-file or a read error */
+  int dest_fd; /* -1 once finished */
+  /* Internal pipe that holds data that has been read but not written. */
+  int pipe_read, pipe_write;
+  int buf_size;
+  /* Bytes read but not yet written: those in the pipe plus those in
+     out_buf. */
+  int buffered;
+  /* Set when the pipe has no free slots.  The pipe can fill up before
+     buffered reaches buf_size, because each splice() takes up a whole
+     slot however little it moves. */
+  int pipe_full;
+  /* Cleared when splice() is found not to work for that side. */
+  int splice_in, splice_out;
+  /* Only allocated when falling back to read()/write(). */
+  char *in_buf;
+  char *out_buf;
+  int out_start, out_end;
+  long long total_read, total_written;
+  struct flush_request *flushes; /* In order of target. */
+  GIOChannel *source_channel, *dest_channel;
+  guint source_watch, dest_watch;
+  GIOCondition source_cond, dest_cond;
+};
+
+static int active_count = 0;
+
+
+static gboolean source_handler(GIOChannel *ch, GIOCondition cond, void *obj);
+static gboolean dest_handler(GIOChannel *ch, GIOCondition cond, void *obj);
+
+
+static void fwd_unref(struct fd_forwarder *fwd)
+{
+  assert(fwd->refs > 0);
+  if(--fwd->refs == 0) {
+    assert(fwd->dest_fd < 0);
+    assert(!fwd->flushes);
+    free(fwd->in_buf);
+    free(fwd->out_buf);
+    free(fwd);
+  }
+}
+
+static int fd_has_access(int fd, int unwanted_mode)
+{
+  int flags = fcntl(fd, F_GETFL);
+  return flags >= 0 && (flags & O_ACCMODE) != unwanted_mode;
+}
+
+/* Tries to make the pipe big enough to hold `wanted' bytes.  Returns
+   the size it ended up with. */
+static int set_pipe_size(int fd, int wanted)
+{
+#ifdef F_SETPIPE_SZ
+  int size = fcntl(fd, F_SETPIPE_SZ, wanted);
+  if(size < 0) {
+    size = fcntl(fd, F_GETPIPE_SZ);
+  }
+  if(size > 0) {
+    return size;
+  }
+#endif
+  return PIPE_BUF;
+}
+
+/* Glib watches cannot be changed in place, so this replaces the watch
+   when the condition changes. */
+static void set_watch(struct fd_forwarder *fwd, GIOChannel *channel,
+		      guint *watch, GIOCondition *current, GIOCondition cond,
+		      GIOFunc handler)
+{
+  if(*current == cond) {
+    return;
+  }
+  if(*current) {
+    g_source_remove(*watch);
+  }
+  *current = cond;
+  if(cond) {
+    *watch = g_io_add_watch(channel, cond, handler, fwd);
+  }
+}
+
+static void update_watches(struct fd_forwarder *fwd)
+{
+  GIOCondition in_cond = 0;
+  GIOCondition out_cond = 0;
+  /* Not watching the source when the pipe is full is what provides
+     back pressure. */
+  if(fwd->source_fd >= 0 && fwd->buffered < fwd->buf_size &&
+     !fwd->pipe_full) {
+    in_cond = G_IO_IN | G_IO_HUP | G_IO_ERR;
+  }
+  /* The destination is always watched for errors, so that we stop
+     when its reader goes away even if there is nothing to write. */
+  if(fwd->dest_fd >= 0) {
+    out_cond = (fwd->buffered > 0 ? G_IO_OUT : 0) | G_IO_HUP | G_IO_ERR;
+  }
+  set_watch(fwd, fwd->source_channel, &fwd->source_watch, &fwd->source_cond,
+	    in_cond, source_handler);
+  set_watch(fwd, fwd->dest_channel, &fwd->dest_watch, &fwd->dest_cond,
+	    out_cond, dest_handler);
+}
+
+static void check_flushes(struct fd_forwarder *fwd)
+{
+  while(fwd->flushes &&
+	(fwd->dest_fd < 0 || fwd->total_written >= fwd->flushes->target)) {
+    struct flush_request *req = fwd->flushes;
+    fwd->flushes = req->next;
+    req->f(req->x);
+    free(req);
+  }
+}
+
+/* Called when the source has been read to the end and all the data
+   has been written, or when the destination becomes unwritable, in
+   which case any buffered data is discarded. */
+static void finish(struct fd_forwarder *fwd)
+{
+  if(fwd->dest_fd < 0) {
+    return;
+  }
+  fwd->refs++;
+  if(fwd->source_fd >= 0) {
+    close(fwd->source_fd);
+    fwd->source_fd = -1;
+  }
+  close(fwd->dest_fd);
+  fwd->dest_fd = -1;
+  close(fwd->pipe_read);
+  close(fwd->pipe_write);
+  fwd->buffered = 0;
+  update_watches(fwd);
+  g_io_channel_unref(fwd->source_channel);
+  g_io_channel_unref(fwd->dest_channel);
+  active_count--;
+  check_flushes(fwd);
+  fwd_unref(fwd); /* The event loop's reference */
+  fwd_unref(fwd);
+}
+
+static void source_finished(struct fd_forwarder *fwd)
+{
+  close(fwd->source_fd);
+  fwd->source_fd = -1;
+  if(fwd->buffered == 0) {
+    finish(fwd);
+  }
+}
+
+static int pipe_has_free_slot(struct fd_forwarder *fwd)
+{
+  struct pollfd pfd;
+  pfd.fd = fwd->pipe_write;
+  pfd.events = POLLOUT;
+  return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLOUT);
+}
+
+/* Reads from the source into the pipe.  This is only called when poll()
+   says that the source is readable, so it does not block. */
+static void fill(struct fd_forwarder *fwd)
+{
+  int space = fwd->buf_size - fwd->buffered;
+  ssize_t got = 0;
+  assert(fwd->source_fd >= 0);
+  assert(space > 0);
+  /* Otherwise splice() would give EAGAIN, and since the source is
+     still readable, the event loop would keep calling us.  Stop
+     watching the source until drain() has made room. */
+  if(!pipe_has_free_slot(fwd)) {
+    fwd->pipe_full = 1;
+    return;
+  }
+  if(fwd->splice_in) {
+    got = splice(fwd->source_fd, NULL, fwd->pipe_write, NULL, space,
+		 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if(got < 0 && (errno == EINVAL || errno == ENOSYS)) {
+      fwd->splice_in = 0;
+    }
+  }
+  if(!fwd->splice_in) {
+    if(!fwd->in_buf) {
+      fwd->in_buf = amalloc(fwd->buf_size);
+    }
+    /* Writes of up to PIPE_BUF bytes are atomic, and the pipe has a
+       free slot, so the write below cannot block or write short. */
+    if(space > PIPE_BUF) {
+      space = PIPE_BUF;
+    }
+    got = read(fwd->source_fd, fwd->in_buf, space);
+    if(got > 0) {
+      ssize_t written = write(fwd->pipe_write, fwd->in_buf, got);
+      assert(written == got);
+    }
+  }
+  if(got > 0) {
+    fwd->buffered += got;
+    fwd->total_read += got;
+  }
+  else if(got == 0 || (errno != EAGAIN && errno != EINTR)) {
+    /* read() can give ECONNRESET if the other end closed its
+       connection without reading everything it was sent. */
+    source_finished(fwd);
+  }
+}
+
+/* Writes from the pipe to the destination.  The destination FD may be
+   shared with other processes (for example, when it is a tty), so we
+   only set O_NONBLOCK on it for the duration of the call, as
+   write_nonblocking() in stream.py does. */
+static void drain(struct fd_forwarder *fwd)
+{
+  ssize_t written = 0;
+  int saved_errno;
+  int flags = fcntl(fwd->dest_fd, F_GETFL);
+  assert(fwd->buffered > 0);
+  if(flags >= 0) {
+    fcntl(fwd->dest_fd, F_SETFL, flags | O_NONBLOCK);
+  }
+  if(fwd->splice_out) {
+    written = splice(fwd->pipe_read, NULL, fwd->dest_fd, NULL, fwd->buffered,
+		     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if(written < 0 && (errno == EINVAL || errno == ENOSYS)) {
+      fwd->splice_out = 0;
+    }
+  }
+  if(!fwd->splice_out) {
+    if(fwd->out_start == fwd->out_end) {
+      ssize_t got;
+      if(!fwd->out_buf) {
+	fwd->out_buf = amalloc(fwd->buf_size);
+      }
+      got = read(fwd->pipe_read, fwd->out_buf, fwd->buffered);
+      assert(got > 0);
+      fwd->out_start = 0;
+      fwd->out_end = got;
+    }
+    written = write(fwd->dest_fd, fwd->out_buf + fwd->out_start,
+		    fwd->out_end - fwd->out_start);
+    if(written > 0) {
+      fwd->out_start += written;
+    }
+  }
+  saved_errno = errno;
+  if(flags >= 0) {
+    fcntl(fwd->dest_fd, F_SETFL, flags);
+  }
+
+  if(written > 0) {
+    fwd->pipe_full = 0;
+    fwd->buffered -= written;
+    fwd->total_written += written;
+    check_flushes(fwd);
+    if(fwd->source_fd < 0 && fwd->buffered == 0) {
+      finish(fwd);
+    }
+  }
+  else if(written < 0 && saved_errno != EAGAIN && saved_errno != EINTR) {
+    /* Typically EPIPE.  Python ignores SIGPIPE, so we get an error
+       instead of being killed. */
+    finish(fwd);
+  }
+}
+
+static gboolean source_handler(GIOChannel *ch, GIOCondition cond, void *obj)
+{
+  struct fd_forwarder *fwd = obj;
+  fwd->refs++;
+  if(fwd->source_fd >= 0 && fwd->buffered < fwd->buf_size) {
+    fill(fwd);
+    /* Try writing straight away rather than waiting for the next
+       iteration of the event loop.  This does nothing if the
+       destination is not ready. */
+    if(fwd->dest_fd >= 0 && fwd->buffered > 0) {
+      drain(fwd);
+    }
+  }
+  if(fwd->dest_fd >= 0) {
+    update_watches(fwd);
+  }
+  fwd_unref(fwd);
+  /* The watch is removed by update_watches() when necessary. */
+  return TRUE;
+}
+
+static gboolean dest_handler(GIOChannel *ch, GIOCondition cond, void *obj)
+{
+  struct fd_forwarder *fwd = obj;
+  fwd->refs++;
+  if((cond & G_IO_OUT) && fwd->dest_fd >= 0 && fwd->buffered > 0) {
+    drain(fwd);
+  }
+  if(fwd->dest_fd >= 0 && (cond & (G_IO_ERR | G_IO_HUP))) {
+    finish(fwd);
+  }
+  if(fwd->dest_fd >= 0) {
+    update_watches(fwd);
+  }
+  fwd_unref(fwd);
+  return TRUE;
+}
+
+struct fd_forwarder *fd_forward_make(int source_fd, int dest_fd,
+				     int buf_size, int *err)
+{
+  struct fd_forwarder *fwd;
+  int pipe_fds[2];
+  int i;
+
+  if(pipe(pipe_fds) < 0) {
+    *err = errno;
+    close(source_fd);
+    close(dest_fd);
+    return NULL;
+  }
+  for(i = 0; i < 2; i++) {
+    fcntl(pipe_fds[i], F_SETFL, O_NONBLOCK);
+    fcntl(pipe_fds[i], F_SETFD, FD_CLOEXEC);
+  }
+  if(buf_size <= 0) {
+    buf_size = FD_FORWARD_DEFAULT_SIZE;
+  }
+  i = set_pipe_size(pipe_fds[1], buf_size);
+  if(buf_size > i) {
+    buf_size = i;
+  }
+
+  fwd = amalloc(sizeof(struct fd_forwarder));
+  fwd->refs = 2; /* The caller's and the event loop's */
+  fwd->source_fd = source_fd;
+  fwd->dest_fd = dest_fd;
+  fwd->pipe_read = pipe_fds[0];
+  fwd->pipe_write = pipe_fds[1];
+  fwd->buf_size = buf_size;
+  fwd->buffered = 0;
+  fwd->pipe_full = 0;
+  fwd->splice_in = 1;
+  fwd->splice_out = 1;
+  fwd->in_buf = NULL;
+  fwd->out_buf = NULL;
+  fwd->out_start = 0;
+  fwd->out_end = 0;
+  fwd->total_read = 0;
+  fwd->total_written = 0;
+  fwd->flushes = NULL;
+  fwd->source_channel = g_io_channel_unix_new(source_fd);
+  fwd->dest_channel = g_io_channel_unix_new(dest_fd);
+  fwd->source_cond = 0;
+  fwd->dest_cond = 0;
+  active_count++;
+
+  if(!fd_has_access(dest_fd, O_RDONLY)) {
+    finish(fwd);
+  }
+  else if(!fd_has_access(source_fd, O_WRONLY)) {
+    source_finished(fwd);
+  }
+  else {
+    update_watches(fwd);
+  }
+  return fwd;
+}
+
+void fd_forward_free(struct fd_forwarder *fwd)
+{
+  fwd_unref(fwd);
+}
+
+void fd_forward_flush(struct fd_forwarder *fwd,
+		      void (*f)(void *x), void *x)
+{
+  struct flush_request *req, **tail;
+  int pending = 0;
+
+  if(fwd->dest_fd < 0) {
+    f(x);
+    return;
+  }
+  /* Rather than reading everything that is available now, which the
+     pipe might not have room for, note how much there is to read. */
+  if(fwd->source_fd >= 0 &&
+     ioctl(fwd->source_fd, FIONREAD, &pending) < 0) {
+    pending = 0;
+  }
+  req = amalloc(sizeof(struct flush_request));
+  req->target = fwd->total_read + pending;
+  req->f = f;
+  req->x = x;
+  req->next = NULL;
+  for(tail = &fwd->flushes; *tail; tail = &(*tail)->next) {}
+  *tail = req;
+
+  fwd->refs++;
+  check_flushes(fwd);
+  fwd_unref(fwd);
+}
+
+int fd_forward_active_count(void)
+{
+  return active_count;
+}
@@ -0,0 +1,63 @@
+/* Copyright (C) 2008 Mark Seaborn
+
+   This file is part of Plash.
+
+   Plash is free software; you can redistribute it and/or modify it
+   under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 2.1 of
+   the License, or (at your option) any later version.
+
+   Plash is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with Plash; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301,
+   USA.  */
+
+#ifndef plash_fd_forward_h
+#define plash_fd_forward_h
+
+
+/* Copies data from one file descriptor to another using the Glib
+   event loop, in the same way as FDForwarder in
+   plash/comms/stream.py.  This is used for proxying a sandboxed
+   program's stdin/stdout/stderr.
+
+   Data is moved with splice() through an internal pipe, so it does
+   not pass through user space unless one of the FDs does not support
+   splice() (such as a tty), in which case read()/write() is used for
+   that side.  At most buf_size bytes are held in the pipe at a time;
+   when the destination is not being read, the forwarder stops reading
+   from the source. */
+
+struct fd_forwarder;
+
+/* Starts forwarding.  Takes ownership of both FDs, even on error.
+   buf_size may be 0 to use the default.  Returns NULL on error.
+
+   The forwarder keeps running until the source reaches end-of-file
+   and everything has been written, or until the destination becomes
+   unwritable.  At that point it closes the FDs itself, so the caller
+   can drop its reference earlier with fd_forward_free(). */
+struct fd_forwarder *fd_forward_make(int source_fd, int dest_fd,
+				     int buf_size, int *err);
+
+/* Drops the caller's reference.  This does not stop forwarding. */
+void fd_forward_free(struct fd_forwarder *fwd);
+
+/* Reads any data that is currently available from the source, and
+   calls f(x) once it has been written to the destination (or once the
+   destination becomes unwritable).  f may be called before this
+   returns. */
+void fd_forward_flush(struct fd_forwarder *fwd,
+		      void (*f)(void *x), void *x);
+
+/* Returns the number of forwarders that have not finished yet, for
+   deciding whether the event loop needs to keep running. */
+int fd_forward_active_count(void);
+
+
+#endif
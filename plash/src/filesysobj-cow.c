@@ -18,15 +18,26 @@
    USA.  */
 
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
 
 #include "region.h"
 #include "serialise.h"
 #include "cap-protocol.h"
 #include "filesysobj-readonly.h"
+#include "filesysobj-real.h"
 #include "filesysobj-union.h"
 
 
 DECLARE_VTABLE(cow_dir_vtable);
+DECLARE_VTABLE(cow_file_vtable);
 
 /* Parent and children nodes are linked together.  The following
    operations use this:
@@ -43,8 +54,19 @@ DECLARE_VTABLE(cow_dir_vtable);
    A parent can only be freed when its children are freed.
    The parent has only weak references to its children, so the
    children can be freed before the parent is freed.
+
+   Deleting entries that exist in the read layer is done by recording
+   a "whiteout" in the write layer, following the convention used by
+   aufs:  an empty file ".wh.NAME" hides NAME in the read layer.  A
+   directory containing ".wh..wh..opq" is "opaque":  the read layer's
+   directory of the same name is ignored.  This is used when a
+   directory is deleted and then re-created.  Names starting with
+   ".wh." are reserved and are not visible through the cow_dir.
 */
 
+#define WHITEOUT_PREFIX ".wh."
+#define OPAQUE_MARKER ".wh..wh..opq"
+
 struct cow_dir {
   struct filesys_obj hdr;
 
@@ -59,10 +81,55 @@ struct cow_dir {
      parent's "children" field. */
   char *name; /* malloc'd */
   struct cow_dir *next; /* Non-owning reference */
+  /* Set when the directory has been removed or renamed, which takes
+     the node out of its parent's list. */
+  int detached;
+
+  /* Whether the read layer is hidden by an opaque marker. */
+  int opaque;
+
+  /* Invalidated by changes made through this object.  Changes made
+     by other means are caught by checking the layers' timestamps. */
+  struct merged_list_cache list_cache;
+};
+
+
+/* A file that was found in the read layer.  It is copied up into the
+   write layer the first time it is opened for writing (or its
+   metadata is changed).  After that, all operations go to the copy. */
+struct cow_file {
+  struct filesys_obj hdr;
+
+  struct cow_dir *parent; /* Owning reference */
+  char *name; /* malloc'd */
+  struct filesys_obj *file_read;
+  struct filesys_obj *file_write; /* NULL until copied up */
 };
 
 
 static int realize(struct cow_dir *dir, int *err);
+static int is_whited_out(struct cow_dir *dir, const char *leaf);
+
+
+static int is_reserved_name(const char *leaf)
+{
+  return !strncmp(leaf, WHITEOUT_PREFIX, strlen(WHITEOUT_PREFIX));
+}
+
+static int layer_has_entry(struct filesys_obj *dir, const char *leaf)
+{
+  struct filesys_obj *obj = dir->vtable->traverse(dir, leaf);
+  if(obj) {
+    filesys_obj_free(obj);
+    return 1;
+  }
+  return 0;
+}
+
+static int is_opaque(struct filesys_obj *dir_write)
+{
+  return dir_write && layer_has_entry(dir_write, OPAQUE_MARKER);
+}
 
 
 struct filesys_obj *
@@ -77,6 +144,9 @@ make_cow_dir(struct filesys_obj *dir_write,
   dir->name = NULL;
   dir->children = NULL;
   dir->next = NULL;
+  dir->detached = 0;
+  dir->opaque = is_opaque(dir_write);
+  merged_list_cache_init(&dir->list_cache);
   return (struct filesys_obj *) dir;
 }
 
@@ -87,8 +157,9 @@ void cow_dir_free(struct filesys_obj *obj)
   
   if(dir->dir_write) { filesys_obj_free(dir->dir_write); }
   filesys_obj_free(dir->dir_read);
+  merged_list_cache_clear(&dir->list_cache);
 
-  if(dir->parent) {
+  if(dir->parent && !dir->detached) {
     /* Unlink from parent's list. */
     int found = 0;
     struct cow_dir **node;
@@ -100,9 +171,9 @@ void cow_dir_free(struct filesys_obj *obj)
       }
     }
     assert(found);
-    
+  }
+  if(dir->parent) {
     free(dir->name);
-
     filesys_obj_free(dir->parent);
   }
 }
@@ -173,6 +244,9 @@ make_subdir(struct cow_dir *parent, const char *name,
   subdir->name = strdup(name);
   assert(subdir->name);
   subdir->children = NULL;
+  subdir->detached = 0;
+  subdir->opaque = is_opaque(dir_write);
+  merged_list_cache_init(&subdir->list_cache);
   
   /* Link into list. */
   subdir->next = parent->children;
@@ -181,14 +255,20 @@ make_subdir(struct cow_dir *parent, const char *name,
   return (struct filesys_obj *) subdir;
 }
 
-/* write_dir is a non-owning reference.
-   file is an owning reference. */
+/* file is an owning reference. */
 static struct filesys_obj *
-make_cow_file(struct filesys_obj *write_dir, const char *name,
+make_cow_file(struct cow_dir *parent, const char *name,
 	      struct filesys_obj *file)
 {
-  /* Temporary */
-  return make_read_only_proxy(file);
+  struct cow_file *obj =
+    filesys_obj_make(sizeof(struct cow_file), &cow_file_vtable);
+  inc_ref((struct filesys_obj *) parent);
+  obj->parent = parent;
+  obj->name = strdup(name);
+  assert(obj->name);
+  obj->file_read = file;
+  obj->file_write = NULL;
+  return (struct filesys_obj *) obj;
 }
 
 struct filesys_obj *cow_dir_traverse(struct filesys_obj *obj, const char *leaf)
@@ -199,6 +279,10 @@ struct filesys_obj *cow_dir_traverse(struct filesys_obj *obj, const char *leaf)
   struct filesys_obj *child2;
   int type1;
   int type2;
+
+  if(is_reserved_name(leaf)) {
+    return NULL;
+  }
   
   /* Look up child node first. */
   struct cow_dir *node;
@@ -219,9 +303,16 @@ struct filesys_obj *cow_dir_traverse(struct filesys_obj *obj, const char *leaf)
     child1 = NULL;
   }
   
-  child2 = dir->dir_read->vtable->traverse(dir->dir_read, leaf);
-  if(child2) {
-    type2 = child2->vtable->fsobj_type(child2);
+  /* A whiteout and an entry of the same name cannot both exist in
+     the write layer, so only look for a whiteout if there is no entry. */
+  if(!dir->opaque && (child1 || !is_whited_out(dir, leaf))) {
+    child2 = dir->dir_read->vtable->traverse(dir->dir_read, leaf);
+    if(child2) {
+      type2 = child2->vtable->fsobj_type(child2);
+    }
+  }
+  else {
+    child2 = NULL;
   }
 
   /* If not present in write layer: */
@@ -234,9 +325,14 @@ struct filesys_obj *cow_dir_traverse(struct filesys_obj *obj, const char *leaf)
       /* Directory will be created on demand in the write layer. */
       return make_subdir(dir /* parent */, leaf, NULL /* child1 */, child2);
     }
-    else {
+    else if(type2 == OBJT_FILE) {
       /* File was found in read layer. */
-      return make_cow_file(dir->dir_write, leaf, child2);
+      return make_cow_file(dir /* parent */, leaf, child2);
+    }
+    else {
+      /* Symlinks cannot be modified in place, so there is no need to
+	 copy them up. */
+      return make_read_only_proxy(child2);
     }
   }
 
@@ -253,12 +349,88 @@ struct filesys_obj *cow_dir_traverse(struct filesys_obj *obj, const char *leaf)
   return child1;
 }
 
+static int sort_seqf_compare(const void *p1, const void *p2)
+{
+  return seqf_compare(*(seqf_t *) p1, *(seqf_t *) p2);
+}
+
+/* Removes whiteouts, and the entries they hide, from a listing. */
+static int filter_whiteouts(region_t r, seqt_t *list, int count, int *err)
+{
+  seqf_t prefix = seqf_string(WHITEOUT_PREFIX);
+  seqf_t buf = flatten(r, *list);
+  seqf_t *hidden;
+  int hidden_count = 0;
+  int i;
+
+  /* Collect the names that are hidden.  Usually there are none. */
+  hidden = region_alloc(r, count * sizeof(seqf_t));
+  for(i = 0; i < count; i++) {
+    int inode, type;
+    seqf_t name;
+    int ok = 1;
+    m_int(&ok, &buf, &inode);
+    m_int(&ok, &buf, &type);
+    m_lenblock(&ok, &buf, &name);
+    if(!ok) { *err = EIO; return -1; }
+    if(name.size >= prefix.size &&
+       !memcmp(name.data, prefix.data, prefix.size)) {
+      hidden[hidden_count].data = name.data + prefix.size;
+      hidden[hidden_count].size = name.size - prefix.size;
+      hidden_count++;
+    }
+  }
+  if(hidden_count == 0) {
+    return count;
+  }
+  qsort(hidden, hidden_count, sizeof(seqf_t), sort_seqf_compare);
+
+  {
+    cbuf_t out = cbuf_make(r, 100);
+    int out_count = 0;
+    buf = flatten(r, *list);
+    for(i = 0; i < count; i++) {
+      int inode, type;
+      seqf_t name;
+      int ok = 1;
+      m_int(&ok, &buf, &inode);
+      m_int(&ok, &buf, &type);
+      m_lenblock(&ok, &buf, &name);
+      if(!ok) { *err = EIO; return -1; }
+      if((name.size >= prefix.size &&
+	  !memcmp(name.data, prefix.data, prefix.size)) ||
+	 bsearch(&name, hidden, hidden_count, sizeof(seqf_t),
+		 sort_seqf_compare)) {
+	continue;
+      }
+      cbuf_put_int(out, inode);
+      cbuf_put_int(out, type);
+      cbuf_put_int(out, name.size);
+      cbuf_put_seqf(out, name);
+      out_count++;
+    }
+    *list = seqt_of_cbuf(out);
+    return out_count;
+  }
+}
+
 int cow_dir_list(struct filesys_obj *obj, region_t r, seqt_t *result, int *err)
 {
   struct cow_dir *dir = (void *) obj;
 
   if(dir->dir_write) {
-    return merge_dir_lists(r, dir->dir_write, dir->dir_read, result, err);
+    int count;
+    if(dir->opaque) {
+      count = dir->dir_write->vtable->list(dir->dir_write, r, result, err);
+    }
+    else {
+      count = merge_dir_lists(r, dir->dir_write, dir->dir_read,
+			      &dir->list_cache, result, err);
+    }
+    if(count < 0) {
+      return -1;
+    }
+    return filter_whiteouts(r, result, count, err);
   }
   else {
     /* No merging required:  return dir_read's list. */
@@ -266,30 +438,37 @@ int cow_dir_list(struct filesys_obj *obj, region_t r, seqt_t *result, int *err)
   }
 }
 
-/* Ensure that the directory has been created in the writable layer.
-   Recursively traverses the parent links to create the necessary
-   directories. */
-/* Post-condition:  dir->dir_write is non-NULL. */
-static int realize(struct cow_dir *dir, int *err)
+/* Creates `dir' in the write layer, given that its parent exists
+   there. */
+static int realize_one(struct cow_dir *dir, int *err)
 {
-  if(!dir->dir_write) {
-    struct stat st;
-    struct filesys_obj *p, *old_dir, *new_dir;
-    
-    assert(dir->parent);
-    if(realize(dir->parent, err) < 0) {
-      return -1;
-    }
+  struct stat st;
+  struct filesys_obj *p, *old_dir, *new_dir;
+
+  if(dir->detached) {
+    /* The directory has been removed. */
+    *err = ENOENT;
+    return -1;
+  }
 
-    /* Stat the directory in the read layer, just to find out its
-       permissions mode, so that we can create the new directory with
-       the same permissions. */
-    if(dir->dir_read->vtable->fsobj_stat(dir->dir_read, &st, err) < 0) {
+  /* Stat the directory in the read layer, just to find out its
+     permissions mode, so that we can create the new directory with
+     the same permissions. */
+  if(dir->dir_read->vtable->fsobj_stat(dir->dir_read, &st, err) < 0) {
+    return -1;
+  }
+
+  /* Create the new directory, and get a reference to it. */
+  p = dir->parent->dir_write;
+  if(p->vtable == &real_dir_vtable) {
+    /* Avoids going through traverse(), which stats the new
+       directory by name before opening it. */
+    new_dir = real_dir_mkdir_open(p, dir->name, st.st_mode & 07777, err);
+    if(!new_dir) {
       return -1;
     }
-
-    /* Create the new directory, and get a reference to it. */
-    p = dir->parent->dir_write;
+  }
+  else {
     if(p->vtable->mkdir(p, dir->name, st.st_mode, err) < 0) {
       if(*err != EEXIST) {
 	return -1;
@@ -301,31 +480,214 @@ static int realize(struct cow_dir *dir, int *err)
       *err = ENOENT;
       return -1;
     }
-    old_dir = dir->dir_write;
-    dir->dir_write = new_dir;
-    if(old_dir) {
-      /* This should only happen if the function got re-entered. */
-      filesys_obj_free(old_dir);
+  }
+  old_dir = dir->dir_write;
+  dir->dir_write = new_dir;
+  if(old_dir) {
+    /* This should only happen if the function got re-entered. */
+    filesys_obj_free(old_dir);
+  }
+  return 0;
+}
+
+/* Ensure that the directory has been created in the writable layer.
+   Creates all the missing ancestors in one pass, starting from the
+   deepest one that already exists.  Each node keeps its new write
+   layer directory, so siblings and later calls do not repeat work. */
+/* Post-condition:  dir->dir_write is non-NULL. */
+static int realize(struct cow_dir *dir, int *err)
+{
+  struct cow_dir **chain;
+  struct cow_dir *node;
+  int depth = 0;
+  int i;
+
+  for(node = dir; !node->dir_write; node = node->parent) {
+    assert(node->parent);
+    depth++;
+  }
+  if(depth == 0) {
+    return 0;
+  }
+
+  chain = amalloc(depth * sizeof(struct cow_dir *));
+  i = depth;
+  for(node = dir; !node->dir_write; node = node->parent) {
+    chain[--i] = node;
+  }
+  for(i = 0; i < depth; i++) {
+    if(!chain[i]->dir_write && realize_one(chain[i], err) < 0) {
+      free(chain);
+      return -1;
     }
   }
+  free(chain);
   return 0;
 }
 
-static int exists_in_read_layer(struct cow_dir *dir, const char *leaf)
+/* Fills out `buf' with the name of the whiteout for `leaf'. */
+static int whiteout_name(char *buf, size_t size, const char *leaf, int *err)
 {
-  struct filesys_obj *obj =
-    dir->dir_read->vtable->traverse(dir->dir_read, leaf);
-  if(obj) {
-    filesys_obj_free(obj);
-    return 1;
+  if(snprintf(buf, size, "%s%s", WHITEOUT_PREFIX, leaf) >= (int) size) {
+    *err = ENAMETOOLONG;
+    return -1;
   }
-  else {
+  return 0;
+}
+
+static int is_whited_out(struct cow_dir *dir, const char *leaf)
+{
+  char name[NAME_MAX + 1];
+  int err;
+  return dir->dir_write &&
+    whiteout_name(name, sizeof(name), leaf, &err) == 0 &&
+    layer_has_entry(dir->dir_write, name);
+}
+
+/* Creates an empty file to use as a marker. */
+static int make_marker(struct filesys_obj *dir, const char *name, int *err)
+{
+  int fd = dir->vtable->create_file(dir, name, O_WRONLY, 0600, err);
+  if(fd < 0) {
+    return *err == EEXIST ? 0 : -1;
+  }
+  close(fd);
+  return 0;
+}
+
+static int add_whiteout(struct cow_dir *dir, const char *leaf, int *err)
+{
+  char name[NAME_MAX + 1];
+  if(whiteout_name(name, sizeof(name), leaf, err) < 0 ||
+     realize(dir, err) < 0) {
+    return -1;
+  }
+  return make_marker(dir->dir_write, name, err);
+}
+
+static void remove_whiteout(struct cow_dir *dir, const char *leaf)
+{
+  char name[NAME_MAX + 1];
+  int err;
+  if(whiteout_name(name, sizeof(name), leaf, &err) == 0) {
+    dir->dir_write->vtable->unlink(dir->dir_write, name, &err);
+  }
+}
+
+/* Makes the directory `leaf' in the write layer hide the read
+   layer's directory of the same name. */
+static int make_opaque(struct cow_dir *dir, const char *leaf, int *err)
+{
+  struct filesys_obj *subdir =
+    dir->dir_write->vtable->traverse(dir->dir_write, leaf);
+  int rc;
+  if(!subdir) {
+    *err = ENOENT;
+    return -1;
+  }
+  rc = make_marker(subdir, OPAQUE_MARKER, err);
+  filesys_obj_free(subdir);
+  return rc;
+}
+
+/* Removes whiteouts and the opaque marker from the directory `leaf'
+   in the write layer, so that it can be removed or replaced.  The
+   directory must appear empty through the cow_dir. */
+static int clear_markers(struct cow_dir *dir, const char *leaf, int *err)
+{
+  struct filesys_obj *subdir =
+    dir->dir_write->vtable->traverse(dir->dir_write, leaf);
+  region_t r;
+  seqt_t list;
+  seqf_t buf;
+  int count, i;
+  if(!subdir) {
+    return 0;
+  }
+  r = region_make();
+  count = subdir->vtable->list(subdir, r, &list, err);
+  buf = flatten(r, list);
+  for(i = 0; i < count; i++) {
+    int inode, type;
+    seqf_t name;
+    int ok = 1;
+    m_int(&ok, &buf, &inode);
+    m_int(&ok, &buf, &type);
+    m_lenblock(&ok, &buf, &name);
+    if(ok) {
+      char *leaf2 = strdup_seqf(name);
+      int unused_err;
+      if(is_reserved_name(leaf2)) {
+	subdir->vtable->unlink(subdir, leaf2, &unused_err);
+      }
+      free(leaf2);
+    }
+  }
+  region_free(r);
+  filesys_obj_free(subdir);
+  return count < 0 ? -1 : 0;
+}
+
+/* Takes the node for the directory `leaf' out of the list of
+   children, so that later lookups do not return it. */
+static void forget_child(struct cow_dir *dir, const char *leaf)
+{
+  struct cow_dir **node;
+  for(node = &dir->children; *node; node = &(*node)->next) {
+    if(!strcmp((*node)->name, leaf)) {
+      struct cow_dir *child = *node;
+      *node = child->next;
+      child->next = NULL;
+      child->detached = 1;
+      return;
+    }
+  }
+}
+
+/* Returns the type of `leaf' as seen through the cow_dir, or -1 if
+   it does not exist.  If it is a directory and `empty' is non-NULL,
+   sets *empty to indicate whether it has no entries. */
+static int view_type(struct cow_dir *dir, const char *leaf, int *empty)
+{
+  struct filesys_obj *obj = cow_dir_traverse((struct filesys_obj *) dir, leaf);
+  int type;
+  if(!obj) {
+    return -1;
+  }
+  type = obj->vtable->fsobj_type(obj);
+  if(type == OBJT_DIR && empty) {
+    region_t r = region_make();
+    seqt_t list;
+    int err;
+    *empty = obj->vtable->list(obj, r, &list, &err) == 0;
+    region_free(r);
+  }
+  filesys_obj_free(obj);
+  return type;
+}
+
+static int exists_in_read_layer(struct cow_dir *dir, const char *leaf)
+{
+  if(dir->opaque || is_whited_out(dir, leaf)) {
     return 0;
   }
+  return layer_has_entry(dir->dir_read, leaf);
 }
 
-static int creation_check(struct cow_dir *dir, const char *leaf, int *err)
+static int exists_in_write_layer(struct cow_dir *dir, const char *leaf)
 {
+  return dir->dir_write && layer_has_entry(dir->dir_write, leaf);
+}
+
+/* Sets *whited_out if the new entry is replacing a deleted entry from
+   the read layer. */
+static int creation_check(struct cow_dir *dir, const char *leaf,
+			  int *whited_out, int *err)
+{
+  if(is_reserved_name(leaf)) {
+    *err = EPERM;
+    return -1;
+  }
   if(exists_in_read_layer(dir, leaf)) {
     *err = EEXIST;
     return -1;
@@ -333,119 +695,522 @@ static int creation_check(struct cow_dir *dir, const char *leaf, int *err)
   if(realize(dir, err) < 0) {
     return -1;
   }
+  *whited_out = !dir->opaque && is_whited_out(dir, leaf);
+  merged_list_cache_clear(&dir->list_cache);
   return 0;
 }
 
 int cow_dir_mkdir(struct filesys_obj *obj, const char *leaf, int mode, int *err)
 {
   struct cow_dir *dir = (void *) obj;
+  int whited_out;
 
-  if(creation_check(dir, leaf, err) < 0) {
+  if(creation_check(dir, leaf, &whited_out, err) < 0 ||
+     dir->dir_write->vtable->mkdir(dir->dir_write, leaf, mode, err) < 0) {
     return -1;
   }
-  return dir->dir_write->vtable->mkdir(dir->dir_write, leaf, mode, err);
+  if(whited_out) {
+    /* The read layer's directory must not show through. */
+    if(make_opaque(dir, leaf, err) < 0) {
+      return -1;
+    }
+    remove_whiteout(dir, leaf);
+  }
+  return 0;
 }
 
 int cow_dir_create_file(struct filesys_obj *obj, const char *leaf,
 			int flags, int mode, int *err)
 {
   struct cow_dir *dir = (void *) obj;
+  int whited_out;
+  int fd;
   
-  if(creation_check(dir, leaf, err) < 0) {
+  if(creation_check(dir, leaf, &whited_out, err) < 0) {
     return -1;
   }
-  return dir->dir_write->vtable->create_file(dir->dir_write, leaf,
-					     flags, mode, err);
+  fd = dir->dir_write->vtable->create_file(dir->dir_write, leaf,
+					   flags, mode, err);
+  if(fd >= 0 && whited_out) {
+    remove_whiteout(dir, leaf);
+  }
+  return fd;
 }
 
 int cow_dir_symlink(struct filesys_obj *obj, const char *leaf,
 		    const char *oldpath, int *err)
 {
   struct cow_dir *dir = (void *) obj;
+  int whited_out;
   
-  if(creation_check(dir, leaf, err) < 0) {
+  if(creation_check(dir, leaf, &whited_out, err) < 0 ||
+     dir->dir_write->vtable->symlink(dir->dir_write, leaf, oldpath, err) < 0) {
     return -1;
   }
-  return dir->dir_write->vtable->symlink(dir->dir_write, leaf, oldpath, err);
+  if(whited_out) {
+    remove_whiteout(dir, leaf);
+  }
+  return 0;
 }
 
 int cow_dir_unlink(struct filesys_obj *obj, const char *leaf, int *err)
 {
   struct cow_dir *dir = (void *) obj;
-  
-  if(exists_in_read_layer(dir, leaf)) {
-    /* Deleting files that are present in the read layer is not
-       supported. */
-    *err = EPERM;
+  int in_read, in_write;
+
+  if(is_reserved_name(leaf)) {
+    *err = ENOENT;
     return -1;
   }
-  if(!dir->dir_write) {
+  in_read = exists_in_read_layer(dir, leaf);
+  in_write = exists_in_write_layer(dir, leaf);
+  if(!in_read && !in_write) {
     *err = ENOENT;
     return -1;
   }
-  return dir->dir_write->vtable->unlink(dir->dir_write, leaf, err);
+  merged_list_cache_clear(&dir->list_cache);
+  if(in_write) {
+    if(dir->dir_write->vtable->unlink(dir->dir_write, leaf, err) < 0) {
+      return -1;
+    }
+  }
+  else if(view_type(dir, leaf, NULL) == OBJT_DIR) {
+    *err = EISDIR;
+    return -1;
+  }
+  if(in_read) {
+    /* Hide the read layer's entry. */
+    return add_whiteout(dir, leaf, err);
+  }
+  return 0;
 }
 
 int cow_dir_rmdir(struct filesys_obj *obj, const char *leaf, int *err)
 {
   struct cow_dir *dir = (void *) obj;
-  
-  if(exists_in_read_layer(dir, leaf)) {
-    /* Deleting files that are present in the read layer is not
-       supported. */
-    *err = EPERM;
+  int in_read, in_write, empty;
+
+  if(is_reserved_name(leaf)) {
+    *err = ENOENT;
     return -1;
   }
-  if(!dir->dir_write) {
-    *err = ENOENT;
+  switch(view_type(dir, leaf, &empty)) {
+    case -1: *err = ENOENT; return -1;
+    case OBJT_DIR: break;
+    default: *err = ENOTDIR; return -1;
+  }
+  if(!empty) {
+    *err = ENOTEMPTY;
     return -1;
   }
-  return dir->dir_write->vtable->rmdir(dir->dir_write, leaf, err);
+  in_read = exists_in_read_layer(dir, leaf);
+  in_write = exists_in_write_layer(dir, leaf);
+  merged_list_cache_clear(&dir->list_cache);
+  if(in_write) {
+    if(clear_markers(dir, leaf, err) < 0 ||
+       dir->dir_write->vtable->rmdir(dir->dir_write, leaf, err) < 0) {
+      return -1;
+    }
+  }
+  forget_child(dir, leaf);
+  if(in_read) {
+    /* Hide the read layer's directory. */
+    return add_whiteout(dir, leaf, err);
+  }
+  return 0;
+}
+
+/* Returns whether two directories belong to the same layered tree.
+   Whiteouts and opaque markers only make sense against their own
+   tree's read layer, so entries may not be moved to another tree
+   through the write layer. */
+static int same_cow_tree(struct cow_dir *a, struct cow_dir *b)
+{
+  while(a->parent) a = a->parent;
+  while(b->parent) b = b->parent;
+  return a == b;
 }
 
 int cow_dir_rename(struct filesys_obj *obj, const char *src_leaf,
 		   struct filesys_obj *dest_dir, const char *dest_leaf, int *err)
 {
   struct cow_dir *dir = (void *) obj;
+  struct cow_dir *dest = (void *) dest_dir;
+  int src_type, dest_type, dest_empty;
+  int src_in_read, dest_in_read, dest_whited_out;
 
-  /* Handle the same-directory case only. */
-  if(dir == (void *) dest_dir) {
-    /* Removing or overwriting files that exist in the read layer is
-       not allowed. */
-    if(exists_in_read_layer(dir, src_leaf) ||
-       exists_in_read_layer(dir, dest_leaf)) {
-      *err = EPERM;
+  /* Both ends must be in the same layered tree, so that the rename
+     can be done by the write layer. */
+  if(dest_dir->vtable != &cow_dir_vtable || !same_cow_tree(dir, dest)) {
+    *err = EXDEV;
+    return -1;
+  }
+  if(is_reserved_name(src_leaf) || is_reserved_name(dest_leaf)) {
+    *err = EPERM;
+    return -1;
+  }
+  /* An entry that exists only in the read layer cannot be moved
+     without copying it.  EXDEV tells the caller to do that, as for a
+     rename between filesystems. */
+  src_in_read = exists_in_read_layer(dir, src_leaf);
+  if(!exists_in_write_layer(dir, src_leaf)) {
+    *err = src_in_read ? EXDEV : ENOENT;
+    return -1;
+  }
+  if(dir == dest && !strcmp(src_leaf, dest_leaf)) {
+    return 0;
+  }
+
+  /* The destination may be an entry from the read layer, which
+     must be hidden afterwards.  The write layer cannot check
+     whether such an entry may be replaced, so we check here. */
+  src_type = view_type(dir, src_leaf, NULL);
+  /* A copied-up file can be moved, leaving a whiteout in its place.
+     A directory would lose the entries it gets from the read layer. */
+  if(src_in_read && src_type == OBJT_DIR) {
+    *err = EXDEV;
+    return -1;
+  }
+  dest_type = view_type(dest, dest_leaf, &dest_empty);
+  dest_in_read = exists_in_read_layer(dest, dest_leaf);
+  dest_whited_out = is_whited_out(dest, dest_leaf);
+  if(dest_type >= 0) {
+    if(src_type == OBJT_DIR && dest_type != OBJT_DIR) {
+      *err = ENOTDIR;
       return -1;
     }
-    if(!dir->dir_write) {
-      *err = ENOENT;
+    if(src_type != OBJT_DIR && dest_type == OBJT_DIR) {
+      *err = EISDIR;
+      return -1;
+    }
+    if(dest_type == OBJT_DIR && !dest_empty) {
+      *err = ENOTEMPTY;
+      return -1;
+    }
+    if(dest_type == OBJT_DIR &&
+       exists_in_write_layer(dest, dest_leaf) &&
+       clear_markers(dest, dest_leaf, err) < 0) {
       return -1;
     }
-    return dir->dir_write->vtable->rename(dir->dir_write, src_leaf,
-                                          dir->dir_write, dest_leaf, err);
   }
-  else {
-    *err = EXDEV;
+  /* The destination directory may so far exist only in the read layer. */
+  if(realize(dest, err) < 0) {
+    return -1;
+  }
+
+  merged_list_cache_clear(&dir->list_cache);
+  merged_list_cache_clear(&dest->list_cache);
+  if(dir->dir_write->vtable->rename(dir->dir_write, src_leaf,
+				    dest->dir_write, dest_leaf, err) < 0) {
+    return -1;
+  }
+  forget_child(dir, src_leaf);
+  forget_child(dest, dest_leaf);
+  if(src_type == OBJT_DIR && (dest_in_read || dest_whited_out) &&
+     make_opaque(dest, dest_leaf, err) < 0) {
     return -1;
   }
+  if(dest_whited_out) {
+    remove_whiteout(dest, dest_leaf);
+  }
+  if(src_in_read) {
+    /* Hide the read layer's original. */
+    return add_whiteout(dir, src_leaf, err);
+  }
+  return 0;
 }
 
+/* Only entries that have been copied up into the write layer can be
+   linked, since linking to a read layer file would let writes through
+   to it. */
 int cow_dir_link(struct filesys_obj *obj, const char *src_leaf,
 		 struct filesys_obj *dest_dir, const char *dest_leaf, int *err)
 {
-  *err = EXDEV;
-  return -1;
+  struct cow_dir *dir = (void *) obj;
+  struct cow_dir *dest = (void *) dest_dir;
+  int whited_out;
+
+  if(dest_dir->vtable != &cow_dir_vtable || !same_cow_tree(dir, dest)) {
+    *err = EXDEV;
+    return -1;
+  }
+  if(is_reserved_name(src_leaf)) {
+    *err = EPERM;
+    return -1;
+  }
+  if(!exists_in_write_layer(dir, src_leaf)) {
+    *err = exists_in_read_layer(dir, src_leaf) ? EXDEV : ENOENT;
+    return -1;
+  }
+  if(creation_check(dest, dest_leaf, &whited_out, err) < 0 ||
+     dir->dir_write->vtable->link(dir->dir_write, src_leaf,
+				  dest->dir_write, dest_leaf, err) < 0) {
+    return -1;
+  }
+  if(whited_out) {
+    remove_whiteout(dest, dest_leaf);
+  }
+  return 0;
 }
 
 int cow_dir_socket_bind(struct filesys_obj *obj, const char *leaf,
 			int sock_fd, int *err)
 {
   struct cow_dir *dir = (void *) obj;
+  int whited_out;
 
-  if(creation_check(dir, leaf, err) < 0) {
+  if(creation_check(dir, leaf, &whited_out, err) < 0 ||
+     dir->dir_write->vtable->socket_bind(dir->dir_write, leaf, sock_fd,
+					 err) < 0) {
     return -1;
   }
-  return dir->dir_write->vtable->socket_bind(dir->dir_write, leaf, sock_fd, err);
+  if(whited_out) {
+    remove_whiteout(dir, leaf);
+  }
+  return 0;
+}
+
+
+void cow_file_free(struct filesys_obj *obj1)
+{
+  struct cow_file *obj = (void *) obj1;
+  filesys_obj_free(obj->file_read);
+  if(obj->file_write) { filesys_obj_free(obj->file_write); }
+  free(obj->name);
+  filesys_obj_free((struct filesys_obj *) obj->parent);
+}
+
+#ifdef GC_DEBUG
+void cow_file_mark(struct filesys_obj *obj1)
+{
+  struct cow_file *obj = (void *) obj1;
+  filesys_obj_mark(obj->file_read);
+  if(obj->file_write) { filesys_obj_mark(obj->file_write); }
+  filesys_obj_mark((struct filesys_obj *) obj->parent);
+}
+#endif
+
+/* Copies the contents of src_fd to dest_fd, starting from their
+   current offsets.  Tries the cheapest method first:  sharing the
+   data extents (FICLONE), which only works when both files are on the
+   same filesystem and the filesystem supports it; then copying inside
+   the kernel; and finally read() and write(). */
+static int copy_file_data(int src_fd, int dest_fd, int *err)
+{
+  char buf[0x10000];
+  int use_copy_range = 1;
+  int use_sendfile = 1;
+
+#ifdef FICLONE
+  if(ioctl(dest_fd, FICLONE, src_fd) == 0) {
+    return 0;
+  }
+#endif
+
+  while(1) {
+    ssize_t got;
+#ifdef __NR_copy_file_range
+    if(use_copy_range) {
+      got = syscall(__NR_copy_file_range, src_fd, NULL, dest_fd, NULL,
+		    0x40000000, 0);
+      if(got >= 0) {
+	if(got == 0) return 0;
+	continue;
+      }
+      if(errno != EXDEV && errno != ENOSYS && errno != EINVAL &&
+	 errno != EOPNOTSUPP) {
+	*err = errno;
+	return -1;
+      }
+      use_copy_range = 0;
+    }
+#endif
+    if(use_sendfile) {
+      got = sendfile(dest_fd, src_fd, NULL, 0x40000000);
+      if(got >= 0) {
+	if(got == 0) return 0;
+	continue;
+      }
+      if(errno != ENOSYS && errno != EINVAL) {
+	*err = errno;
+	return -1;
+      }
+      use_sendfile = 0;
+    }
+
+    got = read(src_fd, buf, sizeof(buf));
+    if(got < 0) {
+      if(errno == EINTR) continue;
+      *err = errno;
+      return -1;
+    }
+    if(got == 0) return 0;
+    {
+      char *pos = buf;
+      while(got > 0) {
+	ssize_t written = write(dest_fd, pos, got);
+	if(written < 0) {
+	  if(errno == EINTR) continue;
+	  *err = errno;
+	  return -1;
+	}
+	pos += written;
+	got -= written;
+      }
+    }
+  }
+}
+
+/* Makes a copy of the file in the write layer, if there is not already
+   one there.  The copy is written under a temporary name and then
+   renamed into place, so that a partial copy is never visible.
+   Post-condition:  obj->file_write is non-NULL. */
+static int copy_up(struct cow_file *obj, int skip_data, int *err)
+{
+  static int counter = 0;
+  struct filesys_obj *dir;
+  struct filesys_obj *existing;
+  struct stat st;
+  struct timespec times[2];
+  char tmp_name[64];
+  int src_fd, dest_fd;
+
+  /* This is checked first, because the file may have been deleted
+     after it was copied up. */
+  if(is_whited_out(obj->parent, obj->name)) {
+    /* The file has been deleted. */
+    *err = ENOENT;
+    return -1;
+  }
+  if(obj->file_write) {
+    return 0;
+  }
+  if(realize(obj->parent, err) < 0) {
+    return -1;
+  }
+  dir = obj->parent->dir_write;
+
+  /* Another object for the same file might have copied it up
+     already, in which case we must not overwrite its changes. */
+  existing = dir->vtable->traverse(dir, obj->name);
+  if(existing) {
+    if(existing->vtable->fsobj_type(existing) != OBJT_FILE) {
+      filesys_obj_free(existing);
+      *err = EACCES;
+      return -1;
+    }
+    obj->file_write = existing;
+    return 0;
+  }
+
+  if(obj->file_read->vtable->fsobj_stat(obj->file_read, &st, err) < 0) {
+    return -1;
+  }
+  /* Devices, sockets and FIFOs cannot be copied. */
+  if(!S_ISREG(st.st_mode)) {
+    *err = EACCES;
+    return -1;
+  }
+
+  src_fd = -1;
+  if(!skip_data) {
+    src_fd = obj->file_read->vtable->open(obj->file_read, O_RDONLY, err);
+    if(src_fd < 0) {
+      return -1;
+    }
+  }
+  snprintf(tmp_name, sizeof(tmp_name), ".plash-copy-up.%i.%i",
+	   (int) getpid(), counter++);
+  dest_fd = dir->vtable->create_file(dir, tmp_name, O_WRONLY, 0600, err);
+  if(dest_fd < 0) {
+    if(src_fd >= 0) close(src_fd);
+    return -1;
+  }
+  if(!skip_data && copy_file_data(src_fd, dest_fd, err) < 0) {
+    goto error;
+  }
+  /* The write layer's create_file() refuses setuid and setgid bits,
+     so we do not copy them either. */
+  times[0] = st.st_atim;
+  times[1] = st.st_mtim;
+  if(fchmod(dest_fd, st.st_mode & 01777) < 0 ||
+     futimens(dest_fd, times) < 0) {
+    *err = errno;
+    goto error;
+  }
+  if(dir->vtable->rename(dir, tmp_name, dir, obj->name, err) < 0) {
+    goto error;
+  }
+  if(src_fd >= 0) close(src_fd);
+  close(dest_fd);
+
+  obj->file_write = dir->vtable->traverse(dir, obj->name);
+  if(!obj->file_write) {
+    /* Shouldn't happen since we just created the file. */
+    *err = ENOENT;
+    return -1;
+  }
+  return 0;
+
+ error:
+  {
+    int unused_err;
+    dir->vtable->unlink(dir, tmp_name, &unused_err);
+  }
+  if(src_fd >= 0) close(src_fd);
+  close(dest_fd);
+  return -1;
+}
+
+static struct filesys_obj *cow_file_current(struct cow_file *obj)
+{
+  return obj->file_write ? obj->file_write : obj->file_read;
+}
+
+int cow_file_stat(struct filesys_obj *obj1, struct stat *buf, int *err)
+{
+  struct cow_file *obj = (void *) obj1;
+  struct filesys_obj *file = cow_file_current(obj);
+  return file->vtable->fsobj_stat(file, buf, err);
+}
+
+int cow_file_utimes(struct filesys_obj *obj1, const struct timeval *atime,
+		    const struct timeval *mtime, int *err)
+{
+  struct cow_file *obj = (void *) obj1;
+
+  if(copy_up(obj, 0 /* skip_data */, err) < 0) {
+    return -1;
+  }
+  return obj->file_write->vtable->fsobj_utimes(obj->file_write, atime, mtime,
+					       err);
+}
+
+int cow_file_chmod(struct filesys_obj *obj1, int mode, int *err)
+{
+  struct cow_file *obj = (void *) obj1;
+
+  if(copy_up(obj, 0 /* skip_data */, err) < 0) {
+    return -1;
+  }
+  return obj->file_write->vtable->fsobj_chmod(obj->file_write, mode, err);
+}
+
+int cow_file_open(struct filesys_obj *obj1, int flags, int *err)
+{
+  struct cow_file *obj = (void *) obj1;
+
+  if((flags & O_ACCMODE) != O_RDONLY || (flags & O_TRUNC)) {
+    /* There is no need to copy the data if it is about to be
+       truncated. */
+    if(copy_up(obj, (flags & O_TRUNC) != 0 /* skip_data */, err) < 0) {
+      return -1;
+    }
+  }
+  {
+    struct filesys_obj *file = cow_file_current(obj);
+    return file->vtable->open(file, flags, err);
+  }
 }
 
 
@@ -17,7 +17,10 @@
    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301,
    USA.  */
 
+#include <assert.h>
 #include <errno.h>
+#include <unistd.h>
+#include <sys/sysmacros.h>
 
 #include "region.h"
 #include "filesysobj-fab.h"
@@ -34,6 +37,46 @@ struct list *assoc(struct list *list, const char *name)
 }
 
 
+static int fab_inode_space_count = 0;
+
+struct fab_inode_space *fab_inode_space_make(void)
+{
+  struct fab_inode_space *space = amalloc(sizeof(struct fab_inode_space));
+  /* Keep the device number below 2^31 so that it survives being
+     marshalled as an int. */
+  int minor = ((getpid() << 6) ^ ++fab_inode_space_count) & 0x7ffff;
+  space->refcount = 1;
+  space->dev = makedev(FAB_OBJ_STAT_DEV_MAJOR, minor);
+  space->next_inode = 1;
+  return space;
+}
+
+void fab_inode_space_free(struct fab_inode_space *space)
+{
+  assert(space->refcount > 0);
+  if(--space->refcount == 0) {
+    free(space);
+  }
+}
+
+int fab_inode_alloc(struct fab_inode_space *space)
+{
+  return space->next_inode++;
+}
+
+void fab_stat_init(struct stat *st, int dev, int inode, int mode, int size)
+{
+  memset(st, 0, sizeof(struct stat));
+  st->st_dev = dev;
+  st->st_ino = inode;
+  st->st_mode = mode;
+  /* FIXME: for directories, st_nlink could count the child directories */
+  st->st_nlink = S_ISDIR(mode) ? 0 : 1;
+  st->st_size = size;
+  st->st_blksize = 1024;
+}
+
+
 int refuse_chmod(struct filesys_obj *obj, int mode, int *err)
 {
   *err = EACCES;
@@ -122,19 +165,7 @@ void fab_dir_mark(struct filesys_obj *obj1)
 int fab_dir_stat(struct filesys_obj *obj, struct stat *st, int *err)
 {
   struct fab_dir *dir = (void *) obj;
-  st->st_dev = FAB_OBJ_STAT_DEVICE;
-  st->st_ino = dir->inode;
-  st->st_mode = S_IFDIR | 0777;
-  st->st_nlink = 0; /* FIXME: this can be used to count the number of child directories */
-  st->st_uid = 0;
-  st->st_gid = 0;
-  st->st_rdev = 0;
-  st->st_size = 0;
-  st->st_blksize = 1024;
-  st->st_blocks = 0;
-  st->st_atime = 0;
-  st->st_mtime = 0;
-  st->st_ctime = 0;
+  *st = dir->stat;
   return 0;
 }
 
@@ -181,19 +212,7 @@ void fab_symlink_free(struct filesys_obj *obj1)
 int fab_symlink_stat(struct filesys_obj *obj, struct stat *st, int *err)
 {
   struct fab_symlink *sym = (void *) obj;
-  st->st_dev = FAB_OBJ_STAT_DEVICE;
-  st->st_ino = sym->inode;
-  st->st_mode = S_IFLNK | 0777;
-  st->st_nlink = 1; /* Not necessarily accurate */
-  st->st_uid = 0;
-  st->st_gid = 0;
-  st->st_rdev = 0;
-  st->st_size = sym->dest.size;
-  st->st_blksize = 1024;
-  st->st_blocks = 0;
-  st->st_atime = 0;
-  st->st_mtime = 0;
-  st->st_ctime = 0;
+  *st = sym->stat;
   return 0;
 }
 
@@ -233,19 +252,7 @@ void s_fab_dir_mark(struct filesys_obj *obj1)
 int s_fab_dir_stat(struct filesys_obj *obj, struct stat *st, int *err)
 {
   struct s_fab_dir *dir = (void *) obj;
-  st->st_dev = FAB_OBJ_STAT_DEVICE;
-  st->st_ino = dir->inode;
-  st->st_mode = S_IFDIR | 0777;
-  st->st_nlink = 0; /* FIXME: this can be used to count the number of child directories */
-  st->st_uid = 0;
-  st->st_gid = 0;
-  st->st_rdev = 0;
-  st->st_size = 0;
-  st->st_blksize = 1024;
-  st->st_blocks = 0;
-  st->st_atime = 0;
-  st->st_mtime = 0;
-  st->st_ctime = 0;
+  *st = dir->stat;
   return 0;
 }
 
@@ -24,8 +24,29 @@
 #include "filesysslot.h"
 
 
-/* Device number reported by stat.  FIXME: avoid clashes? */
-#define FAB_OBJ_STAT_DEVICE 100
+/* Fabricated objects get their device and inode numbers from an
+   inode space.  Each namespace has its own space with its own device
+   number, so that tools which use (st_dev, st_ino) to identify files
+   do not confuse fabricated objects from different namespaces.
+
+   The device number uses a major number that Linux does not allocate,
+   and a minor number derived from the process ID and a per-process
+   counter.  It has to fit in the 32-bit st_dev field of the protocol,
+   so clashes between servers are unlikely rather than impossible. */
+#define FAB_OBJ_STAT_DEV_MAJOR 0xfab
+
+struct fab_inode_space {
+  int refcount;
+  int dev;
+  int next_inode;
+};
+
+struct fab_inode_space *fab_inode_space_make(void);
+void fab_inode_space_free(struct fab_inode_space *space);
+int fab_inode_alloc(struct fab_inode_space *space);
+
+/* Fills out the stat record returned for a fabricated object. */
+void fab_stat_init(struct stat *st, int dev, int inode, int mode, int size);
 
 
 /* Abstract version that "assoc" operates on. */
@@ -47,13 +68,13 @@ struct obj_list {
 struct fab_dir {
   struct filesys_obj hdr;
   struct obj_list *entries; /* Owned by the fab_dir */
-  int inode;
+  struct stat stat;
 };
 
 struct fab_symlink {
   struct filesys_obj hdr;
   seqf_t dest; /* malloc'd block, owned by this object */
-  int inode;
+  struct stat stat;
 };
 
 DECLARE_VTABLE(fab_dir_vtable);
@@ -71,7 +92,7 @@ struct slot_list {
 struct s_fab_dir {
   struct filesys_obj hdr;
   struct slot_list *entries; /* Owned by the s_fab_dir */
-  int inode;
+  struct stat stat;
 };
 
 DECLARE_VTABLE(s_fab_dir_vtable);
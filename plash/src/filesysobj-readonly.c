@@ -21,6 +21,8 @@
 #include <fcntl.h>
 
 #include "filesysobj.h"
+#include "filesysobj-readonly.h"
+#include "filesysobj-real.h"
 #include "cap-protocol.h"
 
 
@@ -31,15 +33,52 @@ struct readonly_obj {
   struct filesys_obj *x; /* The object being proxied */
 };
 
-/* Takes an owning reference. */
+/* Takes an owning reference.
+   Objects that are already read-only are returned as they are rather
+   than being wrapped again.  Real files, directories and symlinks are
+   given their read-only vtables instead of a proxy, which saves an
+   indirect call per operation.  Since real_dir_ro_traverse() passes
+   freshly created objects to this, they are switched in place, so
+   walking a read-only real directory tree allocates nothing extra. */
 struct filesys_obj *make_read_only_proxy(struct filesys_obj *x)
 {
-  struct readonly_obj *obj =
-    filesys_obj_make(sizeof(struct readonly_obj), &readonly_obj_vtable);
+  struct readonly_obj *obj;
+  struct filesys_obj *real;
+  if(is_read_only_obj(x)) return x;
+  real = real_obj_make_read_only(x);
+  if(real) return real;
+  obj = filesys_obj_make(sizeof(struct readonly_obj), &readonly_obj_vtable);
   obj->x = x;
   return (struct filesys_obj *) obj;
 }
 
+/* Returns non-zero if `obj' refuses all modifications made through it. */
+int is_read_only_obj(struct filesys_obj *obj)
+{
+  return obj->vtable == &readonly_obj_vtable || real_obj_is_read_only(obj);
+}
+
+/* Returns non-zero if open() flags only ask for read access. */
+int read_only_open_allowed(int flags)
+{
+  /* These flags are not allowed; they may not be relevant:
+     O_CREAT | O_EXCL | O_TRUNC | O_APPEND | O_DIRECTORY | O_NOFOLLOW */
+  return (flags & O_ACCMODE) == O_RDONLY &&
+    /* Only these flags are allowed.  This check is probably unnecessary: */
+    (flags & ~(O_ACCMODE | O_NOCTTY | O_NONBLOCK | O_NDELAY | O_SYNC |
+	       O_LARGEFILE)) == 0;
+}
+
+/* Returns the object that `obj' is proxying (as a borrowed reference)
+   if `obj' is a read-only proxy, or NULL otherwise. */
+struct filesys_obj *read_only_proxy_target(struct filesys_obj *obj)
+{
+  if(obj->vtable == &readonly_obj_vtable) {
+    return ((struct readonly_obj *) obj)->x;
+  }
+  return NULL;
+}
+
 
 void readonly_free(struct filesys_obj *obj1)
 {
@@ -70,13 +109,7 @@ int readonly_stat(struct filesys_obj *obj1, struct stat *buf, int *err)
 int readonly_open(struct filesys_obj *obj1, int flags, int *err)
 {
   struct readonly_obj *obj = (void *) obj1;
-  /* These flags are not allowed; they may not be relevant:
-     O_CREAT | O_EXCL | O_TRUNC | O_APPEND | O_DIRECTORY | O_NOFOLLOW */
-
-  if((flags & O_ACCMODE) == O_RDONLY &&
-     /* Only these flags are allowed.  This check is probably unnecessary: */
-     (flags & ~(O_ACCMODE | O_NOCTTY | O_NONBLOCK | O_NDELAY | O_SYNC |
-		O_LARGEFILE)) == 0) {
+  if(read_only_open_allowed(flags)) {
     return obj->x->vtable->open(obj->x, flags, err);
   }
   else {
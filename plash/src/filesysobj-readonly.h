@@ -23,5 +23,8 @@
 #include "filesysobj.h"
 
 struct filesys_obj *make_read_only_proxy(struct filesys_obj *x);
+struct filesys_obj *read_only_proxy_target(struct filesys_obj *obj);
+int is_read_only_obj(struct filesys_obj *obj);
+int read_only_open_allowed(int flags);
 
 #endif
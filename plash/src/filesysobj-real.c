@@ -36,6 +36,8 @@
 #include "serialise.h"
 #include "filesysobj.h"
 #include "filesysobj-real.h"
+#include "filesysobj-readonly.h"
+#include "build-fs.h"
 #include "cap-protocol.h"
 
 
@@ -271,6 +273,55 @@ int leafname_ok(const char *leaf)
   }
   return 1;
 }
+/* Does the work of traverse + open or create_file with one openat(). */
+int real_dir_open_or_create(struct filesys_obj *obj, const char *leaf,
+			    int flags, int mode, int *err)
+{
+  struct real_dir *dir = (void *) obj;
+  int fd;
+  struct stat st;
+
+  if(!leafname_ok(leaf)) { *err = ENOENT; return -1; }
+
+  /* create_file refuses these, so leave it to give the right error. */
+  if((mode & S_ISUID) ||
+     (mode & S_ISGID)) {
+    return generic_open_or_create(obj, leaf, flags, mode, err);
+  }
+
+  if(flags &
+     ~(O_ACCMODE | O_CREAT | O_EXCL | O_NOCTTY | O_TRUNC | O_APPEND |
+       O_NONBLOCK | O_NDELAY | O_SYNC |
+       O_NOFOLLOW | O_LARGEFILE)) {
+    /* Unrecognised flags */
+    if(MOD_DEBUG) fprintf(server_log, MOD_MSG "open_or_create: unrecognised flags: 0o%o\n", flags);
+    *err = EINVAL;
+    return -1;
+  }
+
+  /* Couldn't open the directory; we don't have an FD for it. */
+  if(!dir->fd) { *err = EIO; return -1; }
+
+  /* O_NOFOLLOW is essential:  the kernel would resolve a symlink
+     relative to the server's root, not the client's. */
+  fd = openat(dir->fd->fd, leaf, flags | O_CREAT | O_NOFOLLOW, mode);
+  if(fd < 0) {
+    *err = errno;
+    return -1;
+  }
+  set_close_on_exec_flag(fd, 1);
+
+  /* As in create_file:  never pass the process a FD for a directory. */
+  if(fstat(fd, &st) < 0) { close(fd); *err = errno; return -1; }
+  if(S_ISDIR(st.st_mode)) {
+    if(MOD_DEBUG) fprintf(server_log, MOD_MSG "open_or_create: turned into a directory\n");
+    close(fd);
+    *err = EISDIR;
+    return -1;
+  }
+  return fd;
+}
+
 
 struct filesys_obj *real_dir_traverse(struct filesys_obj *obj, const char *leaf)
 {
@@ -393,6 +444,29 @@ int real_dir_mkdir(struct filesys_obj *obj, const char *leaf, int mode, int *err
   return rc;
 }
 
+/* Creates a subdirectory, or uses an existing one, and returns an
+   object for it.  This saves a separate traverse() after mkdir(). */
+struct filesys_obj *real_dir_mkdir_open(struct filesys_obj *obj,
+					const char *leaf, int mode, int *err)
+{
+  struct real_dir *dir = (void *) obj;
+  struct real_dir *new_obj;
+  struct stat stat;
+  int fd;
+
+  if(real_dir_mkdir(obj, leaf, mode, err) < 0 && *err != EEXIST) {
+    return NULL;
+  }
+  fd = openat(dir->fd->fd, leaf, O_RDONLY | O_NOFOLLOW | O_DIRECTORY, 0);
+  if(fd < 0) { *err = errno; return NULL; }
+  set_close_on_exec_flag(fd, 1);
+  if(fstat(fd, &stat) < 0) { *err = errno; close(fd); return NULL; }
+  new_obj = filesys_obj_make(sizeof(struct real_dir), &real_dir_vtable);
+  new_obj->stat = stat;
+  new_obj->fd = make_fd(fd);
+  return (struct filesys_obj *) new_obj;
+}
+
 int real_dir_symlink(struct filesys_obj *obj, const char *leaf,
 		     const char *oldpath, int *err)
 {
@@ -417,6 +491,9 @@ int real_dir_rename(struct filesys_obj *obj, const char *leaf,
 
   if(!leafname_ok(leaf) || !leafname_ok(dest_leaf)) { *err = ENOENT; return -1; }
 
+  /* The destination may be a combined directory whose entry
+     dest_leaf belongs to a real directory. */
+  dest_dir = comb_dir_entry_dir(dest_dir, dest_leaf);
   if(dest_dir->vtable == &real_dir_vtable) {
     struct real_dir *real_dest_dir = (struct real_dir *) dest_dir;
     int rc = renameat(dir->fd->fd, leaf,
@@ -425,7 +502,8 @@ int real_dir_rename(struct filesys_obj *obj, const char *leaf,
       *err = errno;
     return rc;
   }
-  *err = EXDEV;
+  /* A read-only directory can never receive the entry. */
+  *err = is_read_only_obj(dest_dir) ? EACCES : EXDEV;
   return -1;
 }
 
@@ -437,6 +515,9 @@ int real_dir_link(struct filesys_obj *obj, const char *leaf,
 
   if(!leafname_ok(leaf) || !leafname_ok(dest_leaf)) { *err = ENOENT; return -1; }
 
+  /* The destination may be a combined directory whose entry
+     dest_leaf belongs to a real directory. */
+  dest_dir = comb_dir_entry_dir(dest_dir, dest_leaf);
   if(dest_dir->vtable == &real_dir_vtable) {
     struct real_dir *real_dest_dir = (struct real_dir *) dest_dir;
     int rc = linkat(dir->fd->fd, leaf,
@@ -445,7 +526,8 @@ int real_dir_link(struct filesys_obj *obj, const char *leaf,
       *err = errno;
     return rc;
   }
-  *err = EXDEV;
+  /* A read-only directory can never receive the entry. */
+  *err = is_read_only_obj(dest_dir) ? EACCES : EXDEV;
   return -1;
 }
 
@@ -662,4 +744,80 @@ int real_symlink_readlink(struct filesys_obj *obj, region_t r, seqf_t *result, i
 }
 
 
+
+/* Takes an owning reference to `obj'.  If it is a writable real
+   object, returns a read-only version of it; otherwise returns NULL
+   and leaves `obj' alone.  When the caller holds the only reference,
+   `obj' is switched to its read-only vtable in place, since nobody
+   else can still be using the writable version.  Otherwise it is
+   copied, sharing its file descriptor. */
+struct filesys_obj *real_obj_make_read_only(struct filesys_obj *obj)
+{
+  struct filesys_obj *copy;
+  if(obj->vtable == &real_dir_vtable) {
+    struct real_dir *dir = (void *) obj;
+    if(obj->refcount == 1) {
+      obj->vtable = &real_dir_ro_vtable;
+      return obj;
+    }
+    copy = filesys_obj_make(sizeof(struct real_dir), &real_dir_ro_vtable);
+    ((struct real_dir *) copy)->stat = dir->stat;
+    ((struct real_dir *) copy)->fd = dir->fd;
+    if(dir->fd) dir->fd->refcount++;
+  }
+  else if(obj->vtable == &real_file_vtable) {
+    struct real_file *file = (void *) obj;
+    if(obj->refcount == 1) {
+      obj->vtable = &real_file_ro_vtable;
+      return obj;
+    }
+    copy = filesys_obj_make(sizeof(struct real_file), &real_file_ro_vtable);
+    ((struct real_file *) copy)->stat = file->stat;
+    ((struct real_file *) copy)->dir_fd = file->dir_fd;
+    ((struct real_file *) copy)->leaf = strdup(file->leaf);
+    file->dir_fd->refcount++;
+  }
+  else if(obj->vtable == &real_symlink_vtable) {
+    struct real_symlink *sym = (void *) obj;
+    if(obj->refcount == 1) {
+      obj->vtable = &real_symlink_ro_vtable;
+      return obj;
+    }
+    copy = filesys_obj_make(sizeof(struct real_symlink),
+			    &real_symlink_ro_vtable);
+    ((struct real_symlink *) copy)->stat = sym->stat;
+    ((struct real_symlink *) copy)->dir_fd = sym->dir_fd;
+    ((struct real_symlink *) copy)->leaf = strdup(sym->leaf);
+    sym->dir_fd->refcount++;
+  }
+  else return NULL;
+  filesys_obj_free(obj);
+  return copy;
+}
+
+int real_obj_is_read_only(struct filesys_obj *obj)
+{
+  return obj->vtable == &real_dir_ro_vtable ||
+    obj->vtable == &real_file_ro_vtable ||
+    obj->vtable == &real_symlink_ro_vtable;
+}
+
+int real_file_ro_open(struct filesys_obj *obj, int flags, int *err)
+{
+  if(!read_only_open_allowed(flags)) {
+    *err = EACCES;
+    return -1;
+  }
+  return real_file_open(obj, flags, err);
+}
+
+struct filesys_obj *real_dir_ro_traverse(struct filesys_obj *obj,
+					 const char *leaf)
+{
+  struct filesys_obj *t = real_dir_traverse(obj, leaf);
+  if(t) return make_read_only_proxy(t);
+  else return 0;
+}
+
+
 #include "out-vtable-filesysobj-real.h"
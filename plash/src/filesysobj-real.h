@@ -49,8 +49,18 @@ DECLARE_VTABLE(real_dir_vtable);
 DECLARE_VTABLE(real_file_vtable);
 DECLARE_VTABLE(real_symlink_vtable);
 
+/* Read-only versions, used by make_read_only_proxy() in place of a
+   proxy object.  They use the same structs as the above. */
+DECLARE_VTABLE(real_dir_ro_vtable);
+DECLARE_VTABLE(real_file_ro_vtable);
+DECLARE_VTABLE(real_symlink_ro_vtable);
+
 
 struct filesys_obj *initial_dir(const char *pathname, int *err);
+struct filesys_obj *real_dir_mkdir_open(struct filesys_obj *obj,
+					const char *leaf, int mode, int *err);
+struct filesys_obj *real_obj_make_read_only(struct filesys_obj *obj);
+int real_obj_is_read_only(struct filesys_obj *obj);
 
 
 #endif
@@ -18,52 +18,116 @@
    USA.  */
 
 #include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "region.h"
 #include "serialise.h"
 #include "filesysobj-fab.h"
+#include "filesysobj-real.h"
 #include "filesysobj-union.h"
 #include "cap-protocol.h"
 
 
 DECLARE_VTABLE(union_dir_vtable);
 
+/* A union of any number of directories.  Entries in earlier layers
+   override entries in later layers, except that directories are
+   combined with directories of the same name in later layers.
+   A union whose first argument is a union is flattened into a single
+   layer array, so a lookup does not need to descend through nested
+   proxy objects.  That gives the same result as nesting them.  A
+   union as the second argument is kept as one layer, because there a
+   file in one of its layers hides its later layers' directories of
+   the same name, which a flat union would merge. */
 struct union_dir {
   struct filesys_obj hdr;
-  struct filesys_obj *dir1, *dir2;
+  int count;
+  struct filesys_obj **dirs; /* malloc'd; owning references */
+  struct merged_list_cache list_cache;
 };
 
-struct filesys_obj *make_union_dir(struct filesys_obj *dir1,
-				   struct filesys_obj *dir2)
+/* Takes owning references to the elements of `dirs', but not to the
+   array itself.  `count' must be at least 2. */
+static struct filesys_obj *make_union_dir_n(int count,
+					    struct filesys_obj **dirs)
 {
   struct union_dir *dir =
     filesys_obj_make(sizeof(struct union_dir), &union_dir_vtable);
-  dir->dir1 = dir1;
-  dir->dir2 = dir2;
+  dir->count = count;
+  dir->dirs = amalloc(count * sizeof(struct filesys_obj *));
+  memcpy(dir->dirs, dirs, count * sizeof(struct filesys_obj *));
+  merged_list_cache_init(&dir->list_cache);
   return (struct filesys_obj *) dir;
 }
 
+/* Adds the layers of `obj' to `dirs', taking an owning reference to
+   `obj'.  Returns the number added. */
+static int union_layers(struct filesys_obj *obj, struct filesys_obj **dirs)
+{
+  if(obj->vtable == &union_dir_vtable) {
+    struct union_dir *dir = (void *) obj;
+    int count = dir->count;
+    if(dirs) {
+      int i;
+      for(i = 0; i < count; i++) {
+	dirs[i] = dir->dirs[i];
+	inc_ref(dirs[i]);
+      }
+      filesys_obj_free(obj);
+    }
+    return count;
+  }
+  else {
+    if(dirs) dirs[0] = obj;
+    return 1;
+  }
+}
+
+struct filesys_obj *make_union_dir(struct filesys_obj *dir1,
+				   struct filesys_obj *dir2)
+{
+  int count1 = union_layers(dir1, NULL);
+  int count = count1 + 1;
+  struct filesys_obj **dirs = amalloc(count * sizeof(struct filesys_obj *));
+  struct filesys_obj *result;
+  union_layers(dir1, dirs);
+  dirs[count1] = dir2;
+  result = make_union_dir_n(count, dirs);
+  free(dirs);
+  return result;
+}
+
 
 void union_dir_free(struct filesys_obj *obj)
 {
   struct union_dir *dir = (void *) obj;
-  filesys_obj_free(dir->dir1);
-  filesys_obj_free(dir->dir2);
+  int i;
+  for(i = 0; i < dir->count; i++) {
+    filesys_obj_free(dir->dirs[i]);
+  }
+  free(dir->dirs);
+  merged_list_cache_clear(&dir->list_cache);
 }
 
 #ifdef GC_DEBUG
 void union_dir_mark(struct filesys_obj *obj)
 {
   struct union_dir *dir = (void *) obj;
-  filesys_obj_mark(dir->dir1);
-  filesys_obj_mark(dir->dir2);
+  int i;
+  for(i = 0; i < dir->count; i++) {
+    filesys_obj_mark(dir->dirs[i]);
+  }
 }
 #endif
 
 int union_dir_stat(struct filesys_obj *obj, struct stat *buf, int *err)
 {
   struct union_dir *dir = (void *) obj;
-  if(dir->dir1->vtable->fsobj_stat(dir->dir1, buf, err) < 0) return -1;
+  struct filesys_obj *dir1 = dir->dirs[0];
+  if(dir1->vtable->fsobj_stat(dir1, buf, err) < 0) return -1;
   buf->st_nlink = 0; /* FIXME: this can be used to count the number of child directories */
   return 0;
 }
@@ -71,127 +135,310 @@ int union_dir_stat(struct filesys_obj *obj, struct stat *buf, int *err)
 struct filesys_obj *union_dir_traverse(struct filesys_obj *obj, const char *leaf)
 {
   struct union_dir *dir = (void *) obj;
-  struct filesys_obj *child1, *child2;
-  int type1, type2;
-
-  /* If the entry is not present in dir1, return entry from dir2. */
-  child1 = dir->dir1->vtable->traverse(dir->dir1, leaf);
-  if(!child1) return dir->dir2->vtable->traverse(dir->dir2, leaf);
-
-  /* If dir1's entry is not a directory, it overrides any entry from dir2. */
-  type1 = child1->vtable->fsobj_type(child1);
-  if(type1 != OBJT_DIR) return child1;
-
-  /* If the entry is not present in dir2, return entry from dir1. */
-  child2 = dir->dir2->vtable->traverse(dir->dir2, leaf);
-  if(!child2) return child1;
-
-  /* If dir2's entry is not a directory, dir1's entry overrides it. */
-  type2 = child2->vtable->fsobj_type(child2);
-  if(type2 != OBJT_DIR) {
-    filesys_obj_free(child2);
-    return child1;
+  struct filesys_obj **children;
+  struct filesys_obj *result;
+  int found = 0;
+  int i;
+
+  /* Find the first layer containing the entry.  If the entry is not
+     a directory, it overrides entries in the later layers. */
+  for(i = 0; i < dir->count; i++) {
+    struct filesys_obj *child =
+      dir->dirs[i]->vtable->traverse(dir->dirs[i], leaf);
+    if(child) {
+      if(child->vtable->fsobj_type(child) != OBJT_DIR) return child;
+      children = amalloc((dir->count - i) * sizeof(struct filesys_obj *));
+      children[found++] = child;
+      i++;
+      break;
+    }
   }
+  if(!found) return NULL;
 
-  /* Otherwise, dir1 and dir2's entries are both directories, so we
-     union them together.  Create a new union directory proxy
-     object. */
-  return make_union_dir(child1, child2);
+  /* Collect the directories of the same name from the later layers.
+     Non-directories are overridden by the directory we found. */
+  for(; i < dir->count; i++) {
+    struct filesys_obj *child =
+      dir->dirs[i]->vtable->traverse(dir->dirs[i], leaf);
+    if(child) {
+      if(child->vtable->fsobj_type(child) == OBJT_DIR) {
+	children[found++] = child;
+      }
+      else {
+	filesys_obj_free(child);
+      }
+    }
+  }
+
+  /* If there are several directories, union them together. */
+  result = found == 1 ? children[0] : make_union_dir_n(found, children);
+  free(children);
+  return result;
 }
 
-static int sort_seqf_compare(const void *p1, const void *p2)
+/* Listing a layered directory involves listing each layer, sorting
+   the listings and merging them.  Programs tend to list the same
+   directories repeatedly, so we keep sorted listings of real
+   directories in a small table keyed on device and inode number.
+
+   An entry is valid while the directory's mtime and ctime are
+   unchanged.  Timestamps have limited granularity, so a listing is
+   only cached if the directory was last changed before the second in
+   which we read it; otherwise a later change in the same second could
+   go unnoticed. */
+
+#define LIST_CACHE_SIZE 64
+
+struct list_cache_entry {
+  int used;
+  struct dir_stamp stamp;
+  int count;
+  struct dir_entry *entries; /* malloc'd, followed by the names */
+};
+
+static struct list_cache_entry list_cache[LIST_CACHE_SIZE];
+
+/* Returns non-zero if `dir' is a real directory, filling out `stamp'. */
+static int get_dir_stamp(struct filesys_obj *dir, struct dir_stamp *stamp)
 {
-  return seqf_compare(*(seqf_t *) p1, *(seqf_t *) p2);
+  struct real_dir *real = (void *) dir;
+  struct stat st;
+
+  if((dir->vtable != &real_dir_vtable &&
+      dir->vtable != &real_dir_ro_vtable) || !real->fd) return 0;
+  if(fstat(real->fd->fd, &st) < 0) return 0;
+  stamp->dev = st.st_dev;
+  stamp->ino = st.st_ino;
+  stamp->mtime = st.st_mtim;
+  stamp->ctime = st.st_ctim;
+  return 1;
 }
 
-/* This is used by cow_dir too. */
-int merge_dir_lists(region_t r,
-		    struct filesys_obj *dir1,
-		    struct filesys_obj *dir2,
-		    seqt_t *result,
+static int dir_stamp_equal(struct dir_stamp *a, struct dir_stamp *b)
+{
+  return a->dev == b->dev &&
+    a->ino == b->ino &&
+    a->mtime.tv_sec == b->mtime.tv_sec &&
+    a->mtime.tv_nsec == b->mtime.tv_nsec &&
+    a->ctime.tv_sec == b->ctime.tv_sec &&
+    a->ctime.tv_nsec == b->ctime.tv_nsec;
+}
+
+/* Copies an array of entries and their names into one block.  If
+   `block' is NULL, just returns the size needed. */
+static size_t copy_dir_entries(void *block, struct dir_entry *entries,
+			       int count)
+{
+  size_t size = count * sizeof(struct dir_entry);
+  int i;
+  for(i = 0; i < count; i++) {
+    if(block) {
+      struct dir_entry *dest = (struct dir_entry *) block + i;
+      char *name = (char *) block + size;
+      memcpy(name, entries[i].name.data, entries[i].name.size);
+      dest->inode = entries[i].inode;
+      dest->type = entries[i].type;
+      dest->name.data = name;
+      dest->name.size = entries[i].name.size;
+    }
+    size += entries[i].name.size;
+  }
+  return size;
+}
+
+static int sort_dir_entry_compare(const void *p1, const void *p2)
+{
+  return seqf_compare(((struct dir_entry *) p1)->name,
+		      ((struct dir_entry *) p2)->name);
+}
+
+/* Returns the listing of `dir', sorted by name, allocated in `r'.
+   If `dir' is a real directory, this sets *cacheable to indicate
+   whether the listing can be re-used while its stamp, which is filled
+   out in `stamp', is unchanged.  Returns the number of entries, or -1
+   on error. */
+int sorted_dir_list(region_t r, struct filesys_obj *dir,
+		    struct dir_entry **result,
+		    struct dir_stamp *stamp, int *cacheable,
 		    int *err)
 {
-  int count1, count2;
+  time_t list_time = time(NULL);
+  struct list_cache_entry *slot = NULL;
+  struct dir_entry *array;
   seqt_t got;
   seqf_t buf;
-  seqf_t *array1, *array2;
-  int i;
+  int count, i;
 
-  region_t r2 = region_make();
+  *cacheable = 0;
+  if(get_dir_stamp(dir, stamp)) {
+    slot = &list_cache[(stamp->ino ^ stamp->dev) % LIST_CACHE_SIZE];
+    if(slot->used && dir_stamp_equal(&slot->stamp, stamp)) {
+      void *block = region_alloc(r, copy_dir_entries(NULL, slot->entries,
+						     slot->count));
+      copy_dir_entries(block, slot->entries, slot->count);
+      *result = block;
+      *cacheable = 1;
+      return slot->count;
+    }
+  }
 
-  count1 = dir1->vtable->list(dir1, r2, &got, err);
-  if(count1 < 0) { region_free(r2); return -1; }
-  array1 = region_alloc(r2, count1 * sizeof(seqf_t));
+  count = dir->vtable->list(dir, r, &got, err);
+  if(count < 0) return -1;
+  array = region_alloc(r, count * sizeof(struct dir_entry));
   buf = flatten(r, got);
-  for(i = 0; i < count1; i++) {
-    int inode, type;
-    seqf_t name;
+  for(i = 0; i < count; i++) {
     int ok = 1;
-    m_int(&ok, &buf, &inode);
-    m_int(&ok, &buf, &type);
-    m_lenblock(&ok, &buf, &name);
-    if(ok) {
-      array1[i] = name;
+    m_int(&ok, &buf, &array[i].inode);
+    m_int(&ok, &buf, &array[i].type);
+    m_lenblock(&ok, &buf, &array[i].name);
+    if(!ok) { *err = EIO; return -1; }
+  }
+  qsort(array, count, sizeof(struct dir_entry), sort_dir_entry_compare);
+
+  if(slot &&
+     stamp->mtime.tv_sec < list_time &&
+     stamp->ctime.tv_sec < list_time) {
+    void *block = malloc(copy_dir_entries(NULL, array, count));
+    if(block) {
+      copy_dir_entries(block, array, count);
+      if(slot->used) free(slot->entries);
+      slot->used = 1;
+      slot->stamp = *stamp;
+      slot->count = count;
+      slot->entries = block;
+      *cacheable = 1;
     }
-    else { region_free(r2); *err = EIO; return -1; }
   }
+  *result = array;
+  return count;
+}
 
-  count2 = dir2->vtable->list(dir2, r2, &got, err);
-  if(count2 < 0) { region_free(r2); return -1; }
-  array2 = region_alloc(r2, count2 * sizeof(seqf_t));
-  buf = flatten(r, got);
-  for(i = 0; i < count2; i++) {
-    int inode, type;
-    seqf_t name;
-    int ok = 1;
-    m_int(&ok, &buf, &inode);
-    m_int(&ok, &buf, &type);
-    m_lenblock(&ok, &buf, &name);
-    if(ok) {
-      array2[i] = name;
+void merged_list_cache_init(struct merged_list_cache *cache)
+{
+  cache->valid = 0;
+  cache->data = NULL;
+  cache->stamps = NULL;
+}
+
+void merged_list_cache_clear(struct merged_list_cache *cache)
+{
+  if(cache->valid) {
+    free(cache->data);
+    free(cache->stamps);
+  }
+  merged_list_cache_init(cache);
+}
+
+/* This is used by cow_dir too.  `cache' may be NULL. */
+int merge_dir_lists(region_t r,
+		    struct filesys_obj *dir1,
+		    struct filesys_obj *dir2,
+		    struct merged_list_cache *cache,
+		    seqt_t *result,
+		    int *err)
+{
+  struct filesys_obj *dirs[2];
+  dirs[0] = dir1;
+  dirs[1] = dir2;
+  return merge_dir_lists_n(r, 2, dirs, cache, result, err);
+}
+
+/* Merges the listings of several directories.  Names that occur in
+   more than one of them are listed once. */
+int merge_dir_lists_n(region_t r, int layers, struct filesys_obj **dirs,
+		      struct merged_list_cache *cache,
+		      seqt_t *result,
+		      int *err)
+{
+  int *counts, *pos;
+  struct dir_entry **arrays;
+  struct dir_stamp *stamps;
+  int cacheable = 1;
+  int i;
+  region_t r2;
+
+  if(cache && cache->valid && cache->layers == layers) {
+    struct dir_stamp stamp;
+    for(i = 0; i < layers; i++) {
+      if(!get_dir_stamp(dirs[i], &stamp) ||
+	 !dir_stamp_equal(&stamp, &cache->stamps[i]))
+	break;
+    }
+    if(i == layers) {
+      char *data = region_alloc(r, cache->size);
+      memcpy(data, cache->data, cache->size);
+      *result = mk_leaf2(r, data, cache->size);
+      return cache->count;
     }
-    else { region_free(r2); *err = EIO; return -1; }
   }
+  if(cache) merged_list_cache_clear(cache);
 
-  /* Sort the sequences to make it easy to merge them. */
-  qsort(array1, count1, sizeof(seqf_t), sort_seqf_compare);
-  qsort(array2, count2, sizeof(seqf_t), sort_seqf_compare);
+  r2 = region_make();
+  counts = region_alloc(r2, layers * sizeof(int));
+  pos = region_alloc(r2, layers * sizeof(int));
+  arrays = region_alloc(r2, layers * sizeof(struct dir_entry *));
+  stamps = region_alloc(r2, layers * sizeof(struct dir_stamp));
+  for(i = 0; i < layers; i++) {
+    int layer_cacheable;
+    counts[i] = sorted_dir_list(r2, dirs[i], &arrays[i], &stamps[i],
+				&layer_cacheable, err);
+    if(counts[i] < 0) { region_free(r2); return -1; }
+    if(!layer_cacheable) cacheable = 0;
+    pos[i] = 0;
+  }
 
-  /* Merge the two sequences. */
+  /* Merge the sorted sequences.  The number of layers is small, so
+     we just scan them all for the lowest name at each step. */
   {
     cbuf_t buf = cbuf_make(r, 100);
     int count = 0;
-    int i1 = 0, i2 = 0;
     while(1) {
-      int comp;
-      if(i1 < count1 && i2 < count2) {
-	comp = seqf_compare(array1[i1], array2[i2]);
+      seqf_t *lowest = NULL;
+      for(i = 0; i < layers; i++) {
+	if(pos[i] < counts[i] &&
+	   (!lowest || seqf_compare(arrays[i][pos[i]].name, *lowest) < 0)) {
+	  lowest = &arrays[i][pos[i]].name;
+	}
       }
-      else if(i1 < count1) comp = -1;
-      else if(i2 < count2) comp = 1;
-      else break;
+      if(!lowest) break;
 
       cbuf_put_int(buf, 0); /* d_ino */
       cbuf_put_int(buf, 0); /* d_type */
-      if(comp < 0) {
-	cbuf_put_int(buf, array1[i1].size);
-	cbuf_put_seqf(buf, array1[i1]);
-	i1++;
+      cbuf_put_int(buf, lowest->size);
+      cbuf_put_seqf(buf, *lowest);
+      count++;
+
+      /* Skip this name in all the layers that contain it. */
+      {
+	seqf_t name = *lowest;
+	for(i = 0; i < layers; i++) {
+	  if(pos[i] < counts[i] &&
+	     seqf_compare(arrays[i][pos[i]].name, name) == 0) {
+	    pos[i]++;
+	  }
+	}
       }
-      else if(comp > 0) {
-	cbuf_put_int(buf, array2[i2].size);
-	cbuf_put_seqf(buf, array2[i2]);
-	i2++;
+    }
+    *result = seqt_of_cbuf(buf);
+
+    if(cache && cacheable) {
+      seqf_t data = flatten(r, *result);
+      cache->data = malloc(data.size);
+      cache->stamps = malloc(layers * sizeof(struct dir_stamp));
+      if(cache->data && cache->stamps) {
+	memcpy(cache->data, data.data, data.size);
+	memcpy(cache->stamps, stamps, layers * sizeof(struct dir_stamp));
+	cache->size = data.size;
+	cache->count = count;
+	cache->layers = layers;
+	cache->valid = 1;
       }
       else {
-	cbuf_put_int(buf, array1[i1].size);
-	cbuf_put_seqf(buf, array1[i1]);
-	i1++;
-	i2++;
+	free(cache->data);
+	free(cache->stamps);
+	merged_list_cache_init(cache);
       }
-      count++;
     }
-    *result = seqt_of_cbuf(buf);
     region_free(r2);
     return count;
   }
@@ -201,7 +448,8 @@ int union_dir_list(struct filesys_obj *obj, region_t r, seqt_t *result, int *err
 {
   struct union_dir *dir = (void *) obj;
   
-  return merge_dir_lists(r, dir->dir1, dir->dir2, result, err);
+  return merge_dir_lists_n(r, dir->count, dir->dirs, &dir->list_cache,
+			   result, err);
 }
 
 
@@ -20,12 +20,53 @@
 #ifndef filesysobj_union_h
 #define filesysobj_union_h
 
+#include <sys/stat.h>
+#include "filesysobj.h"
+
+
 struct filesys_obj *make_union_dir(struct filesys_obj *x, struct filesys_obj *y);
 
+struct dir_entry {
+  int inode, type;
+  seqf_t name;
+};
+
+/* Identifies a version of a real directory's contents. */
+struct dir_stamp {
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime, ctime;
+};
+
+/* A merged listing kept by a layered directory object.  It is only
+   used while all the layers are real directories with unchanged
+   stamps. */
+struct merged_list_cache {
+  int valid;
+  int layers;
+  struct dir_stamp *stamps; /* malloc'd; one per layer */
+  int count;
+  char *data; /* malloc'd */
+  int size;
+};
+
+int sorted_dir_list(region_t r, struct filesys_obj *dir,
+		    struct dir_entry **result,
+		    struct dir_stamp *stamp, int *cacheable,
+		    int *err);
+
+void merged_list_cache_init(struct merged_list_cache *cache);
+void merged_list_cache_clear(struct merged_list_cache *cache);
+
 int merge_dir_lists(region_t r,
 		    struct filesys_obj *dir1,
 		    struct filesys_obj *dir2,
+		    struct merged_list_cache *cache,
 		    seqt_t *result,
 		    int *err);
+int merge_dir_lists_n(region_t r, int layers, struct filesys_obj **dirs,
+		      struct merged_list_cache *cache,
+		      seqt_t *result,
+		      int *err);
 
 #endif
@@ -342,6 +342,23 @@ void marshal_cap_call(struct filesys_obj *obj, region_t r,
     *result = pack_dir_create_file_result(r, fd);
     return;
   }
+  case METHOD_DIR_OPEN_OR_CREATE:
+  {
+    int flags;
+    int mode;
+    seqf_t leaf;
+    int fd;
+    int err;
+    if(unpack_dir_open_or_create(r, args, &flags, &mode, &leaf) < 0) goto bad_msg;
+    fd = obj->vtable->open_or_create(obj, region_strdup_seqf(r, leaf),
+				     flags, mode, &err);
+    if(fd < 0) {
+      *result = pack_fail(r, err);
+      return;
+    }
+    *result = pack_dir_open_or_create_result(r, fd);
+    return;
+  }
   case METHOD_DIR_MKDIR:
   {
     int mode;
@@ -706,6 +723,26 @@ int marshal_create_file(struct filesys_obj *obj, const char *leaf,
   return fd;
 }
 
+int marshal_open_or_create(struct filesys_obj *obj, const char *leaf,
+			   int flags, int mode, int *err)
+{
+  int fd;
+  region_t r = region_make();
+  struct cap_args result;
+  cap_call(obj, r, pack_dir_open_or_create(r, flags, mode,
+					   mk_string(r, leaf)), &result);
+  if(unpack_dir_open_or_create_result(r, result, &fd) >= 0) {}
+  else if(unpack_fail(r, result, err) >= 0) { fd = -1; }
+  else {
+    *err = ENOSYS;
+    fd = -1;
+    caps_free(result.caps);
+    close_fds(result.fds);
+  }
+  region_free(r);
+  return fd;
+}
+
 int marshal_mkdir(struct filesys_obj *obj, const char *leaf, int mode, int *err)
 {
   int rc;
@@ -927,6 +964,32 @@ int dummy_create_file(struct filesys_obj *obj, const char *leaf,
   return -1;
 }
 
+/* Default for directories that cannot do better:  look up the entry,
+   then open it or create it. */
+int generic_open_or_create(struct filesys_obj *obj, const char *leaf,
+			   int flags, int mode, int *err)
+{
+  struct filesys_obj *child = obj->vtable->traverse(obj, leaf);
+  int fd;
+  if(!child) {
+    return obj->vtable->create_file(obj, leaf, flags, mode, err);
+  }
+  if(flags & O_EXCL) {
+    *err = EEXIST;
+    fd = -1;
+  }
+  else {
+    switch(child->vtable->fsobj_type(child)) {
+      case OBJT_FILE: fd = child->vtable->open(child, flags, err); break;
+      case OBJT_DIR: *err = EISDIR; fd = -1; break;
+      case OBJT_SYMLINK: *err = ELOOP; fd = -1; break;
+      default: *err = ENOTDIR; fd = -1; break;
+    }
+  }
+  filesys_obj_free(child);
+  return fd;
+}
+
 int dummy_mkdir(struct filesys_obj *obj, const char *leaf, int mode, int *err)
 {
   *err = ENOSYS;
@@ -1101,6 +1164,14 @@ int invalid_create_file(struct filesys_obj *obj, const char *leaf,
   return -1;
 }
 
+int invalid_open_or_create(struct filesys_obj *obj, const char *leaf,
+			   int flags, int mode, int *err)
+{
+  assert(0);
+  *err = ENOSYS;
+  return -1;
+}
+
 int invalid_mkdir(struct filesys_obj *obj, const char *leaf, int mode, int *err)
 {
   assert(0);
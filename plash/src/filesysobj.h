@@ -122,6 +122,12 @@ struct filesys_obj_vtable {
   int (*list)(struct filesys_obj *obj, region_t r, seqt_t *result, int *err);
   int (*create_file)(struct filesys_obj *obj, const char *leaf,
 		     int flags, int mode, int *err);
+  /* Opens `leaf' as a file, creating it if it does not exist, like
+     open() with O_CREAT (`flags' may include O_EXCL).  Does not follow
+     symlinks:  fails with ELOOP if `leaf' is one.  Fails with EISDIR if
+     `leaf' is a directory. */
+  int (*open_or_create)(struct filesys_obj *obj, const char *leaf,
+			int flags, int mode, int *err);
   int (*mkdir)(struct filesys_obj *obj, const char *leaf, int mode, int *err);
   int (*symlink)(struct filesys_obj *obj, const char *leaf,
 		 const char *oldpath, int *err);
@@ -217,6 +223,8 @@ struct filesys_obj *dummy_traverse(struct filesys_obj *obj, const char *leaf);
 int dummy_list(struct filesys_obj *obj, region_t r, seqt_t *result, int *err);
 int dummy_create_file(struct filesys_obj *obj, const char *leaf,
 		      int flags, int mode, int *err);
+int generic_open_or_create(struct filesys_obj *obj, const char *leaf,
+			   int flags, int mode, int *err);
 int dummy_mkdir(struct filesys_obj *obj, const char *leaf, int mode, int *err);
 int dummy_symlink(struct filesys_obj *obj, const char *leaf,
 		  const char *oldpath, int *err);
@@ -254,6 +262,8 @@ struct filesys_obj *marshal_traverse(struct filesys_obj *obj, const char *leaf);
 int marshal_list(struct filesys_obj *obj, region_t r, seqt_t *result, int *err);
 int marshal_create_file(struct filesys_obj *obj, const char *leaf,
 			int flags, int mode, int *err);
+int marshal_open_or_create(struct filesys_obj *obj, const char *leaf,
+			   int flags, int mode, int *err);
 int marshal_mkdir(struct filesys_obj *obj, const char *leaf, int mode, int *err);
 int marshal_symlink(struct filesys_obj *obj, const char *leaf,
 		    const char *oldpath, int *err);
@@ -161,5 +161,11 @@ struct filesys_obj *make_read_only_slot(struct filesys_obj *obj)
   return (void *) slot;
 }
 
+/* Read-only slots always contain the same object. */
+int is_read_only_slot(struct filesys_obj *slot)
+{
+  return slot->vtable == &ro_slot_vtable;
+}
+
 
 #include "out-vtable-filesysslot.h"
@@ -68,6 +68,7 @@ struct filesys_read_only_slot {
 struct filesys_obj *make_generic_slot(struct filesys_obj *dir, char *leaf);
 /* Takes ownership of the obj reference */
 struct filesys_obj *make_read_only_slot(struct filesys_obj *obj);
+int is_read_only_slot(struct filesys_obj *slot);
 
 
 #endif
@@ -23,7 +23,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <fcntl.h>
+#include <string.h>
+#include <signal.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 
 #include "region.h"
 #include "parse-filename.h"
@@ -38,6 +41,9 @@
 #include "marshal.h"
 #include "marshal-pack.h"
 #include "exec.h"
+#include "filesysobj-real.h"
+#include "build-fs.h"
+#include "log.h"
 
 
 int process_chdir(struct process *p, seqf_t pathname, int *err)
@@ -56,6 +62,46 @@ int process_chdir(struct process *p, seqf_t pathname, int *err)
   }
 }
 
+/* Handles open() with O_CREAT by asking the directory to open or
+   create the last component in one step, rather than looking it up
+   first.  Returns FD, -1 for an error, or -2 if process_open_d() must
+   handle the general case:  the last component is a symlink to
+   follow or a directory, or the directory does not implement
+   open_or_create. */
+static int process_open_or_create(struct filesys_obj *root,
+				  struct dir_stack *cwd, seqf_t pathname,
+				  int flags, int mode, int *err)
+{
+  region_t r = region_make();
+  void *result;
+  int rc =
+    resolve_obj(r, root, cwd, pathname, SYMLINK_LIMIT,
+		1 /* nofollow */, CREATE_ONLY, &result, err);
+  region_free(r);
+  if(rc == RESOLVED_EMPTY_SLOT) {
+    struct resolved_slot *slot = result;
+    int fd = slot->dir->vtable->open_or_create(slot->dir, slot->leaf,
+					       flags, mode, err);
+    free_resolved_slot(slot);
+    if(fd < 0 &&
+       ((*err == ELOOP && !(flags & (O_NOFOLLOW | O_EXCL))) ||
+	*err == EISDIR ||
+	*err == ENOSYS)) {
+      return -2;
+    }
+    return fd;
+  }
+  else if(rc == RESOLVED_DIR) {
+    dir_stack_free(result);
+    return -2;
+  }
+  else if(rc > 0) {
+    filesys_obj_free(result);
+    return -2;
+  }
+  return -1;
+}
+
 /* Returns FD, or -1 for an error.
    If this is returning a dummy FD (for directories), it will set
    `dummy_fd' to 1, fill out `r_obj', and return -1. */
@@ -63,9 +109,20 @@ int process_open_d(struct filesys_obj *root, struct dir_stack *cwd,
 		   seqf_t pathname, int flags, int mode, int *err,
 		   int *dummy_fd, cap_t *r_obj)
 {
-  region_t r = region_make();
+  region_t r;
   void *result;
-  int rc =
+  int rc;
+
+  *dummy_fd = 0;
+  /* A trailing slash means the pathname must be a directory. */
+  if((flags & O_CREAT) && !(flags & O_DIRECTORY) &&
+     pathname.size > 0 && pathname.data[pathname.size - 1] != '/') {
+    int fd = process_open_or_create(root, cwd, pathname, flags, mode, err);
+    if(fd != -2) return fd;
+  }
+
+  r = region_make();
+  rc =
     resolve_obj(r, root, cwd, pathname, SYMLINK_LIMIT,
 		((flags & O_NOFOLLOW) || (flags & O_EXCL)) ? 1:0,
 		(flags & O_CREAT) ? 1:0,
@@ -153,6 +210,35 @@ int process_open(struct filesys_obj *root, struct dir_stack *cwd,
   return fd;
 }
 
+/* Returns a kernel-level FD for the directory `dir' if the process may
+   safely resolve pathnames relative to it itself, or -1 otherwise.
+   The kernel knows nothing of the process's namespace and cannot stop
+   it from following "..", so this is only safe when the namespace
+   grants nothing less than the real root directory, read-write:  the
+   root must pass through to an unwrapped real_dir for the server's
+   "/", and `dir' must itself be an unwrapped real_dir. */
+static int kernel_dir_fd(struct process *proc, struct filesys_obj *dir)
+{
+  struct real_dir *real = (void *) dir;
+  struct filesys_obj *root;
+  struct stat st;
+  int is_real_root;
+
+  if(dir->vtable != &real_dir_vtable || !real->fd) return -1;
+
+  root = comb_dir_passthrough(proc->root);
+  if(!root) root = inc_ref(proc->root);
+  is_real_root =
+    root->vtable == &real_dir_vtable &&
+    stat("/", &st) == 0 &&
+    ((struct real_dir *) root)->stat.st_dev == st.st_dev &&
+    ((struct real_dir *) root)->stat.st_ino == st.st_ino;
+  filesys_obj_free(root);
+  if(!is_real_root) return -1;
+
+  return openat(real->fd->fd, ".", O_RDONLY | O_DIRECTORY);
+}
+
 /* mkdir() behaves like open() with O_EXCL: it won't follow a symbolic
    link and create the destination. */
 int process_mkdir(struct filesys_obj *root, struct dir_stack *cwd,
@@ -187,6 +273,7 @@ int process_rename(struct filesys_obj *root,
 		   struct dir_stack *new_dir, seqf_t newpath, int *err)
 {
   struct resolved_slot *slot_src, *slot_dest;
+  struct filesys_obj *src, *dest;
   int rc;
   slot_src = resolve_any_slot(root, old_dir, oldpath, SYMLINK_LIMIT, err);
   if(!slot_src) return -1;
@@ -195,9 +282,11 @@ int process_rename(struct filesys_obj *root,
     free_resolved_slot(slot_src);
     return -1;
   }
-  rc = slot_src->dir->vtable->rename(slot_src->dir, slot_src->leaf,
-				     slot_dest->dir, slot_dest->leaf,
-				     err);
+  /* Go straight to the directories holding the entries, so that
+     renaming between a combined directory and a real one works. */
+  src = comb_dir_entry_dir(slot_src->dir, slot_src->leaf);
+  dest = comb_dir_entry_dir(slot_dest->dir, slot_dest->leaf);
+  rc = src->vtable->rename(src, slot_src->leaf, dest, slot_dest->leaf, err);
   free_resolved_slot(slot_src);
   free_resolved_slot(slot_dest);
   return rc;
@@ -208,6 +297,7 @@ int process_link(struct filesys_obj *root,
 		 struct dir_stack *new_dir, seqf_t newpath, int *err)
 {
   struct resolved_slot *slot_src, *slot_dest;
+  struct filesys_obj *src, *dest;
   int rc;
   slot_src = resolve_any_slot(root, old_dir, oldpath, SYMLINK_LIMIT, err);
   if(!slot_src) return -1;
@@ -216,9 +306,11 @@ int process_link(struct filesys_obj *root,
     free_resolved_slot(slot_src);
     return -1;
   }
-  rc = slot_src->dir->vtable->link(slot_src->dir, slot_src->leaf,
-				   slot_dest->dir, slot_dest->leaf,
-				   err);
+  /* Go straight to the directories holding the entries, so that
+     linking between a combined directory and a real one works. */
+  src = comb_dir_entry_dir(slot_src->dir, slot_src->leaf);
+  dest = comb_dir_entry_dir(slot_dest->dir, slot_dest->leaf);
+  rc = src->vtable->link(src, slot_src->leaf, dest, slot_dest->leaf, err);
   free_resolved_slot(slot_src);
   free_resolved_slot(slot_dest);
   return rc;
@@ -376,28 +468,46 @@ static seqt_t pack_stat_info(region_t r, struct stat *st)
 	      mk_int(r, st->st_ctime)));
 }
 
-static bufref_t pack_string_array(region_t r, argmkbuf_t argbuf,
-				  int argc, const char **argv)
-{
-  bufref_t *array;
-  bufref_t array_ref = argmk_array(argbuf, argc, &array);
-  int i;
-  for(i = 0; i < argc; i++)
-    array[i] = argmk_str(argbuf, mk_string(r, argv[i]));
-  return array_ref;
-}
-
+/* If `preload' is non-NULL, this packs a "RExl" reply, which includes
+   the table of preloaded libraries, and takes ownership of its FDs. */
 static void pack_exec_result(region_t r, argmkbuf_t argbuf, seqf_t cmd_filename,
 			     int argc, const char **argv, bufref_t exec_fds,
+			     struct exec_preload *preload,
 			     seqt_t *reply, fds_t *reply_fds)
 {
-  bufref_t args = pack_string_array(r, argbuf, argc, argv);
-  bufref_t pair = argmk_pair(argbuf, args, exec_fds);
+  bufref_t args = argmk_str_array(argbuf, argc, argv);
+  bufref_t result;
+  int method = METHOD_R_FSOP_EXEC;
+
+  if(preload) {
+    /* The FD map's indexes are indexes into the array of pathnames.
+       Pathnames with no FD do not exist. */
+    struct fd_mapping *fds =
+      region_alloc(r, preload->count * sizeof(struct fd_mapping));
+    int i, count = 0;
+    bufref_t *a;
+    for(i = 0; i < preload->count; i++) {
+      if(preload->fds[i] >= 0) {
+	fds[count].fd_no = i;
+	fds[count].fd = preload->fds[i];
+	count++;
+      }
+    }
+    result = argmk_array(argbuf, 4, &a);
+    a[0] = args;
+    a[1] = exec_fds;
+    a[2] = argmk_str_array(argbuf, preload->count, preload->pathnames);
+    a[3] = argmk_fd_map(argbuf, count, fds);
+    method = METHOD_R_FSOP_EXEC_PRELOAD;
+  }
+  else {
+    result = argmk_pair(argbuf, args, exec_fds);
+  }
 
-  *reply = cat5(r, mk_int(r, METHOD_R_FSOP_EXEC),
+  *reply = cat5(r, mk_int(r, method),
 		mk_int(r, cmd_filename.size),
 		mk_leaf(r, cmd_filename),
-		mk_int(r, pair),
+		mk_int(r, result),
 		argbuf_data(argbuf));
   *reply_fds = argbuf_fds(argbuf);
 }
@@ -407,6 +517,193 @@ struct log_info {
   int read_only; /* Whether the operation attempted was read-only */
 };
 
+/* Statistics on fs_op requests, kept per operation name.  These are
+   always collected; they are cheap compared with the cost of the
+   request itself.  They can be read with the fsop_stats method, or
+   written to stderr by sending the server SIGUSR1.
+
+   The dump has two kinds of line for each operation:
+     <op> ok=<count> fail=<count> [e<errno>=<count> ...]
+     <op> ok-us|fail-us <count> <count> ...
+   In the second, the Nth count (from 0) is the number of calls that
+   took under 2^N microseconds and at least 2^(N-1).  Trailing zero
+   counts are omitted, and the last bucket also counts anything longer. */
+
+#define FSOP_STATS_MAX_OPS 64
+#define FSOP_STATS_BUCKETS 24
+#define FSOP_STATS_MAX_ERRNO 160
+
+struct fsop_op_stats {
+  const char *op_name;
+  unsigned int ok, fail;
+  unsigned int ok_hist[FSOP_STATS_BUCKETS];
+  unsigned int fail_hist[FSOP_STATS_BUCKETS];
+  unsigned int errors[FSOP_STATS_MAX_ERRNO];
+};
+
+static struct fsop_op_stats fsop_stats[FSOP_STATS_MAX_OPS];
+static int fsop_stats_count = 0;
+
+static struct fsop_op_stats *fsop_stats_lookup(const char *op_name)
+{
+  int i;
+  /* Names are normally string literals, so try comparing pointers first. */
+  for(i = 0; i < fsop_stats_count; i++) {
+    if(fsop_stats[i].op_name == op_name) return &fsop_stats[i];
+  }
+  for(i = 0; i < fsop_stats_count; i++) {
+    if(!strcmp(fsop_stats[i].op_name, op_name)) return &fsop_stats[i];
+  }
+  if(fsop_stats_count == FSOP_STATS_MAX_OPS) return NULL;
+  fsop_stats[fsop_stats_count].op_name = op_name;
+  return &fsop_stats[fsop_stats_count++];
+}
+
+static void fsop_stats_record(const char *op_name, int err, long us)
+{
+  struct fsop_op_stats *st = fsop_stats_lookup(op_name);
+  int bucket = 0;
+
+  if(!st) return;
+  while(bucket < FSOP_STATS_BUCKETS - 1 && us >= (1L << bucket)) bucket++;
+  if(err) {
+    st->fail++;
+    st->fail_hist[bucket]++;
+    if(err > 0 && err < FSOP_STATS_MAX_ERRNO) st->errors[err]++;
+  }
+  else {
+    st->ok++;
+    st->ok_hist[bucket]++;
+  }
+}
+
+/* The dump is formatted without using stdio or malloc so that it can
+   be done from a signal handler.  Output is accumulated a line at a
+   time and passed to a flush function. */
+struct stats_out {
+  char buf[512];
+  int used;
+  void (*flush)(struct stats_out *out);
+  int fd;
+  region_t r;
+  seqt_t text;
+};
+
+static void stats_put_str(struct stats_out *out, const char *str)
+{
+  for(; *str; str++) {
+    if(out->used == sizeof(out->buf)) out->flush(out);
+    out->buf[out->used++] = *str;
+  }
+}
+
+static void stats_put_uint(struct stats_out *out, unsigned int x)
+{
+  char digits[12];
+  int i = sizeof(digits) - 1;
+  digits[i] = 0;
+  do {
+    digits[--i] = '0' + x % 10;
+    x /= 10;
+  } while(x);
+  stats_put_str(out, digits + i);
+}
+
+static void stats_put_hist(struct stats_out *out, const char *op_name,
+			   const char *kind, unsigned int *hist)
+{
+  int count = FSOP_STATS_BUCKETS;
+  int i;
+  while(count > 0 && !hist[count - 1]) count--;
+  if(count == 0) return;
+  stats_put_str(out, op_name);
+  stats_put_str(out, kind);
+  for(i = 0; i < count; i++) {
+    stats_put_str(out, " ");
+    stats_put_uint(out, hist[i]);
+  }
+  stats_put_str(out, "\n");
+  out->flush(out);
+}
+
+static void fsop_stats_dump(struct stats_out *out)
+{
+  int i, e;
+  for(i = 0; i < fsop_stats_count; i++) {
+    struct fsop_op_stats *st = &fsop_stats[i];
+    stats_put_str(out, st->op_name);
+    stats_put_str(out, " ok=");
+    stats_put_uint(out, st->ok);
+    stats_put_str(out, " fail=");
+    stats_put_uint(out, st->fail);
+    for(e = 0; e < FSOP_STATS_MAX_ERRNO; e++) {
+      if(st->errors[e]) {
+	stats_put_str(out, " e");
+	stats_put_uint(out, e);
+	stats_put_str(out, "=");
+	stats_put_uint(out, st->errors[e]);
+      }
+    }
+    stats_put_str(out, "\n");
+    out->flush(out);
+    stats_put_hist(out, st->op_name, " ok-us", st->ok_hist);
+    stats_put_hist(out, st->op_name, " fail-us", st->fail_hist);
+  }
+}
+
+static void stats_flush_fd(struct stats_out *out)
+{
+  int done = 0;
+  while(done < out->used) {
+    int got = write(out->fd, out->buf + done, out->used - done);
+    if(got < 0 && errno == EINTR) continue;
+    if(got <= 0) break;
+    done += got;
+  }
+  out->used = 0;
+}
+
+static void stats_flush_region(struct stats_out *out)
+{
+  char *copy = region_alloc(out->r, out->used);
+  memcpy(copy, out->buf, out->used);
+  out->text = cat2(out->r, out->text, mk_leaf2(out->r, copy, out->used));
+  out->used = 0;
+}
+
+static seqt_t fsop_stats_text(region_t r)
+{
+  struct stats_out out;
+  out.used = 0;
+  out.flush = stats_flush_region;
+  out.r = r;
+  out.text = seqt_empty;
+  fsop_stats_dump(&out);
+  return out.text;
+}
+
+static void fsop_stats_signal_handler(int sig)
+{
+  struct stats_out out;
+  int saved_errno = errno;
+  out.used = 0;
+  out.flush = stats_flush_fd;
+  out.fd = STDERR_FILENO;
+  fsop_stats_dump(&out);
+  errno = saved_errno;
+}
+
+/* Called by servers that want their statistics to be dumped on SIGUSR1. */
+void fsop_stats_install_signal_handler(void)
+{
+  struct sigaction act;
+  memset(&act, 0, sizeof(act));
+  act.sa_handler = fsop_stats_signal_handler;
+  act.sa_flags = SA_RESTART;
+  sigemptyset(&act.sa_mask);
+  sigaction(SIGUSR1, &act, NULL);
+}
+
 int handle_fs_op_message(region_t r, struct process *proc,
 			 struct fs_op_object *obj,
 			 seqf_t msg_orig, fds_t fds_orig, cap_seq_t cap_args,
@@ -507,10 +804,14 @@ int handle_fs_op_message(region_t r, struct process *proc,
     break;
   }
   case METHOD_FSOP_EXEC:
+  case METHOD_FSOP_EXEC_PRELOAD:
   {
     seqf_t cmd_filename;
+    seqf_t lib_path = seqf_empty;
     bufref_t argv_ref;
     m_lenblock(&ok, &msg, &cmd_filename);
+    if(method_id == METHOD_FSOP_EXEC_PRELOAD)
+      m_lenblock(&ok, &msg, &lib_path);
     m_int(&ok, &msg, &argv_ref);
     if(ok) {
       struct arg_m_buf argbuf = { msg, caps_empty, fds_empty };
@@ -528,16 +829,11 @@ int handle_fs_op_message(region_t r, struct process *proc,
 
       /* Unpack arguments. */
       {
-	const bufref_t *a;
-	if(argm_array(&argbuf, argv_ref, &argc, &a)) goto exec_fail;
+	char **a;
+	if(argm_str_array(r, &argbuf, argv_ref, &argc, &a)) goto exec_fail;
 	/* We use argv[0] later on, so check that argc >= 1. */
 	if(argc < 1) goto exec_fail;
-	argv = region_alloc(r, argc * sizeof(seqf_t));
-	for(i = 0; i < argc; i++) {
-	  seqf_t arg;
-	  if(argm_str(&argbuf, a[i], &arg)) goto exec_fail;
-	  argv[i] = region_strdup_seqf(r, arg);
-	}
+	argv = (const char **) a;
       }
 
       /* Log the execve() argument list too. */
@@ -585,8 +881,7 @@ int handle_fs_op_message(region_t r, struct process *proc,
 	cmd_filename2 = seqf_string(ldso_path);
 	argv2[1] = executable_filename;
 
-	bufref_t *array;
-	exec_fds = argmk_array(argmkbuf, 0, &array); /* No FDs returned */
+	exec_fds = argmk_fd_map(argmkbuf, 0, NULL); /* No FDs returned */
       }
       else {
 	extra_args = 2;
@@ -600,19 +895,29 @@ int handle_fs_op_message(region_t r, struct process *proc,
 	  err = errno;
 	  goto exec_fail;
 	}
-	bufref_t *array;
-	exec_fds = argmk_array(argmkbuf, 1, &array);
-	array[0] = argmk_pair(argmkbuf,
-			      argmk_int(argmkbuf, 1), /* Index into argv */
-			      argmk_fd(argmkbuf, ldso_fd));
+	struct fd_mapping fd_arg;
+	fd_arg.fd_no = 1; /* Index into argv */
+	fd_arg.fd = ldso_fd;
+	exec_fds = argmk_fd_map(argmkbuf, 1, &fd_arg);
       }
       assert(argc >= 1);
       argv2[0] = argv[0];
       for(i = 1; i < argc; i++)
 	argv2[extra_args + i] = argv[i];
 
-      pack_exec_result(r, argmkbuf, cmd_filename2, argc + extra_args, argv2,
-		       exec_fds, reply, reply_fds);
+      if(method_id == METHOD_FSOP_EXEC_PRELOAD) {
+	struct exec_preload preload;
+	exec_preload_libraries(r, proc->root, proc->cwd, executable_filename,
+			       lib_path.size > 0 ?
+			         region_strdup_seqf(r, lib_path) : NULL,
+			       &preload);
+	pack_exec_result(r, argmkbuf, cmd_filename2, argc + extra_args, argv2,
+			 exec_fds, &preload, reply, reply_fds);
+      }
+      else {
+	pack_exec_result(r, argmkbuf, cmd_filename2, argc + extra_args, argv2,
+			 exec_fds, NULL, reply, reply_fds);
+      }
       *log_reply = mk_string(r, "ok");
       log->read_only = TRUE;
       return 0;
@@ -652,30 +957,28 @@ int handle_fs_op_message(region_t r, struct process *proc,
 	return 0;
       }
       else if(dummy_fd) {
-	/* Open a file descriptor to use as the dummy FD.
-	   We use /dev/null.  Check that we're getting what we expect
-	   by looking at the device type -- it's 1,3 under Linux. */
-	struct stat stat;
-	int fd = open("/dev/null", O_RDONLY);
-	if(fd < 0) goto dummy_fail;
-	if(fstat(fd, &stat) < 0 ||
-	   !S_ISCHR(stat.st_mode) ||
-	   stat.st_rdev != 0x103) {
-	  close(fd);
-	  goto dummy_fail;
+	/* If the directory is a real one that the process could reach
+	   anyway, return a real directory FD so that libc can do
+	   openat()/fstatat() calls on it without asking us. */
+	int kernel_fd =
+	  kernel_dir_fd(proc, dir_stack_upcast(d_obj)->dir);
+	if(kernel_fd >= 0) {
+	  *reply = mk_int(r, METHOD_R_FSOP_OPEN_DIR_KERNEL);
+	  *reply_fds = mk_fds1(r, kernel_fd);
+	  *log_reply = mk_string(r, "got dir, kernel FD");
+	  *r_caps = mk_caps1(r, d_obj);
+	  return 0;
 	}
-	
-	*reply = mk_int(r, METHOD_R_FSOP_OPEN_DIR);
-	*log_reply = mk_string(r, "got dir, use dummy FD");
-	*reply_fds = mk_fds1(r, fd);
+	/* Otherwise the client creates its own dummy FD to stand in for
+	   the directory, so we only return the dir_stack object.  This
+	   saves opening /dev/null here and passing an FD across the
+	   socket on every opendir()/fchdir()-style open().  We do not
+	   pass a real directory FD: the client could use it to escape
+	   the chroot jail with openat(fd, "..", ...). */
+	*reply = mk_int(r, METHOD_R_FSOP_OPEN_DIR_NOFD);
+	*log_reply = mk_string(r, "got dir");
 	*r_caps = mk_caps1(r, d_obj);
 	return 0;
-      dummy_fail:
-	filesys_obj_free(d_obj);
-	*reply = cat2(r, mk_int(r, METHOD_FAIL),
-		      mk_int(r, EIO));
-	*log_reply = mk_string(r, "fail: can't use /dev/null as dummy");
-	return 0;
       }
       else {
 	return err;
@@ -1254,6 +1557,18 @@ int handle_fs_op_message(region_t r, struct process *proc,
       }
     }
   }
+  case METHOD_FSOP_STATS:
+  {
+    m_end(&ok, &msg);
+    if(ok) {
+      log->op_name = "fsop_stats";
+      log->read_only = TRUE;
+      *reply = cat2(r, mk_int(r, METHOD_R_FSOP_STATS), fsop_stats_text(r));
+      *log_reply = mk_string(r, "ok");
+      return 0;
+    }
+    break;
+  }
   case METHOD_FSOP_LOG:
   {
     if(ok) {
@@ -1312,10 +1627,13 @@ void fs_op_call(struct filesys_obj *obj1, region_t r,
   seqt_t log_msg = mk_string(r, "");
   seqt_t log_reply = mk_string(r, "?");
   struct log_info log_info;
+  struct timeval start, end;
+  long duration_us;
   int err;
 
   log_info.read_only = FALSE;
   log_info.op_name = "???";
+  gettimeofday(&start, NULL);
   
   result->data = seqt_empty;
   result->caps = caps_empty;
@@ -1324,23 +1642,27 @@ void fs_op_call(struct filesys_obj *obj1, region_t r,
 		       args.fds, args.caps,
 		       &result->data, &result->fds, &result->caps,
 		       &log_msg, &log_reply, &log_info);
+  gettimeofday(&end, NULL);
+  duration_us = (end.tv_sec - start.tv_sec) * 1000000L +
+    (end.tv_usec - start.tv_usec);
+  fsop_stats_record(log_info.op_name, err, duration_us);
   if(err) {
     result->data = cat2(r, mk_int(r, METHOD_FAIL),
 			mk_int(r, err));
-    log_reply = mk_printf(r, "fail: %s", strerror(err));
   }
   caps_free(args.caps);
   close_fds(args.fds);
   
   if(obj->log) {
-    seqt_t msg = mk_printf(r, "[%c%c] %s%s%s: %s",
-	    log_info.read_only ? 'r' : 'w',
-	    err ? '!' : '.',
-	    log_info.op_name,
-	    log_msg.size > 0 ? ": " : "",
-	    flatten_str(r, log_msg),
-	    flatten_str(r, log_reply));
-    obj->log->vtable->log_msg(obj->log, flatten(r, msg));
+    struct log_op_info op;
+    op.op_name = log_info.op_name;
+    op.read_only = log_info.read_only;
+    op.err = err;
+    op.start = start;
+    op.duration_us = duration_us;
+    op.msg = log_msg;
+    op.reply = log_reply;
+    log_op(obj->log, &op);
   }
 }
 
@@ -45,6 +45,8 @@ cap_t make_fs_op_server(struct filesys_obj *log,
 
 cap_t fs_op_maker_make(struct filesys_obj *log);
 
+void fsop_stats_install_signal_handler(void);
+
 cap_t conn_maker_make(void);
 cap_t union_dir_maker_make(void);
 cap_t fab_dir_maker_make(void);
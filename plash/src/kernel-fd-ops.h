@@ -23,6 +23,7 @@
 #define kernel_close close
 #define kernel_dup dup
 #define kernel_dup2 dup2
+#define kernel_pipe pipe
 #define kernel_fxstat __fxstat
 #define kernel_fxstat64 __fxstat64
 #define kernel_connect connect
@@ -52,6 +52,10 @@ int req_and_reply_with_fds2(region_t r, seqt_t msg, fds_t fds,
 int req_and_reply(region_t r, seqt_t msg, seqf_t *reply);
 void libc_log(const char *msg);
 
+/* Passes the table of libraries that the server opened for ld.so
+   from execve() to ld.so.  See exec_preload_libraries() in exec.c. */
+#define PRELOADED_LIBS_VAR "PLASH_PRELOADED_LIBS"
+
 
 #ifdef GLIBC_SEPARATE_BUILD
 
@@ -28,8 +28,11 @@
    Directory FDs:  These are implemented by a Plash object, which is
    actually a dir_stack rather than a directory object.  This is used
    to implement fchdir(), and fstat() on directory FDs.  The
-   corresponding kernel-level FD is a "dummy" FD, created by opening
-   /dev/null.
+   corresponding kernel-level FD is a "dummy" FD, created by libc as
+   the read end of a pipe whose write end is closed.  (Older servers
+   pass a dummy FD for /dev/null instead.)  When the namespace grants
+   the whole real filesystem, the server may instead pass a real
+   directory FD, which libc uses to do some *at() calls itself.
 
    Unix domain socket FDs:  The pathname passed to connect() or bind()
    is stored by libc so that getsockname() can return the pathname.
@@ -48,6 +51,7 @@
 struct libc_fd {
   cap_t fd_dir_obj; /* May be NULL */
   char *fd_socket_pathname; /* String allocated with malloc(), or NULL */
+  int fd_kernel_dir; /* Whether the kernel-level FD is a real directory */
 };
 
 extern struct libc_fd *g_fds;
@@ -57,5 +61,9 @@ void fds_resize(int fd);
 void fds_slot_clear(int fd);
 int fds_get_dir_obj(int dir_fd, cap_t *result);
 
+/* Returned by fds_kernel_openat() when the call must go to the server. */
+#define FDS_USE_SERVER (-2)
+int fds_kernel_openat(int dir_fd, const char *pathname, int flags, int mode);
+
 
 #endif
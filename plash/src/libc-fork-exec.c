@@ -161,24 +161,13 @@ static int exec_object(cap_t obj, int argc, const char **argv,
   int got_cwd;
 
   /* Pack main argv arguments. */
-  {
-    bufref_t *a;
-    int i;
-    argv_arg = argmk_array(argbuf, argc, &a);
-    for(i = 0; i < argc; i++) {
-      a[i] = argmk_str(argbuf, mk_string(r, argv[i]));
-    }
-  }
+  argv_arg = argmk_str_array(argbuf, argc, argv);
 
   /* Pack the environment arguments. */
   {
-    bufref_t *a;
-    int i, count;
+    int count;
     for(count = 0; envp[count]; count++) /* nothing */;
-    env_arg = argmk_array(argbuf, count, &a);
-    for(i = 0; i < count; i++) {
-      a[i] = argmk_str(argbuf, mk_string(r, envp[i]));
-    }
+    env_arg = argmk_str_array(argbuf, count, envp);
   }
 
   /* Get the root directory object. */
@@ -217,7 +206,7 @@ static int exec_object(cap_t obj, int argc, const char **argv,
        If FD i was not present, fds[i] = -1.
        If a FD was copied to FD x, fds[x] = -2. */
     int limit = 100;
-    bufref_t *a;
+    struct fd_mapping *a;
     int i, j, got_fds = 0;
     int *fds = region_alloc(r, limit * sizeof(int));
     for(i = 0; i < limit; i++) fds[i] = -1;
@@ -243,16 +232,17 @@ static int exec_object(cap_t obj, int argc, const char **argv,
 	}
       }
     }
-    fds_arg = argmk_array(argbuf, got_fds, &a);
+    a = region_alloc(r, got_fds * sizeof(struct fd_mapping));
     for(i = 0, j = 0; i < limit; i++) {
       if(fds[i] >= 0) {
 	assert(j < got_fds);
-	a[j] = argmk_pair(argbuf, argmk_int(argbuf, i),
-			  argmk_fd(argbuf, fds[i]));
+	a[j].fd_no = i;
+	a[j].fd = fds[i];
 	j++;
       }
     }
     assert(j == got_fds);
+    fds_arg = argmk_fd_map(argbuf, got_fds, a);
   }
 
   {
@@ -304,27 +294,6 @@ static int exec_object(cap_t obj, int argc, const char **argv,
   return -1;
 }
 
-static int unpack_string_array(region_t r, struct arg_m_buf argbuf, int argref,
-			       int *argc_result, char ***argv_result)
-{
-  int argc;
-  const bufref_t *array;
-  if(argm_array(&argbuf, argref, &argc, &array))
-    return -1;
-  char **argv = region_alloc(r, (argc + 1) * sizeof(char *));
-  int i;
-  for(i = 0; i < argc; i++) {
-    seqf_t arg;
-    if(argm_str(&argbuf, array[i], &arg))
-      return -1;
-    argv[i] = region_strdup_seqf(r, arg);
-  }
-  argv[argc] = NULL;
-  *argc_result = argc;
-  *argv_result = argv;
-  return 0;
-}
-
 static char *int_to_string(region_t r, int value)
 {
   char buf[40];
@@ -333,6 +302,29 @@ static char *int_to_string(region_t r, int value)
   return region_strdup(r, buf);
 }
 
+static int unpack_exec_argv(region_t r, struct arg_m_buf *argbuf,
+			    bufref_t args, bufref_t exec_fds,
+			    int *argc, char ***argv)
+{
+  if(argm_str_array(r, argbuf, args, argc, argv))
+    return -1;
+
+  int fds_count;
+  struct fd_mapping *fds_array;
+  if(argm_fd_map(r, argbuf, exec_fds, &fds_count, &fds_array))
+    return -1;
+  /* Substitute file descriptor arguments into the argv, overwriting
+     placeholder arguments.  The FD numbers here are indexes into argv. */
+  int i;
+  for(i = 0; i < fds_count; i++) {
+    int argv_index = fds_array[i].fd_no;
+    if(!(0 <= argv_index && argv_index < *argc))
+      return -1;
+    (*argv)[argv_index] = int_to_string(r, fds_array[i].fd);
+  }
+  return 0;
+}
+
 static int unpack_exec_result(region_t r, int argref,
 			      seqf_t packed_data, fds_t fds,
 			      int *argc, char ***argv)
@@ -341,31 +333,66 @@ static int unpack_exec_result(region_t r, int argref,
   bufref_t args, exec_fds;
   if(argm_pair(&argbuf, argref, &args, &exec_fds))
     return -1;
-  if(unpack_string_array(r, argbuf, args, argc, argv))
-    return -1;
+  return unpack_exec_argv(r, &argbuf, args, exec_fds, argc, argv);
+}
 
-  int fds_count;
-  const bufref_t *fds_array;
-  if(argm_array(&argbuf, exec_fds, &fds_count, &fds_array))
+
+/* Unpacks the table of libraries preloaded by the server (see
+   exec_preload_libraries() in exec.c) into an environment variable
+   for ld.so.  Each entry is "FD=PATHNAME", or "n=PATHNAME" if the
+   pathname does not exist; entries are separated by ':'. */
+static int unpack_preloaded_libs(region_t r, struct arg_m_buf *argbuf,
+				 bufref_t pathnames_ref, bufref_t fds_ref,
+				 char **env_var)
+{
+  int count, fds_count, i;
+  char **pathnames;
+  struct fd_mapping *fds;
+  int *lib_fds;
+  seqt_t var = mk_string(r, PRELOADED_LIBS_VAR "=");
+
+  if(argm_str_array(r, argbuf, pathnames_ref, &count, &pathnames) ||
+     argm_fd_map(r, argbuf, fds_ref, &fds_count, &fds))
     return -1;
-  /* Substitute file descriptor arguments into the argv, overwriting
-     placeholder arguments. */
-  int i;
+  lib_fds = region_alloc(r, count * sizeof(int));
+  for(i = 0; i < count; i++) lib_fds[i] = -1;
   for(i = 0; i < fds_count; i++) {
-    bufref_t argv_index_ref, fd_ref;
-    int argv_index;
-    int fd;
-    if(argm_pair(&argbuf, fds_array[i], &argv_index_ref, &fd_ref) ||
-       argm_int(&argbuf, argv_index_ref, &argv_index) ||
-       argm_fd(&argbuf, fd_ref, &fd))
+    if(!(0 <= fds[i].fd_no && fds[i].fd_no < count))
       return -1;
-    if(!(0 <= argv_index && argv_index < *argc))
+    lib_fds[fds[i].fd_no] = fds[i].fd;
+  }
+  for(i = 0; i < count; i++) {
+    if(strchr(pathnames[i], ':'))
       return -1;
-    (*argv)[argv_index] = int_to_string(r, fd);
+    if(lib_fds[i] >= 0)
+      var = cat2(r, var, mk_printf(r, "%s%i=%s", i > 0 ? ":" : "",
+				   lib_fds[i], pathnames[i]));
+    else
+      var = cat2(r, var, mk_printf(r, "%sn=%s", i > 0 ? ":" : "",
+				   pathnames[i]));
   }
+  *env_var = flatten_str(r, var);
   return 0;
 }
 
+/* Returns a copy of `envp' with `var' added, replacing any existing
+   setting of the same variable. */
+static char **env_replace(region_t r, char *const envp[], char *var)
+{
+  int count, i, j;
+  int name_len = strchr(var, '=') - var + 1;
+  char **envp2;
+  for(count = 0; envp[count]; count++) /* nothing */;
+  envp2 = region_alloc(r, (count + 2) * sizeof(char *));
+  for(i = 0, j = 0; i < count; i++) {
+    if(strncmp(envp[i], var, name_len))
+      envp2[j++] = envp[i];
+  }
+  envp2[j++] = var;
+  envp2[j] = NULL;
+  return envp2;
+}
+
 
 export(new_plash_libc_kernel_execve, plash_libc_kernel_execve);
 
@@ -397,16 +424,10 @@ int new_execve(const char *cmd_filename, char *const argv[], char *const envp[])
   /* Pack the arguments. */
   argmkbuf_t argbuf = argbuf_make(r);
   bufref_t args;
-  int argc, i;
+  int argc;
   /* Count the arguments. */
   for(argc = 0; argv[argc]; argc++) /* nothing */;
-  {
-    bufref_t *a;
-    args = argmk_array(argbuf, argc, &a);
-    for(i = 0; i < argc; i++) {
-      a[i] = argmk_str(argbuf, mk_string(r, argv[i]));
-    }
-  }
+  args = argmk_str_array(argbuf, argc, (const char **) argv);
 
   plash_libc_lock();
   if(plash_init() < 0) { __set_errno(ENOSYS); goto error; }
@@ -418,15 +439,52 @@ int new_execve(const char *cmd_filename, char *const argv[], char *const envp[])
 
   /* Unset the close-on-exec flag. */
   if(fcntl(comm_sock, F_SETFD, 0) < 0) { goto error; }
-      
+
+  /* Ask the server to open the libraries that ld.so will need.  It
+     needs to know the new program's LD_LIBRARY_PATH for this. */
+  const char *lib_path = "";
+  int i;
+  for(i = 0; envp[i]; i++) {
+    if(!strncmp(envp[i], "LD_LIBRARY_PATH=", 16))
+      lib_path = envp[i] + 16;
+  }
   cap_call(fs_server, r,
-	   pl_pack(r, METHOD_FSOP_EXEC, "siS", seqf_string(cmd_filename),
+	   pl_pack(r, METHOD_FSOP_EXEC_PRELOAD, "ssiS",
+		   seqf_string(cmd_filename), seqf_string(lib_path),
 		   args, flatten_reuse(r, argbuf_data(argbuf))),
 	   &result);
   seqf_t cmd_filename2;
   int argv2_ref;
   seqf_t argv2_packed;
   fds_t exec_fds;
+  int err;
+  if(pl_unpack(r, result, METHOD_R_FSOP_EXEC_PRELOAD, "siSF", &cmd_filename2,
+	       &argv2_ref, &argv2_packed, &exec_fds)) {
+    struct arg_m_buf argbuf2 = { argv2_packed, caps_empty, exec_fds };
+    int size;
+    const bufref_t *a;
+    int argc2;
+    char **argv2;
+    char *preload_var;
+    if(argm_array(&argbuf2, argv2_ref, &size, &a) || size != 4 ||
+       unpack_exec_argv(r, &argbuf2, a[0], a[1], &argc2, &argv2) ||
+       unpack_preloaded_libs(r, &argbuf2, a[2], a[3], &preload_var)) {
+      close_fds(exec_fds);
+      __set_errno(EIO);
+      goto error;
+    }
+    kernel_execve(region_strdup_seqf(r, cmd_filename2), argv2,
+		  env_replace(r, envp, preload_var));
+    close_fds(exec_fds);
+    goto error;
+  }
+  if(pl_unpack(r, result, METHOD_FAIL, "i", &err) && err == ENOSYS) {
+    /* Older servers do not implement preloading. */
+    cap_call(fs_server, r,
+	     pl_pack(r, METHOD_FSOP_EXEC, "siS", seqf_string(cmd_filename),
+		     args, flatten_reuse(r, argbuf_data(argbuf))),
+	     &result);
+  }
   if(pl_unpack(r, result, METHOD_R_FSOP_EXEC, "siSF", &cmd_filename2,
 	       &argv2_ref, &argv2_packed, &exec_fds)) {
     int argc2;
@@ -30,6 +30,7 @@
 #include <sys/stat.h>
 #include <sys/un.h>
 #include <sys/statfs.h>
+#include <sys/syscall.h>
 
 #include "region.h"
 #include "comms.h"
@@ -140,6 +141,7 @@ static void libc_fd_init(struct libc_fd *fd)
 {
   fd->fd_dir_obj = NULL;
   fd->fd_socket_pathname = NULL;
+  fd->fd_kernel_dir = 0;
 }
 
 /* Ensure that the g_fds array is at least `fd + 1' elements long,
@@ -211,6 +213,219 @@ int fds_get_dir_obj(int dir_fd, cap_t *result)
 }
 
 
+#if defined(SYS_openat2) && !(defined(IN_RTLD) || defined(IS_IN_rtld))
+#define HAVE_KERNEL_OPENAT
+
+/* Same layout as the kernel's "struct open_how". */
+struct kernel_open_how {
+  unsigned long long flags;
+  unsigned long long mode;
+  unsigned long long resolve;
+};
+#define KERNEL_RESOLVE_NO_MAGICLINKS 0x02
+#define KERNEL_RESOLVE_NO_SYMLINKS 0x04
+#define KERNEL_RESOLVE_BENEATH 0x08
+#endif
+
+/* Tries to open `pathname' relative to `dir_fd' with the kernel,
+   without asking the server.  This is only possible when the server
+   gave us a real directory FD for `dir_fd'.  The kernel knows nothing
+   about symlinks that the server would resolve differently or about
+   "..", so we only trust it for pathnames that stay beneath the
+   directory and contain no symlinks.  Directories (unless O_PATH is
+   given) must also be opened by the server, so that we get a
+   directory object for them.  New files must be created by the
+   server too, because the kernel would make them owned by the
+   sandbox's UID rather than the user's.
+   Returns a FD, or -1 with errno set for an error that the server
+   would also give, or FDS_USE_SERVER. */
+int fds_kernel_openat(int dir_fd, const char *pathname, int flags, int mode)
+{
+#ifdef HAVE_KERNEL_OPENAT
+  struct kernel_open_how how;
+  struct stat st;
+  int fd;
+
+  if(!(0 <= dir_fd && dir_fd < g_fds_size && g_fds[dir_fd].fd_kernel_dir))
+    return FDS_USE_SERVER;
+  if((flags & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL))
+    return FDS_USE_SERVER;
+
+  /* With O_CREAT, an existing file can still be opened directly. */
+  how.flags = flags & ~O_CREAT;
+  how.mode = 0;
+  how.resolve = KERNEL_RESOLVE_BENEATH | KERNEL_RESOLVE_NO_SYMLINKS |
+    KERNEL_RESOLVE_NO_MAGICLINKS;
+  fd = syscall(SYS_openat2, dir_fd, pathname, &how, sizeof(how));
+  if(fd < 0) {
+    /* Other errors, such as EXDEV for "..", ELOOP for symlinks, or
+       EACCES (we are running under a different UID from the server),
+       might not be what the server would say. */
+    if(errno == ENOENT && (flags & O_CREAT))
+      return FDS_USE_SERVER;
+    if(errno == ENOENT || errno == EEXIST || errno == ENOTDIR)
+      return -1;
+    return FDS_USE_SERVER;
+  }
+  if(!(flags & O_PATH) &&
+     (kernel_fxstat(_STAT_VER, fd, &st) < 0 || S_ISDIR(st.st_mode))) {
+    kernel_close(fd);
+    return FDS_USE_SERVER;
+  }
+  fds_slot_clear_warn_if_used(fd);
+  return fd;
+#else
+  return FDS_USE_SERVER;
+#endif
+}
+
+
+/* Create a kernel-level FD to stand in for a directory FD.  We use
+   the read end of a pipe whose write end has been closed: reading it
+   gives EOF and writing it gives EBADF, much as for a directory opened
+   read-only, and it grants no authority. */
+static int make_dummy_dir_fd(void)
+{
+#if defined(IN_RTLD) || defined(IS_IN_rtld)
+  /* In ld.so, pipe() is not available. */
+  __set_errno(ENOSYS);
+  return -1;
+#else
+  int pipe_fds[2];
+  if(kernel_pipe(pipe_fds) < 0)
+    return -1;
+  kernel_close(pipe_fds[1]);
+  return pipe_fds[0];
+#endif
+}
+
+static void fds_set_dir_obj(int fd, cap_t dir_obj)
+{
+  assert(fd >= 0);
+  fds_resize(fd);
+  fds_slot_clear_warn_if_used(fd);
+  log_fd(fd, "fill out fd_dir_obj");
+  g_fds[fd].fd_dir_obj = dir_obj;
+}
+
+
+/* The table of libraries that the server opened for us on execve(),
+   so that ld.so does not need to send a request for each library it
+   opens.  It is parsed from PRELOADED_LIBS_VAR the first time open()
+   is called, rather than on every call.  Each entry points into the
+   environment variable, so that the entry can be marked as used there
+   (by overwriting its first character) for the benefit of the copy of
+   this code in libc, which has its own table. */
+#define PRELOADED_LIBS_MAX 128
+
+struct preloaded_lib {
+  char *entry;
+  const char *pathname;
+  int pathname_len;
+  int fd; /* -1 if the pathname does not exist, -2 once used */
+};
+
+static struct preloaded_lib preloaded_libs[PRELOADED_LIBS_MAX];
+static int preloaded_libs_count = -1; /* -1 until parsed */
+
+/* The FDs are marked close-on-exec, so that any that are not closed
+   by ld.so or by preloaded_libs_release() do not leak into programs
+   that this process runs. */
+static void preloaded_libs_parse(void)
+{
+  char *entry = getenv(PRELOADED_LIBS_VAR);
+  preloaded_libs_count = 0;
+  if(!entry)
+    return;
+  while(*entry) {
+    char *end = strchr(entry, ':');
+    char *eq = strchr(entry, '=');
+    int fd = -2;
+    if(!end) end = entry + strlen(entry);
+    if(eq && eq < end) {
+      if(entry[0] == 'n') {
+	fd = -1;
+      }
+      else if('0' <= entry[0] && entry[0] <= '9') {
+	char *p;
+	fd = 0;
+	for(p = entry; p < eq; p++) fd = fd * 10 + (*p - '0');
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+      }
+      if(fd != -2 && preloaded_libs_count < PRELOADED_LIBS_MAX) {
+	struct preloaded_lib *lib = &preloaded_libs[preloaded_libs_count++];
+	lib->entry = entry;
+	lib->pathname = eq + 1;
+	lib->pathname_len = end - (eq + 1);
+	lib->fd = fd;
+      }
+    }
+    entry = *end ? end + 1 : end;
+  }
+}
+
+/* Looks up `pathname' in the table of preloaded libraries.  Each FD
+   is only returned once; later opens of the pathname go to the server.
+   Returns 1 if `pathname' was found, with *result set to a FD or to -1
+   with errno set.  Returns 0 otherwise. */
+static int preloaded_lib_open(int dir_fd, const char *pathname, int flags,
+			      int *result)
+{
+  int len, i;
+  if(preloaded_libs_count < 0)
+    preloaded_libs_parse();
+  if(preloaded_libs_count == 0 ||
+     dir_fd != AT_FDCWD || pathname[0] != '/' ||
+     (flags & (O_ACCMODE | O_CREAT | O_TRUNC)) != O_RDONLY)
+    return 0;
+  len = strlen(pathname);
+  for(i = 0; i < preloaded_libs_count; i++) {
+    struct preloaded_lib *lib = &preloaded_libs[i];
+    if(lib->pathname_len == len && !memcmp(lib->pathname, pathname, len)) {
+      if(lib->fd == -1) {
+	/* The server told us that the pathname does not exist. */
+	__set_errno(ENOENT);
+	*result = -1;
+	return 1;
+      }
+      if(lib->fd >= 0) {
+	*result = lib->fd;
+	lib->fd = -2;
+	lib->entry[0] = 'x';
+	fds_slot_clear_warn_if_used(*result);
+	return 1;
+      }
+      return 0;
+    }
+  }
+  return 0;
+}
+
+#if !(defined(IN_RTLD) || defined(IS_IN_rtld))
+/* By the time libc's constructors run, ld.so has loaded all the
+   libraries that the program needs at startup.  Close the FDs for
+   preloaded libraries that it did not use, and clear the table so
+   that it is not used by dlopen() or passed on to other programs. */
+static void __attribute__((constructor)) preloaded_libs_release(void)
+{
+  char *entry = getenv(PRELOADED_LIBS_VAR);
+  char *var = entry;
+  if(!entry)
+    return;
+  while(*entry) {
+    char *end = strchr(entry, ':');
+    if(!end) end = entry + strlen(entry);
+    if('0' <= entry[0] && entry[0] <= '9')
+      kernel_close(atoi(entry));
+    entry = *end ? end + 1 : end;
+  }
+  var[0] = 0;
+  unsetenv(PRELOADED_LIBS_VAR);
+  preloaded_libs_count = 0;
+}
+#endif
+
+
 /* Try to set the errno from the given message, otherwise set it to ENOSYS. */
 void set_errno_from_reply(seqf_t msg)
 {
@@ -286,6 +501,14 @@ int new_openat(int dir_fd, const char *filename, int flags, ...)
   flags = flags & ~O_CLOEXEC;
 #endif
 
+  if(preloaded_lib_open(dir_fd, filename, flags, &result_fd))
+    goto exit;
+
+  result_fd = fds_kernel_openat(dir_fd, filename, flags, mode);
+  if(result_fd != FDS_USE_SERVER)
+    goto exit;
+  result_fd = -1;
+
   if(libc_get_fs_op(&fs_op_server) < 0)
     goto exit;
   if(fds_get_dir_obj(dir_fd, &dir_obj) < 0)
@@ -301,17 +524,33 @@ int new_openat(int dir_fd, const char *filename, int flags, ...)
     goto exit;
   }
   cap_t returned_dir_obj;
+  if(pl_unpack(r, result, METHOD_R_FSOP_OPEN_DIR_NOFD, "c",
+	       &returned_dir_obj)) {
+    /* This handles the case in which a directory is opened.  We
+       create our own dummy FD to return. */
+    result_fd = make_dummy_dir_fd();
+    if(result_fd < 0) {
+      filesys_obj_free(returned_dir_obj);
+      goto exit;
+    }
+    fds_set_dir_obj(result_fd, returned_dir_obj);
+    goto exit;
+  }
+  if(pl_unpack(r, result, METHOD_R_FSOP_OPEN_DIR_KERNEL, "fc",
+	       &returned_fd, &returned_dir_obj)) {
+    /* The server gave us a real directory FD, which we can pass to
+       the kernel in later *at() calls. */
+    result_fd = returned_fd;
+    fds_set_dir_obj(result_fd, returned_dir_obj);
+    g_fds[result_fd].fd_kernel_dir = 1;
+    goto exit;
+  }
   if(pl_unpack(r, result, METHOD_R_FSOP_OPEN_DIR, "fc",
 	       &returned_fd, &returned_dir_obj)) {
+    /* Older servers pass us a dummy FD for /dev/null, which we
+       return. */
     result_fd = returned_fd;
-    /* This handles the case in which a directory is opened.  The server
-       passes us a dummy FD for /dev/null, which we return. */
-    /* Resize the file descriptor array. */
-    assert(result_fd >= 0);
-    fds_resize(result_fd);
-    fds_slot_clear_warn_if_used(result_fd);
-    log_fd(result_fd, "fill out fd_dir_obj");
-    g_fds[result_fd].fd_dir_obj = returned_dir_obj;
+    fds_set_dir_obj(result_fd, returned_dir_obj);
     goto exit;
   }
   caps_free(result.caps);
@@ -21,6 +21,7 @@
 #define _LARGEFILE64_SOURCE
 
 #include <errno.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 
@@ -143,6 +144,21 @@ static void m_stat_info(int *ok, seqf_t *msg, int type, void *buf)
   }
 }
 
+static int kernel_fstat_type(int type, int fd, void *buf)
+{
+  if(type == TYPE_STAT) {
+    return kernel_fxstat(_STAT_VER, fd, (struct stat *) buf);
+  }
+  else if(type == TYPE_STAT64) {
+    return kernel_fxstat64(_STAT_VER, fd, (struct stat64 *) buf);
+  }
+  else {
+    /* Don't recognise ABI version requested. */
+    __set_errno(ENOSYS);
+    return -1;
+  }
+}
+
 /* nofollow=0 for stat, nofollow=1 for lstat. */
 int my_statat(int dir_fd, int nofollow, int type, const char *pathname,
 	      void *buf)
@@ -158,6 +174,20 @@ int my_statat(int dir_fd, int nofollow, int type, const char *pathname,
     __set_errno(EINVAL);
     goto error;
   }
+#ifdef O_PATH
+  {
+    /* With O_NOFOLLOW, O_PATH opens a trailing symlink itself. */
+    int fd = fds_kernel_openat(dir_fd, pathname,
+			       O_PATH | (nofollow ? O_NOFOLLOW : 0), 0);
+    if(fd != FDS_USE_SERVER) {
+      if(fd >= 0) {
+	rc = kernel_fstat_type(type, fd, buf);
+	kernel_close(fd);
+      }
+      goto error;
+    }
+  }
+#endif
   if(libc_get_fs_op(&fs_op_server) < 0)
     goto error;
   if(fds_get_dir_obj(dir_fd, &dir_obj) < 0)
@@ -191,8 +221,10 @@ int my_fstat(int type, int fd, void *buf)
   log_msg(MOD_MSG "fstat\n");
   plash_libc_lock();
 
-  if(0 <= fd && fd < g_fds_size && g_fds[fd].fd_dir_obj) {
-    /* Handle directory FDs specially:  send a message. */
+  if(0 <= fd && fd < g_fds_size && g_fds[fd].fd_dir_obj &&
+     !g_fds[fd].fd_kernel_dir) {
+    /* Handle directory FDs specially:  send a message.  This is not
+       necessary if the kernel-level FD is the real directory. */
     cap_t dir_obj = g_fds[fd].fd_dir_obj;
     region_t r = region_make();
     cap_t fs_op_server;
@@ -232,17 +264,7 @@ int my_fstat(int type, int fd, void *buf)
 
     /* Use the normal fstat system call. */
     log_fd(fd, "normal fstat");
-    if(type == TYPE_STAT) {
-      return kernel_fxstat(_STAT_VER, fd, (struct stat *) buf);
-    }
-    else if(type == TYPE_STAT64) {
-      return kernel_fxstat64(_STAT_VER, fd, (struct stat64 *) buf);
-    }
-    else {
-      /* Don't recognise ABI version requested. */
-      __set_errno(ENOSYS);
-      return -1;
-    }
+    return kernel_fstat_type(type, fd, buf);
   }
 }
 
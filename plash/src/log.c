@@ -17,9 +17,17 @@
    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301,
    USA.  */
 
+#include <errno.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 
+#ifdef PLASH_GLIB
+#include <glib.h>
+#endif
+
+#include "region.h"
+#include "cap-protocol.h"
 #include "log.h"
 
 
@@ -132,4 +140,320 @@ struct filesys_obj *make_log_from_fd(int fd)
 }
 
 
+
+/* Binary logs.  Records are collected in a large buffer which is
+   written out in one go when it fills up, when it has not been written
+   for a second, when the last stream is closed, or on exit.  This
+   avoids a system call per request.  A timer in the server's event
+   loop writes out records that would otherwise sit in the buffer while
+   the server is idle, so that little is lost if it gets killed. */
+
+#define BINARY_LOG_BUFFER_SIZE (256 * 1024)
+#define BINARY_LOG_FLUSH_INTERVAL_US 1000000
+
+struct binary_log_shared {
+  int refcount;
+
+  int fd;
+  int next_id;
+  char *buf;
+  int used;
+  uint64_t last_flush_us;
+  /* List of all binary logs, for flushing on exit */
+  struct binary_log_shared *next, *prev;
+#ifdef PLASH_GLIB
+  guint timer_id;
+#endif
+};
+
+DECLARE_VTABLE(binary_log_stream_vtable);
+struct binary_log_stream {
+  struct filesys_obj hdr;
+
+  struct binary_log_shared *shared;
+  int id;
+};
+
+static struct binary_log_shared binary_logs =
+  { 0, -1, 0, NULL, 0, 0, &binary_logs, &binary_logs };
+
+static uint64_t time_us(struct timeval *tv)
+{
+  return (uint64_t) tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static void write_all(int fd, const char *data, int size)
+{
+  while(size > 0) {
+    int got = write(fd, data, size);
+    if(got < 0 && errno == EINTR) continue;
+    if(got <= 0) break;
+    data += got;
+    size -= got;
+  }
+}
+
+static void binary_log_flush(struct binary_log_shared *shared)
+{
+  struct timeval now;
+  write_all(shared->fd, shared->buf, shared->used);
+  shared->used = 0;
+  gettimeofday(&now, NULL);
+  shared->last_flush_us = time_us(&now);
+#ifdef PLASH_GLIB
+  if(shared->timer_id) {
+    g_source_remove(shared->timer_id);
+    shared->timer_id = 0;
+  }
+#endif
+}
+
+/* Writes out buffers whose records have been waiting for the flush
+   interval, so that not much is lost if the server is killed.  This is
+   used as cap_server_timer_hook. */
+static int binary_log_timer_hook(void)
+{
+  struct binary_log_shared *shared;
+  struct timeval now;
+  uint64_t now_us;
+  int timeout_ms = -1;
+
+  gettimeofday(&now, NULL);
+  now_us = time_us(&now);
+  for(shared = binary_logs.next; shared != &binary_logs;
+      shared = shared->next) {
+    if(shared->used == 0) {
+      continue;
+    }
+    if(now_us - shared->last_flush_us >= BINARY_LOG_FLUSH_INTERVAL_US) {
+      binary_log_flush(shared);
+    }
+    else {
+      int ms = (BINARY_LOG_FLUSH_INTERVAL_US -
+		(now_us - shared->last_flush_us)) / 1000 + 1;
+      if(timeout_ms < 0 || ms < timeout_ms) {
+	timeout_ms = ms;
+      }
+    }
+  }
+  return timeout_ms;
+}
+
+#ifdef PLASH_GLIB
+/* The same for servers that run the Glib event loop rather than
+   cap_run_server(), such as the Python pola-run. */
+static gboolean binary_log_timeout(void *obj)
+{
+  struct binary_log_shared *shared = obj;
+  shared->timer_id = 0;
+  binary_log_flush(shared);
+  return FALSE;
+}
+#endif
+
+static void binary_log_flush_all(void)
+{
+  struct binary_log_shared *shared;
+  for(shared = binary_logs.next; shared != &binary_logs;
+      shared = shared->next) {
+    binary_log_flush(shared);
+  }
+}
+
+/* Returns space for a record of the given size, flushing the buffer if
+   necessary.  Records that would not fit in the buffer are built in
+   *tmp, which the caller must write out and free. */
+static char *binary_log_reserve(struct binary_log_shared *shared, int size,
+				char **tmp)
+{
+  char *dest;
+  *tmp = NULL;
+  if(shared->used + size > BINARY_LOG_BUFFER_SIZE) {
+    binary_log_flush(shared);
+  }
+  if(size > BINARY_LOG_BUFFER_SIZE) {
+    *tmp = amalloc(size);
+    return *tmp;
+  }
+  dest = shared->buf + shared->used;
+  shared->used += size;
+  return dest;
+}
+
+static void binary_log_write(struct binary_log_shared *shared,
+			     struct binary_log_record *rec,
+			     const char *name, seqt_t msg, seqt_t reply)
+{
+  char *tmp;
+  char *dest;
+
+  rec->size = sizeof(*rec) + rec->name_size + msg.size + reply.size;
+  rec->reserved = 0;
+  rec->msg_size = msg.size;
+  rec->reply_size = reply.size;
+  dest = binary_log_reserve(shared, rec->size, &tmp);
+  memcpy(dest, rec, sizeof(*rec));
+  dest += sizeof(*rec);
+  memcpy(dest, name, rec->name_size);
+  dest += rec->name_size;
+  flatten_into(dest, msg);
+  dest += msg.size;
+  flatten_into(dest, reply);
+  if(tmp) {
+    write_all(shared->fd, tmp, rec->size);
+    free(tmp);
+  }
+  if(rec->time_us - shared->last_flush_us >= BINARY_LOG_FLUSH_INTERVAL_US) {
+    binary_log_flush(shared);
+  }
+#ifdef PLASH_GLIB
+  else if(shared->used > 0 && !shared->timer_id) {
+    shared->timer_id = g_timeout_add(BINARY_LOG_FLUSH_INTERVAL_US / 1000,
+				     binary_log_timeout, shared);
+  }
+#endif
+}
+
+static void binary_log_event(struct binary_log_stream *log, int type,
+			     int arg, seqf_t msg)
+{
+  struct binary_log_record rec;
+  struct timeval now;
+  region_t r = region_make();
+
+  gettimeofday(&now, NULL);
+  memset(&rec, 0, sizeof(rec));
+  rec.type = type;
+  rec.stream_id = log->id;
+  rec.arg = arg;
+  rec.time_us = time_us(&now);
+  binary_log_write(log->shared, &rec, "", mk_leaf(r, msg), seqt_empty);
+  region_free(r);
+}
+
+static void binary_log_free(struct filesys_obj *obj)
+{
+  struct binary_log_stream *log = (void *) obj;
+  struct binary_log_shared *shared = log->shared;
+
+  binary_log_event(log, BINARY_LOG_END, 0, seqf_empty);
+
+  assert(shared->refcount > 0);
+  if(--shared->refcount == 0) {
+    binary_log_flush(shared);
+    shared->prev->next = shared->next;
+    shared->next->prev = shared->prev;
+    close(shared->fd);
+    free(shared->buf);
+    free(shared);
+  }
+}
+
+static void binary_log_msg(struct filesys_obj *obj, seqf_t msg)
+{
+  binary_log_event((void *) obj, BINARY_LOG_MSG, 0, msg);
+}
+
+static struct filesys_obj *binary_log_branch(struct filesys_obj *obj,
+					     seqf_t msg)
+{
+  struct binary_log_stream *log = (void *) obj;
+  struct binary_log_stream *log2;
+  int new_id = log->shared->next_id++;
+
+  binary_log_event(log, BINARY_LOG_BRANCH, new_id, msg);
+
+  log2 = filesys_obj_make(sizeof(struct binary_log_stream),
+			  &binary_log_stream_vtable);
+  log->shared->refcount++;
+  log2->shared = log->shared;
+  log2->id = new_id;
+
+  return (struct filesys_obj *) log2;
+}
+
+/* Creates a log object that writes the binary format to the given
+   file descriptor.  Does not take ownership of "fd".  Returns NULL
+   for error. */
+struct filesys_obj *make_binary_log_from_fd(int fd)
+{
+  static int registered_atexit = 0;
+  struct binary_log_shared *shared;
+  struct binary_log_stream *log;
+  struct timeval now;
+  int fd_copy = dup(fd);
+  if(fd_copy < 0) {
+    return NULL;
+  }
+  if(fcntl(fd_copy, F_SETFD, FD_CLOEXEC) < 0) {
+    close(fd_copy);
+    return NULL;
+  }
+  if(!registered_atexit) {
+    atexit(binary_log_flush_all);
+    registered_atexit = 1;
+  }
+  cap_server_timer_hook = binary_log_timer_hook;
+
+  shared = amalloc(sizeof(struct binary_log_shared));
+  shared->refcount = 1;
+  shared->fd = fd_copy;
+  shared->next_id = 1;
+  shared->buf = amalloc(BINARY_LOG_BUFFER_SIZE);
+  shared->used = 0;
+  gettimeofday(&now, NULL);
+  shared->last_flush_us = time_us(&now);
+#ifdef PLASH_GLIB
+  shared->timer_id = 0;
+#endif
+  shared->next = binary_logs.next;
+  shared->prev = &binary_logs;
+  binary_logs.next->prev = shared;
+  binary_logs.next = shared;
+  write_all(fd_copy, BINARY_LOG_MAGIC, strlen(BINARY_LOG_MAGIC));
+
+  log = filesys_obj_make(sizeof(struct binary_log_stream),
+			 &binary_log_stream_vtable);
+  log->shared = shared;
+  log->id = shared->next_id++;
+
+  return (struct filesys_obj *) log;
+}
+
+/* Logs an fs_op request.  Binary logs copy it straight into the
+   shared buffer, without allocating anything per call.  Other logs are
+   given a line of text. */
+void log_op(struct filesys_obj *obj, struct log_op_info *op)
+{
+  if(obj->vtable == &binary_log_stream_vtable) {
+    struct binary_log_stream *log = (void *) obj;
+    struct binary_log_record rec;
+    rec.type = BINARY_LOG_OP;
+    rec.flags = op->read_only ? BINARY_LOG_READ_ONLY : 0;
+    rec.stream_id = log->id;
+    rec.arg = op->err;
+    rec.time_us = time_us(&op->start);
+    rec.duration_us = op->duration_us;
+    rec.name_size = strlen(op->op_name);
+    binary_log_write(log->shared, &rec, op->op_name, op->msg,
+		     op->err ? seqt_empty : op->reply);
+  }
+  else {
+    region_t r = region_make();
+    seqt_t reply = op->err
+      ? mk_printf(r, "fail: %s", strerror(op->err))
+      : op->reply;
+    seqt_t msg = mk_printf(r, "[%c%c] %s%s%s: %s",
+			   op->read_only ? 'r' : 'w',
+			   op->err ? '!' : '.',
+			   op->op_name,
+			   op->msg.size > 0 ? ": " : "",
+			   flatten_str(r, op->msg),
+			   flatten_str(r, reply));
+    obj->vtable->log_msg(obj, flatten(r, msg));
+    region_free(r);
+  }
+}
+
+
 #include "out-vtable-log.h"
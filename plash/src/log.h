@@ -22,10 +22,56 @@
 
 
 #include <stdio.h>
+#include <stdint.h>
+#include <sys/time.h>
 #include "filesysobj.h"
 
 struct filesys_obj *make_log(FILE *fp);
 struct filesys_obj *make_log_from_fd(int fd);
+struct filesys_obj *make_binary_log_from_fd(int fd);
+
+
+/* The binary log format, as decoded by plash-log-decode.  The file
+   starts with BINARY_LOG_MAGIC, followed by records.  Each record is a
+   struct binary_log_record followed by the op name, the message and
+   the reply, with no padding.  Integers are in host byte order. */
+
+#define BINARY_LOG_MAGIC "PlashLg1"
+
+#define BINARY_LOG_OP     1 /* One fs_op request */
+#define BINARY_LOG_MSG    2 /* Free text, as passed to log_msg() */
+#define BINARY_LOG_BRANCH 3 /* Start of a new stream */
+#define BINARY_LOG_END    4 /* End of a stream */
+
+#define BINARY_LOG_READ_ONLY 1 /* Flag: the request was read-only */
+
+struct binary_log_record {
+  uint32_t size; /* Size of the whole record, including this header */
+  uint16_t type;
+  uint16_t flags;
+  uint32_t stream_id;
+  uint32_t arg; /* errno for BINARY_LOG_OP, new stream ID for branches */
+  uint64_t time_us; /* Start time, in microseconds since the epoch */
+  uint32_t duration_us;
+  uint16_t name_size;
+  uint16_t reserved;
+  uint32_t msg_size;
+  uint32_t reply_size;
+};
+
+/* Describes one fs_op request for log_op(), which writes it to either
+   kind of log. */
+struct log_op_info {
+  const char *op_name;
+  int read_only;
+  int err; /* 0 for success */
+  struct timeval start;
+  long duration_us;
+  seqt_t msg; /* The arguments, as text */
+  seqt_t reply; /* The result, as text; unused if err is set */
+};
+
+void log_op(struct filesys_obj *obj, struct log_op_info *op);
 
 
 #endif
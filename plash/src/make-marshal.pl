@@ -37,10 +37,14 @@ my $methods =
    ['Grtd', 'fsop_get_root_dir'],
    ['Gobj', 'fsop_get_obj'],
    ['Logm', 'fsop_log'],
+   ['Stts', 'fsop_stats'],
+     ['RSts', 'r_fsop_stats'],
    # These correspond to Unix system calls:
    ['Open', 'fsop_open'],
      ['ROpn', 'r_fsop_open'],
      ['RDfd', 'r_fsop_open_dir'],
+     ['RDnf', 'r_fsop_open_dir_nofd'],
+     ['RDkr', 'r_fsop_open_dir_kernel'],
    ['Stat', 'fsop_stat'],
      ['RSta', 'r_fsop_stat'],
    ['Rdlk', 'fsop_readlink'],
@@ -67,6 +71,8 @@ my $methods =
    ['Exec', 'fsop_exec'],
      ['RExe', 'r_fsop_exec'],
      ['RExo', 'r_fsop_exec_object'],
+   ['Expl', 'fsop_exec_preload'], # As "Exec", plus LD_LIBRARY_PATH
+     ['RExl', 'r_fsop_exec_preload'],
 
    # File, directory and symlink objects:
    ['Otyp', 'fsobj_type',
@@ -101,6 +107,10 @@ my $methods =
        Args => 'flags/int mode/int leaf/string',
        Result_code => 'ROcr',
        Result => 'fd'],
+   ['Oocr', 'dir_open_or_create',
+       Args => 'flags/int mode/int leaf/string',
+       Result_code => 'ROoc',
+       Result => 'fd'],
    ['Omkd', 'dir_mkdir',
        Args => 'mode/int leaf/string',
        Result => ''],
@@ -138,6 +148,7 @@ my $methods =
    ['Mkcd', 'make_cow_dir'],
    ['Mkro', 'make_read_only_proxy'], # 'c'
    ['Mklg', 'make_log_from_fd'], # 'f'
+   ['Mkbl', 'make_binary_log_from_fd'], # 'f'
 
    # Executable objects
    ['Exep', 'eo_is_executable'],
@@ -38,6 +38,7 @@ my $methods =
       traverse
       list
       create_file
+      open_or_create
       mkdir
       symlink
       rename
@@ -76,6 +77,7 @@ my $defaults =
       'traverse' => 'dummy_traverse',
       'list' => 'dummy_list',
       'create_file' => 'dummy_create_file',
+      'open_or_create' => 'generic_open_or_create',
       'mkdir' => 'dummy_mkdir',
       'symlink' => 'dummy_symlink',
       'rename' => 'dummy_rename_or_link',
@@ -156,6 +158,7 @@ put('gensrc/out-vtable-filesysobj.h',
 	  ['traverse', 'invalid_traverse'],
 	  ['list', 'invalid_list'],
 	  ['create_file', 'invalid_create_file'],
+	  ['open_or_create', 'invalid_open_or_create'],
 	  ['mkdir', 'invalid_mkdir'],
 	  ['symlink', 'invalid_symlink'],
 	  ['rename', 'invalid_rename_or_link'],
@@ -205,6 +208,7 @@ put('gensrc/out-vtable-filesysobj-real.h',
 	  ['traverse', 'real_dir_traverse'],
 	  ['list', 'real_dir_list'],
 	  ['create_file', 'real_dir_create_file'],
+	  ['open_or_create', 'real_dir_open_or_create'],
 	  ['mkdir', 'real_dir_mkdir'],
 	  ['symlink', 'real_dir_symlink'],
 	  ['rename', 'real_dir_rename'],
@@ -225,6 +229,51 @@ put('gensrc/out-vtable-filesysobj-real.h',
 	  ['readlink', 'real_symlink_readlink'],
 	 ]
      },
+     { Name => 'real_file_ro_vtable',
+       Interfaces => [@i_file],
+       Contents =>
+         [['free', 'real_file_free'],
+	  ['mark', 'NULL'],
+	  ['type', 'objt_file'],
+	  ['stat', 'real_file_stat'],
+	  ['utimes', 'refuse_utimes'],
+	  ['chmod', 'refuse_chmod'],
+	  ['open', 'real_file_ro_open'],
+	  ['socket_connect', 'refuse_socket_connect'],
+	 ]
+     },
+     { Name => 'real_dir_ro_vtable',
+       Interfaces => [@i_dir],
+       Contents =>
+         [['free', 'real_dir_free'],
+	  ['mark', 'NULL'],
+	  ['type', 'objt_dir'],
+	  ['stat', 'real_dir_stat'],
+	  ['utimes', 'refuse_utimes'],
+	  ['chmod', 'refuse_chmod'],
+	  ['traverse', 'real_dir_ro_traverse'],
+	  ['list', 'real_dir_list'],
+	  ['create_file', 'refuse_create_file'],
+	  ['mkdir', 'refuse_mkdir'],
+	  ['symlink', 'refuse_symlink'],
+	  ['rename', 'refuse_rename_or_link'],
+	  ['link', 'refuse_rename_or_link'],
+	  ['unlink', 'refuse_unlink'],
+	  ['rmdir', 'refuse_rmdir'],
+	  ['socket_bind', 'refuse_socket_bind'],
+	 ]
+     },
+     { Name => 'real_symlink_ro_vtable',
+       Interfaces => [@i_symlink],
+       Contents =>
+         [['free', 'real_symlink_free'],
+	  ['mark', 'NULL'],
+	  ['type', 'objt_symlink'],
+	  ['stat', 'real_symlink_stat'],
+	  ['utimes', 'refuse_utimes'],
+	  ['readlink', 'real_symlink_readlink'],
+	 ]
+     },
     ]);
 
 put('gensrc/out-vtable-filesysobj-fab.h',
@@ -386,6 +435,19 @@ put('gensrc/out-vtable-filesysobj-cow.h',
 	  ['rmdir', 'cow_dir_rmdir'],
 	  ['socket_bind', 'cow_dir_socket_bind'],
 	 ]
+     },
+     { Name => 'cow_file_vtable',
+       Interfaces => [@i_file],
+       Contents =>
+         [['free', 'cow_file_free'],
+	  ['mark', 'cow_file_mark'],
+	  ['type', 'objt_file'],
+	  ['stat', 'cow_file_stat'],
+	  ['utimes', 'cow_file_utimes'],
+	  ['chmod', 'cow_file_chmod'],
+	  ['open', 'cow_file_open'],
+	  ['socket_connect', 'refuse_socket_connect'],
+	 ]
      }
     ]);
 
@@ -400,6 +462,7 @@ my $marshal_methods =
 	  ['traverse', 'marshal_traverse'],
 	  ['list', 'marshal_list'],
 	  ['create_file', 'marshal_create_file'],
+	  ['open_or_create', 'marshal_open_or_create'],
 	  ['mkdir', 'marshal_mkdir'],
 	  ['symlink', 'marshal_symlink'],
 	  ['rename', 'marshal_rename'],
@@ -554,6 +617,7 @@ put('gensrc/out-vtable-build-fs-dynamic.h',
 	  ['traverse', 'comb_dir_traverse'],
 	  ['list', 'comb_dir_list'],
 	  ['create_file', 'comb_dir_create_file'],
+	  ['open_or_create', 'comb_dir_open_or_create'],
 	  ['mkdir', 'comb_dir_mkdir'],
 	  ['symlink', 'comb_dir_symlink'],
 	  ['rename', 'comb_dir_rename'],
@@ -574,6 +638,15 @@ put('gensrc/out-vtable-log.h',
 	  ['log_msg', 'log_msg'],
 	  ['log_branch', 'log_branch'],
 	 ]
+     },
+     { Name => 'binary_log_stream_vtable',
+       Interfaces => [],
+       Contents =>
+         [['free', 'binary_log_free'],
+	  ['mark', 'NULL'],
+	  ['log_msg', 'binary_log_msg'],
+	  ['log_branch', 'binary_log_branch'],
+	 ]
      }
     ]);
 
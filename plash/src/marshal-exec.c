@@ -46,42 +46,16 @@ int unpack_exec_args(region_t r, struct arg_m_buf argbuf, bufref_t args_ref,
        argm_str(&argbuf, tag_ref, &tag)) return -1;
     
     if(seqf_equal(tag, seqf_string("Argv"))) {
-      int i;
       int count;
-      const bufref_t *a;
-      if(argm_array(&argbuf, arg_ref, &count, &a)) return -1;
-      ea->argv = region_alloc(r, (count + 1) * sizeof(char *));
-      for(i = 0; i < count; i++) {
-	seqf_t str;
-	if(argm_str(&argbuf, a[i], &str)) return -1;
-	ea->argv[i] = region_strdup_seqf(r, str);
-      }
-      ea->argv[count] = 0;
+      if(argm_str_array(r, &argbuf, arg_ref, &count, &ea->argv)) return -1;
     }
     else if(seqf_equal(tag, seqf_string("Env."))) {
-      int i;
       int count;
-      const bufref_t *a;
-      if(argm_array(&argbuf, arg_ref, &count, &a)) return -1;
-      ea->env = region_alloc(r, (count + 1) * sizeof(char *));
-      for(i = 0; i < count; i++) {
-	seqf_t str;
-	if(argm_str(&argbuf, a[i], &str)) return -1;
-	ea->env[i] = region_strdup_seqf(r, str);
-      }
-      ea->env[count] = 0;
+      if(argm_str_array(r, &argbuf, arg_ref, &count, &ea->env)) return -1;
     }
     else if(seqf_equal(tag, seqf_string("Fds."))) {
-      int i;
-      const bufref_t *a;
-      if(argm_array(&argbuf, arg_ref, &ea->fds_count, &a)) return -1;
-      ea->fds = region_alloc(r, ea->fds_count * sizeof(struct fd_mapping));
-      for(i = 0; i < ea->fds_count; i++) {
-	bufref_t no_ref, fd_ref;
-	if(argm_pair(&argbuf, a[i], &no_ref, &fd_ref) ||
-	   argm_int(&argbuf, no_ref, &ea->fds[i].fd_no) ||
-	   argm_fd(&argbuf, fd_ref, &ea->fds[i].fd)) return -1;
-      }
+      if(argm_fd_map(r, &argbuf, arg_ref, &ea->fds_count, &ea->fds))
+	return -1;
     }
     else if(seqf_equal(tag, seqf_string("Root"))) {
       if(argm_cap(&argbuf, arg_ref, &ea->root_dir)) return -1;
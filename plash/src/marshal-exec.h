@@ -23,11 +23,6 @@
 
 #include "serialise.h"
 
-struct fd_mapping {
-  int fd_no;
-  int fd;
-};
-
 struct exec_args {
   char **argv, **env;
   struct fd_mapping *fds;
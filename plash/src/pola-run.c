@@ -143,6 +143,7 @@ void usage(FILE *fp)
 	  "  [--net]         Grant access to network config files\n"
 	  "  [--log]         Print method calls client makes to file server\n"
 	  "  [--log-file <file>]\n"
+	  "  [--log-binary-file <file>]  Log in binary; see plash-log-decode\n"
 	  "  [--server-as-parent]  Server runs as the parent process, not the child\n"
 	  "  [--pet-name <name>]\n"
 	  "  [--powerbox]\n"
@@ -469,6 +470,26 @@ int handle_arguments(region_t r, struct state *state,
       goto arg_handled;
     }
 
+    if(!strcmp(arg, "--log-binary-file")) {
+      char *filename;
+      int log_fd;
+      if(i + 1 > argc) {
+	fprintf(stderr, NAME_MSG _("--log-binary-file expects 1 parameter\n"));
+	return 1;
+      }
+      filename = argv[i++];
+      log_fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+      if(log_fd < 0) {
+	fprintf(stderr, NAME_MSG _("Error opening \"%s\": %s\n"),
+		filename, strerror(errno));
+	return 1;
+      }
+      if(state->log) { filesys_obj_free(state->log); }
+      state->log = make_binary_log_from_fd(log_fd);
+      close(log_fd);
+      goto arg_handled;
+    }
+
     if(!strcmp(arg, "--debug")) {
       state->debug = TRUE;
       goto arg_handled;
@@ -587,6 +608,9 @@ static int args_to_exec_elf_program
 static void server_process(int argc, char **argv,
 			   bool use_gtk)
 {
+  fsop_stats_install_signal_handler();
+  cap_trace_install_signal_handler();
+
 #ifdef GC_DEBUG
   gc_init();
   cap_mark_exported_objects();
@@ -20,6 +20,9 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
+#ifdef REGION_PROFILE
+#include <signal.h>
+#endif
 
 #include "region.h"
 #include "kernel-fd-ops.h"
@@ -37,6 +40,13 @@
 
 #define STATS 1
 
+/* The size of the page each region starts with, and of the pages
+   chained on when that runs out.  Larger allocations get a page of
+   their own size. */
+#ifndef REGION_PAGE_SIZE
+#define REGION_PAGE_SIZE (8 * 1024)
+#endif
+
 struct finaliser_cons {
   void (*finalise)(void *obj);
   void *obj;
@@ -59,11 +69,24 @@ struct region {
   char *free; /* Pointer to next free byte */
   int avail; /* Bytes available in last page */
   struct finaliser_cons *finalisers;
+#ifdef REGION_PROFILE
+  struct region_site *site;
+  unsigned long used; /* Bytes allocated, not counting waste */
+#endif
 };
 
+#ifdef REGION_PROFILE
+static void region_profile_register(struct region_site *site);
+static void region_profile_check_dump(void);
+#endif
+
+#ifdef REGION_PROFILE
+region_t region_make_at(struct region_site *site)
+#else
 region_t region_make()
+#endif
 {
-  int size = 8 * 1024;
+  int size = REGION_PAGE_SIZE;
   struct region *r = malloc(sizeof(struct region) + size);
   if(!r) {
     /* fprintf(stderr, "Out of memory creating region\n");
@@ -79,15 +102,39 @@ region_t region_make()
   r->free = ((char *) r) + sizeof(struct region);
   r->avail = size;
   r->finalisers = 0;
+#ifdef REGION_PROFILE
+  region_profile_check_dump();
+  if(!site->next) region_profile_register(site);
+  site->count++;
+  site->live++;
+  r->site = site;
+  r->used = 0;
+#endif
   return r;
 }
 
+#ifdef REGION_PROFILE
+/* For code compiled without REGION_PROFILE that is linked with code
+   compiled with it.  The parentheses stop region.h's macro expanding. */
+region_t (region_make)(void)
+{
+  static struct region_site unknown_site = { "(unknown)", 0 };
+  return region_make_at(&unknown_site);
+}
+#endif
+
 void region_free(region_t r)
 {
   struct region_page *b;
 
   struct finaliser_cons *c;
   for(c = r->finalisers; c; c = c->next) c->finalise(c->obj);
+
+#ifdef REGION_PROFILE
+  r->site->live--;
+  r->site->total_bytes += r->used;
+  if(r->site->peak_bytes < r->used) r->site->peak_bytes = r->used;
+#endif
   
   b = &r->h; /* NB. This is equal to r */
   while(b) {
@@ -102,6 +149,9 @@ void *region_alloc(region_t r, size_t size)
   /* Word-align the size */
   int s = (size + 3) &~ 3;
 
+#ifdef REGION_PROFILE
+  r->used += s;
+#endif
   if(s <= r->avail) {
     char *x = r->free;
     r->free += s;
@@ -109,7 +159,7 @@ void *region_alloc(region_t r, size_t size)
     return x;
   }
   else {
-    int s2 = 8 * 1024;
+    int s2 = REGION_PAGE_SIZE;
     struct region_page *b;
     if(s >= s2) { s2 = s; }
     b = malloc(sizeof(struct region_page) + s2);
@@ -121,6 +171,10 @@ void *region_alloc(region_t r, size_t size)
     }
 #ifdef STATS
     b->size = s2;
+#endif
+#ifdef REGION_PROFILE
+    r->site->pages++;
+    r->site->wasted_bytes += r->avail;
 #endif
     b->next = 0;
     *r->last = b;
@@ -140,6 +194,94 @@ void region_add_finaliser(region_t r, void (*f)(void *obj), void *obj)
   r->finalisers = c;
 }
 
+#ifdef REGION_PROFILE
+/* Region profiling.  Each region_make() call site has a static
+   region_site, which is added to this list the first time it is used.
+   The summary is printed to stderr when the process exits, and when
+   it receives SIGPROF.  Since the signal can arrive while a region is
+   being updated, the handler only sets a flag, and the summary is
+   printed by the next region_make().
+
+   Sites are listed in order of the largest region they created.
+   Sites with live regions left at exit may be leaking them. */
+
+static struct region_site *region_sites = NULL;
+/* Marks the end of the list, so that a site's next field is non-NULL
+   once it has been registered. */
+static struct region_site region_sites_end;
+static volatile sig_atomic_t region_profile_dump_requested = 0;
+
+static void region_profile_signal_handler(int sig)
+{
+  region_profile_dump_requested = 1;
+}
+
+static void region_profile_at_exit(void)
+{
+  region_profile_print(stderr);
+}
+
+static void region_profile_register(struct region_site *site)
+{
+  if(!region_sites) {
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = region_profile_signal_handler;
+    act.sa_flags = SA_RESTART;
+    sigemptyset(&act.sa_mask);
+    sigaction(SIGPROF, &act, NULL);
+    atexit(region_profile_at_exit);
+    region_sites = &region_sites_end;
+  }
+  site->next = region_sites;
+  region_sites = site;
+}
+
+static void region_profile_check_dump(void)
+{
+  if(region_profile_dump_requested) {
+    region_profile_dump_requested = 0;
+    region_profile_print(stderr);
+  }
+}
+
+static int compare_sites(const void *x1, const void *x2)
+{
+  const struct region_site *s1 = *(const struct region_site **) x1;
+  const struct region_site *s2 = *(const struct region_site **) x2;
+  if(s1->peak_bytes > s2->peak_bytes) return -1;
+  if(s1->peak_bytes < s2->peak_bytes) return 1;
+  return 0;
+}
+
+void region_profile_print(FILE *fp)
+{
+  struct region_site *site, **sorted;
+  int count = 0, i;
+
+  for(site = region_sites; site && site != &region_sites_end;
+      site = site->next) count++;
+  sorted = amalloc((count + 1) * sizeof(struct region_site *));
+  count = 0;
+  for(site = region_sites; site && site != &region_sites_end;
+      site = site->next) sorted[count++] = site;
+  qsort(sorted, count, sizeof(struct region_site *), compare_sites);
+
+  fprintf(fp, "region profile for pid %i (page size %i):\n",
+	  (int) getpid(), REGION_PAGE_SIZE);
+  fprintf(fp, "%10s %6s %10s %12s %8s %10s  %s\n",
+	  "regions", "live", "peak", "total", "pages", "wasted", "site");
+  for(i = 0; i < count; i++) {
+    site = sorted[i];
+    fprintf(fp, "%10lu %6lu %10lu %12lu %8lu %10lu  %s:%i\n",
+	    site->count, site->live, site->peak_bytes, site->total_bytes,
+	    site->pages, site->wasted_bytes, site->file, site->line);
+  }
+  fflush(fp);
+  free(sorted);
+}
+#endif
+
 #ifdef STATS
 /* Returns the number of bytes allocated from a region.
    This is an approximation: includes wasted bytes at the end of pages. */
@@ -46,6 +46,28 @@ void *region_alloc(region_t r, size_t size);
 void region_add_finaliser(region_t r, void (*f)(void *obj), void *obj);
 int region_allocated(region_t r);
 
+#ifdef REGION_PROFILE
+/* When Plash is configured with --enable-region-profile, statistics
+   are kept for each place in the code that calls region_make().
+   See region.c. */
+struct region_site {
+  const char *file;
+  int line;
+  struct region_site *next;
+  unsigned long count; /* Regions created */
+  unsigned long live; /* Regions not yet freed */
+  unsigned long peak_bytes; /* Most bytes allocated from one region */
+  unsigned long total_bytes;
+  unsigned long pages; /* Extra pages chained onto regions */
+  unsigned long wasted_bytes; /* Space left unused at the ends of pages */
+};
+region_t region_make_at(struct region_site *site);
+void region_profile_print(FILE *fp);
+#define region_make() \
+  ({ static struct region_site region_site_ = { __FILE__, __LINE__ }; \
+     region_make_at(&region_site_); })
+#endif
+
 
 static inline void *amalloc(size_t size)
 {
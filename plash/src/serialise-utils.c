@@ -74,6 +74,32 @@ void arg_print_aux(FILE *fp, int indent, argmbuf_t buf, bufref_t x)
       return;
     }
   }
+  {
+    region_t r = region_make();
+    int count, i;
+    char **strs;
+    struct fd_mapping *fds;
+    if(!argm_str_array(r, buf, x, &count, &strs)) {
+      fprintf(fp, "strings[");
+      for(i = 0; i < count; i++) {
+	fprintf(fp, i > 0 ? ", \"%s\"" : "\"%s\"", strs[i]);
+      }
+      fprintf(fp, "]");
+      region_free(r);
+      return;
+    }
+    if(!argm_fd_map(r, buf, x, &count, &fds)) {
+      fprintf(fp, "fds[");
+      for(i = 0; i < count; i++) {
+	fprintf(fp, i > 0 ? ", %i: FD %i" : "%i: FD %i",
+		fds[i].fd_no, fds[i].fd);
+      }
+      fprintf(fp, "]");
+      region_free(r);
+      return;
+    }
+    region_free(r);
+  }
   fprintf(fp, "??");
 }
 
@@ -88,12 +88,22 @@ int cbuf_size(cbuf_t buf)
    Ints are boxed.
    The array data consists of a size followed by references for each of
    the array elements.
+
+   A string array consists of a count, then count+1 offsets, then the
+   strings with their NUL terminators.  String i runs from offset i to
+   offset i+1 (including the NUL), relative to the end of the offsets.
+
+   An FD map consists of a count, then the index of the first FD in the
+   FD array, then the FD numbers.  The FDs are consecutive in the FD
+   array.
 */
 #define TYPE_INT	0
 #define TYPE_STRING	1
 #define TYPE_ARRAY	2
 #define TYPE_CAP	3
 #define TYPE_FD		4
+#define TYPE_STR_ARRAY	5
+#define TYPE_FD_MAP	6
 #define MAKE_REF(type, addr)  ((addr) << 3 | (type))
 #define REF_TYPE(r)	((r) & 0x7)
 #define REF_ADDR(r)	((r) >> 3)
@@ -151,6 +161,41 @@ bufref_t argmk_array(argmkbuf_t buf, int size, bufref_t **out)
   return MAKE_REF(TYPE_ARRAY, index);
 }
 
+bufref_t argmk_str_array(argmkbuf_t buf, int count, const char **strs)
+{
+  int index = cbuf_size(buf->data);
+  int *p = cbuf_alloc(buf->data, (2 + count) * sizeof(int));
+  int *offsets = p + 1;
+  char *data;
+  int i;
+  p[0] = count;
+  offsets[0] = 0;
+  for(i = 0; i < count; i++) {
+    offsets[i + 1] = offsets[i] + strlen(strs[i]) + 1;
+  }
+  data = cbuf_alloc(buf->data, offsets[count]);
+  for(i = 0; i < count; i++) {
+    memcpy(data + offsets[i], strs[i], offsets[i + 1] - offsets[i]);
+  }
+  return MAKE_REF(TYPE_STR_ARRAY, index);
+}
+
+bufref_t argmk_fd_map(argmkbuf_t buf, int count, const struct fd_mapping *fds)
+{
+  int index = cbuf_size(buf->data);
+  int *p = cbuf_alloc(buf->data, (2 + count) * sizeof(int));
+  int *fd_array = cbuf_alloc(buf->fds, count * sizeof(int));
+  int i;
+  p[0] = count;
+  p[1] = buf->fds_got;
+  for(i = 0; i < count; i++) {
+    p[2 + i] = fds[i].fd_no;
+    fd_array[i] = fds[i].fd;
+  }
+  buf->fds_got += count;
+  return MAKE_REF(TYPE_FD_MAP, index);
+}
+
 seqt_t argbuf_data(argmkbuf_t buf)
 {
   return seqt_of_cbuf(buf->data);
@@ -235,3 +280,94 @@ int argm_array(argmbuf_t buf, bufref_t x, int *size, const bufref_t **out)
   }
   return -1;
 }
+
+/* Checks that the data section contains a count followed by `extra' +
+   count ints at address `addr', and returns the count. */
+static int argm_table(argmbuf_t buf, int addr, int extra, int *count)
+{
+  if(0 <= addr && addr + sizeof(int) <= buf->data.size) {
+    int c = *(int *) (buf->data.data + addr);
+    if(0 <= c && c <= buf->data.size / sizeof(int) &&
+       addr + (1 + extra + c) * sizeof(int) <= buf->data.size) {
+      *count = c;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+int argm_str_array(region_t r, argmbuf_t buf, bufref_t x,
+		   int *count, char ***out)
+{
+  char **strs;
+  int c, i;
+  if(REF_TYPE(x) == TYPE_STR_ARRAY) {
+    const int *offsets;
+    int start;
+    char *data;
+    if(argm_table(buf, REF_ADDR(x), 1, &c)) return -1;
+    offsets = (int *) (buf->data.data + REF_ADDR(x) + sizeof(int));
+    start = REF_ADDR(x) + (2 + c) * sizeof(int);
+    /* Written so that adding offsets[c] to start cannot overflow. */
+    if(start > buf->data.size ||
+       offsets[0] != 0 ||
+       offsets[c] < 0 || offsets[c] > buf->data.size - start) return -1;
+    /* Copy all the strings in one go, then check that they are
+       correctly terminated. */
+    data = region_alloc(r, offsets[c]);
+    memcpy(data, buf->data.data + start, offsets[c]);
+    strs = region_alloc(r, (c + 1) * sizeof(char *));
+    for(i = 0; i < c; i++) {
+      if(!(offsets[i] < offsets[i + 1] && offsets[i + 1] <= offsets[c]) ||
+	 data[offsets[i + 1] - 1] != 0) return -1;
+      strs[i] = data + offsets[i];
+    }
+  }
+  else {
+    const bufref_t *a;
+    if(argm_array(buf, x, &c, &a)) return -1;
+    strs = region_alloc(r, (c + 1) * sizeof(char *));
+    for(i = 0; i < c; i++) {
+      seqf_t str;
+      if(argm_str(buf, a[i], &str)) return -1;
+      strs[i] = region_strdup_seqf(r, str);
+    }
+  }
+  strs[c] = NULL;
+  *count = c;
+  *out = strs;
+  return 0;
+}
+
+int argm_fd_map(region_t r, argmbuf_t buf, bufref_t x,
+		int *count, struct fd_mapping **out)
+{
+  struct fd_mapping *fds;
+  int c, i;
+  if(REF_TYPE(x) == TYPE_FD_MAP) {
+    const int *p;
+    if(argm_table(buf, REF_ADDR(x), 1, &c)) return -1;
+    p = (int *) (buf->data.data + REF_ADDR(x));
+    if(!(0 <= p[1] && p[1] <= buf->fds.count &&
+	 c <= buf->fds.count - p[1])) return -1;
+    fds = region_alloc(r, c * sizeof(struct fd_mapping));
+    for(i = 0; i < c; i++) {
+      fds[i].fd_no = p[2 + i];
+      fds[i].fd = buf->fds.fds[p[1] + i];
+    }
+  }
+  else {
+    const bufref_t *a;
+    if(argm_array(buf, x, &c, &a)) return -1;
+    fds = region_alloc(r, c * sizeof(struct fd_mapping));
+    for(i = 0; i < c; i++) {
+      bufref_t no_ref, fd_ref;
+      if(argm_pair(buf, a[i], &no_ref, &fd_ref) ||
+	 argm_int(buf, no_ref, &fds[i].fd_no) ||
+	 argm_fd(buf, fd_ref, &fds[i].fd)) return -1;
+    }
+  }
+  *count = c;
+  *out = fds;
+  return 0;
+}
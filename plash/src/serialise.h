@@ -83,6 +83,21 @@ static inline bufref_t argmk_pair(argmkbuf_t buf, bufref_t x0, bufref_t x1)
   return r;
 }
 
+/* Compact encodings for arrays of strings and for mappings from FD
+   numbers to FDs.  These are stored as one contiguous block (a table
+   of offsets followed by the NUL-terminated strings, or a table of FD
+   numbers with the FDs stored consecutively), rather than as an array
+   of separately-encoded elements, so they are cheap to build and to
+   unpack even for large environments. */
+struct fd_mapping {
+  int fd_no;
+  int fd;
+};
+
+bufref_t argmk_str_array(argmkbuf_t buf, int count, const char **strs);
+/* Takes owning references to the FDs: */
+bufref_t argmk_fd_map(argmkbuf_t buf, int count, const struct fd_mapping *fds);
+
 seqt_t argbuf_data(argmkbuf_t buf);
 cap_seq_t argbuf_caps(argmkbuf_t buf);
 fds_t argbuf_fds(argmkbuf_t buf);
@@ -105,6 +120,14 @@ int argm_cap(argmbuf_t buf, bufref_t x, cap_t *c); /* returns non-owning ref */
 int argm_fd(argmbuf_t buf, bufref_t x, int *fd); /* returns non-owning ref */
 int argm_array(argmbuf_t buf, bufref_t x, int *size, const bufref_t **out);
 
+/* These accept the compact encodings above as well as plain arrays of
+   strings and of (int, FD) pairs.  They allocate the results in `r'.
+   argm_str_array() returns a NULL-terminated array. */
+int argm_str_array(region_t r, argmbuf_t buf, bufref_t x,
+		   int *count, char ***out);
+int argm_fd_map(region_t r, argmbuf_t buf, bufref_t x,
+		int *count, struct fd_mapping **out); /* returns non-owning refs */
+
 static inline int argm_pair(argmbuf_t buf, bufref_t x, bufref_t *x0, bufref_t *x1)
 {
   int size;
@@ -1262,47 +1262,47 @@ void spawn_inv_process(void *spawn_h, struct process_desc_fork *f,
 
   /* Copy the arguments from the list into an array. */
   {
-    bufref_t *a;
+    const char **a;
     int arg_count, i;
     struct str_list *l;
     
     for(l = obj->args_got, arg_count = 0; l; l = l->next) arg_count++;
-    argv_arg = argmk_array(argbuf, arg_count+1, &a);
-    a[0] = argmk_str(argbuf, mk_string(r, "none")); /* FIXME: argv[0] should be omitted */
+    a = region_alloc(r, (arg_count+1) * sizeof(char *));
+    a[0] = "none"; /* FIXME: argv[0] should be omitted */
     for(l = obj->args_got, i = 0; l; l = l->next, i++) {
-      a[i+1] = argmk_str(argbuf, mk_string(r, l->str));
+      a[i+1] = l->str;
     }
+    argv_arg = argmk_str_array(argbuf, arg_count+1, a);
   }
 
-  {
-    bufref_t *a;
-    env_arg = argmk_array(argbuf, 0, &a);
-  }
+  env_arg = argmk_str_array(argbuf, 0, NULL);
 
   root_arg = argmk_cap(argbuf, inc_ref(obj->root_dir));
 
   {
-    bufref_t *a;
+    struct fd_mapping *a;
     int i, j, fd_count = 0;
     for(i = 0; i < obj->fds.count; i++) {
       if(obj->fds.fds[i] >= 0) fd_count++;
     }
-    fds_arg = argmk_array(argbuf, fd_count, &a);
+    a = region_alloc(r, fd_count * sizeof(struct fd_mapping));
     for(i = 0, j = 0; j < fd_count; i++) {
       assert(i < obj->fds.count);
       if(obj->fds.fds[i] >= 0) {
 	int fd = dup(obj->fds.fds[i]);
 	if(fd < 0) {
 	  perror("dup");
+	  for(i = 0; i < j; i++) close(a[i].fd);
 	  argbuf_free_refs(argbuf);
 	  return; /* Error */
 	}
-	a[j] = argmk_pair(argbuf, argmk_int(argbuf, i),
-			  argmk_fd(argbuf, fd));
+	a[j].fd_no = i;
+	a[j].fd = fd;
 	j++;
       }
     }
     assert(j == fd_count);
+    fds_arg = argmk_fd_map(argbuf, fd_count, a);
   }
 
   {
@@ -2536,6 +2536,7 @@ int main(int argc, char *argv[])
   struct shell_state state;
 
   w_setup();
+  fsop_stats_install_signal_handler();
 
   state.env = 0;
 
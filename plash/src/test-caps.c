@@ -58,6 +58,7 @@ struct filesys_obj_vtable hellow_obj_vtable = {
   /* .traverse = */ dummy_traverse,
   /* .list = */ dummy_list,
   /* .create_file = */ dummy_create_file,
+  /* .open_or_create = */ generic_open_or_create,
   /* .mkdir = */ dummy_mkdir,
   /* .symlink = */ dummy_symlink,
   /* .rename = */ dummy_rename_or_link,
@@ -0,0 +1,130 @@
+/* Copyright (C) 2008 Mark Seaborn
+
+   This file is part of Plash.
+
+   Plash is free software; you can redistribute it and/or modify it
+   under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 2.1 of
+   the License, or (at your option) any later version.
+
+   Plash is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with Plash; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301,
+   USA.  */
+
+/* Times a file operation done repeatedly through libc, for
+   benchmark.py.  Prints the average time per operation in
+   microseconds.
+
+   Usage: bench-fs <operation> <path> <count>
+   where <operation> is one of:
+     getcwd     getcwd() (path is ignored); the cheapest request to
+                the file server, so this times a null round trip
+     stat       stat() on <path>
+     open       open() and close() on <path>
+     readdir    opendir(), reading all entries and closedir() on <path>
+     forkexec   fork() and execve() of <path>, waiting for it to exit */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "test-util.h"
+
+
+static void op_getcwd(const char *path)
+{
+  char buf[4096];
+  t_check(getcwd(buf, sizeof(buf)) != NULL);
+}
+
+static void op_stat(const char *path)
+{
+  struct stat st;
+  t_check_zero(stat(path, &st));
+}
+
+static void op_open(const char *path)
+{
+  int fd = open(path, O_RDONLY);
+  t_check(fd >= 0);
+  t_check_zero(close(fd));
+}
+
+static void op_readdir(const char *path)
+{
+  DIR *dir = opendir(path);
+  t_check(dir != NULL);
+  while(readdir(dir)) { /* empty */ }
+  t_check_zero(closedir(dir));
+}
+
+static void op_forkexec(const char *path)
+{
+  int status;
+  int pid = fork();
+  t_check(pid >= 0);
+  if(pid == 0) {
+    execl(path, path, NULL);
+    _exit(1);
+  }
+  t_check(waitpid(pid, &status, 0) == pid);
+  t_check(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+struct bench_op {
+  const char *name;
+  void (*func)(const char *path);
+};
+
+static struct bench_op ops[] = {
+  { "getcwd", op_getcwd },
+  { "stat", op_stat },
+  { "open", op_open },
+  { "readdir", op_readdir },
+  { "forkexec", op_forkexec },
+  { NULL, NULL }
+};
+
+int main(int argc, char **argv)
+{
+  struct bench_op *op;
+  struct timeval start, end;
+  int count, i;
+
+  if(argc != 4) {
+    fprintf(stderr, "Usage: %s <operation> <path> <count>\n", argv[0]);
+    return 1;
+  }
+  for(op = ops; op->name; op++) {
+    if(!strcmp(op->name, argv[1])) break;
+  }
+  if(!op->name) {
+    fprintf(stderr, "%s: unknown operation: %s\n", argv[0], argv[1]);
+    return 1;
+  }
+  count = atoi(argv[3]);
+  t_check(count > 0);
+
+  /* Warm up, so that one-off setup costs are not counted. */
+  op->func(argv[2]);
+  t_check_zero(gettimeofday(&start, NULL));
+  for(i = 0; i < count; i++) {
+    op->func(argv[2]);
+  }
+  t_check_zero(gettimeofday(&end, NULL));
+  printf("%.3f\n", ((end.tv_sec - start.tv_sec) * 1e6 +
+		    (end.tv_usec - start.tv_usec)) / count);
+  return 0;
+}
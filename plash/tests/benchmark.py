@@ -0,0 +1,244 @@
+# Copyright (C) 2008 Mark Seaborn
+#
+# This file is part of Plash.
+#
+# Plash is free software; you can redistribute it and/or modify it
+# under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation; either version 2.1 of
+# the License, or (at your option) any later version.
+#
+# Plash is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with Plash; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301,
+# USA.
+
+"""
+Usage: python benchmark.py [options] [name-prefix...]
+
+Microbenchmarks for the capability RPC path and the file server.
+Prints one line per benchmark, "<name><tab><microseconds per op>".
+
+Options:
+  -n, --iterations N   number of operations to time per benchmark
+  -o, --output FILE    also write the results to FILE
+  -c, --compare FILE   compare against results saved earlier with -o
+  -t, --threshold PCT  with --compare, percentage slowdown counted as
+                       a regression (default 10); exits with status 1
+                       if any benchmark regressed
+"""
+
+import getopt
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+import plash_core
+import plash.env
+import plash.mainloop
+import plash.namespace as ns
+import plash.pola_run_args
+import plash.process
+
+
+def write_file(filename, data):
+    fh = open(filename, "w")
+    try:
+        fh.write(data)
+    finally:
+        fh.close()
+
+
+def compile_helper(tmp_dir):
+    src_dir = os.path.dirname(os.path.abspath(__file__))
+    exe = os.path.join(tmp_dir, "bench-fs")
+    rc = subprocess.call(["gcc", "-O2", "-Wall", "-D_GNU_SOURCE",
+                          "-I%s" % src_dir,
+                          os.path.join(src_dir, "test-util.c"),
+                          os.path.join(src_dir, "bench-fs.c"),
+                          "-o", exe])
+    assert rc == 0
+    return exe
+
+
+def make_tree(path):
+    os.mkdir(path)
+    for i in range(20):
+        write_file(os.path.join(path, "file%i" % i), "")
+
+
+def make_namespaces(tmp_dir):
+    """Returns (name, directory object) pairs, one for each kind of
+    directory the file server can be asked to look up files in."""
+    real_path = os.path.join(tmp_dir, "real")
+    make_tree(real_path)
+    real = plash.env.get_dir_from_path(real_path)
+
+    upper_path = os.path.join(tmp_dir, "upper")
+    os.mkdir(upper_path)
+    union = ns.make_union_dir(plash.env.get_dir_from_path(upper_path), real)
+
+    write_path = os.path.join(tmp_dir, "write")
+    os.mkdir(write_path)
+    cow = ns.make_cow_dir(plash.env.get_dir_from_path(write_path), real)
+
+    # "comb" attaches real at /bench and something else below it, so
+    # that /bench becomes a comb_dir rather than the real dir itself.
+    return [("real", real, None),
+            ("comb", real, ns.make_read_only_proxy(real)),
+            ("union", union, None),
+            ("cow", cow, None)]
+
+
+def run_sandboxed(exe, args, bench_dir, extra):
+    read_fd, write_fd = os.pipe()
+    proc = plash.process.ProcessSpecWithNamespace()
+    proc.env = os.environ.copy()
+    state = plash.pola_run_args.ProcessSetup(proc)
+    state.caller_root = plash.env.get_root_dir()
+    state.handle_args(["--fd", "2", "-B",
+                       "-f", exe, "-e", exe] + args)
+    if "PLASH_LIBRARY_DIR" in os.environ:
+        state.handle_args(["-f", os.environ["PLASH_LIBRARY_DIR"]])
+    if bench_dir is not None:
+        proc.get_namespace().attach_at_path("/bench", bench_dir)
+    if extra is not None:
+        proc.get_namespace().attach_at_path("/bench/extra", extra)
+    proc.fds[1] = plash_core.wrap_fd(write_fd)
+    pid = proc.spawn()
+    # Dropping the FD object closes our copy of the pipe's write end.
+    del proc.fds[1]
+    plash.mainloop.run_server()
+    pid2, status = os.waitpid(pid, 0)
+    assert pid == pid2
+    output = os.fdopen(read_fd).read()
+    if status != 0:
+        raise Exception("bench-fs %r failed with status %i" % (args, status))
+    return float(output)
+
+
+def bench_local_call(count):
+    # A cap_call on an object in this process: measures the marshalling
+    # and dispatch overhead without any socket traffic.
+    fs_op = ns.make_fs_op(plash.env.get_root_dir())
+    fs_op.fsop_log("")
+    start = time.time()
+    for i in xrange(count):
+        fs_op.fsop_log("")
+    return (time.time() - start) * 1e6 / count
+
+
+def bench_startup(count):
+    start = time.time()
+    for i in xrange(count):
+        rc = subprocess.call(["pola-run", "-B", "-e", "/bin/true"])
+        assert rc == 0
+    return (time.time() - start) * 1e6 / count
+
+
+def run_benchmarks(iterations, wanted):
+    def selected(name):
+        return (len(wanted) == 0 or
+                any(name.startswith(prefix) for prefix in wanted))
+
+    tmp_dir = tempfile.mkdtemp(prefix="plash-bench")
+    try:
+        exe = compile_helper(tmp_dir)
+        if selected("cap_call.local"):
+            yield "cap_call.local", bench_local_call(iterations)
+        if selected("cap_call.remote"):
+            yield "cap_call.remote", run_sandboxed(
+                exe, ["getcwd", "/", str(iterations)], None, None)
+        for ns_name, bench_dir, extra in make_namespaces(tmp_dir):
+            for op, path in [("stat", "/bench/file0"),
+                             ("open", "/bench/file0"),
+                             ("readdir", "/bench")]:
+                name = "%s.%s" % (op, ns_name)
+                if selected(name):
+                    yield name, run_sandboxed(
+                        exe, [op, path, str(iterations)], bench_dir, extra)
+        # Forking and starting processes is much slower than the other
+        # operations, so do fewer of them.
+        slow_count = max(1, iterations / 100)
+        if selected("forkexec"):
+            yield "forkexec", run_sandboxed(
+                exe, ["forkexec", "/bin/true", str(slow_count)], None, None)
+        if selected("startup"):
+            yield "startup", bench_startup(slow_count)
+    finally:
+        shutil.rmtree(tmp_dir)
+
+
+def read_results(filename):
+    results = {}
+    fh = open(filename, "r")
+    try:
+        for line in fh:
+            line = line.strip()
+            if line == "" or line.startswith("#"):
+                continue
+            name, value = line.split("\t")
+            results[name] = float(value)
+    finally:
+        fh.close()
+    return results
+
+
+def main(args):
+    iterations = 10000
+    output_file = None
+    compare_file = None
+    threshold = 10.0
+    try:
+        opts, args = getopt.gnu_getopt(
+            args, "n:o:c:t:",
+            ["iterations=", "output=", "compare=", "threshold="])
+    except getopt.GetoptError, exn:
+        print >>sys.stderr, exn
+        print >>sys.stderr, __doc__
+        return 2
+    for opt, value in opts:
+        if opt in ("-n", "--iterations"):
+            iterations = int(value)
+        elif opt in ("-o", "--output"):
+            output_file = value
+        elif opt in ("-c", "--compare"):
+            compare_file = value
+        elif opt in ("-t", "--threshold"):
+            threshold = float(value)
+    baseline = {}
+    if compare_file is not None:
+        baseline = read_results(compare_file)
+
+    lines = ["# name\tmicroseconds per op (%i iterations)" % iterations]
+    print lines[0]
+    regressions = []
+    for name, value in run_benchmarks(iterations, args):
+        line = "%s\t%.3f" % (name, value)
+        lines.append(line)
+        if name in baseline and baseline[name] > 0:
+            change = (value - baseline[name]) * 100 / baseline[name]
+            line += "\t%+.1f%%" % change
+            if change > threshold:
+                line += "\tREGRESSION"
+                regressions.append(name)
+        print line
+        sys.stdout.flush()
+    if output_file is not None:
+        write_file(output_file, "".join(line + "\n" for line in lines))
+    if len(regressions) > 0:
+        print >>sys.stderr, "%i benchmarks regressed by more than %g%%: %s" % (
+            len(regressions), threshold, " ".join(regressions))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
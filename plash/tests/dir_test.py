@@ -17,10 +17,12 @@
 # Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301,
 # USA.
 
+import errno
 import os
 import shutil
 import socket
 import tempfile
+import time
 import unittest
 
 import plash_core
@@ -30,6 +32,22 @@ import plash.marshal as marshal
 import plash.namespace
 
 
+def read_file(path):
+    fh = open(path, "r")
+    try:
+        return fh.read()
+    finally:
+        fh.close()
+
+
+def write_file(path, data):
+    fh = open(path, "w")
+    try:
+        fh.write(data)
+    finally:
+        fh.close()
+
+
 def make_unix_socket():
     sock = socket.socket(socket.AF_UNIX)
     return plash_core.wrap_fd(os.dup(sock.fileno()))
@@ -208,15 +226,64 @@ class FsObjRealTests(unittest.TestCase):
         self.assert_cwd_unchanged(f)
 
 
-class TestDirMixin(object):
+class TestReadOnlyProxy(unittest.TestCase):
+
+    def setUp(self):
+        self.dir_path = tempfile.mkdtemp(prefix="plash-test")
+        os.mkdir(os.path.join(self.dir_path, "subdir"))
+        write_file(os.path.join(self.dir_path, "subdir", "file"), "data")
+        os.symlink("dest", os.path.join(self.dir_path, "subdir", "symlink"))
+
+    def tearDown(self):
+        shutil.rmtree(self.dir_path)
+
+    def check_read_only(self, dir):
+        subdir = dir.dir_traverse("subdir")
+        file_obj = subdir.dir_traverse("file")
+        fd = file_obj.file_open(os.O_RDONLY)
+        self.assertEquals(os.read(fd.fileno(), 100), "data")
+        self.assertEquals(subdir.dir_traverse("symlink").symlink_readlink(),
+                          "dest")
+        self.assertRaises(marshal.UnmarshalError,
+                          lambda: file_obj.file_open(os.O_WRONLY))
+        self.assertRaises(marshal.UnmarshalError,
+                          lambda: file_obj.fsobj_chmod(0777))
+        self.assertRaises(marshal.UnmarshalError,
+                          lambda: subdir.dir_mkdir(0777, "new"))
+        self.assertRaises(marshal.UnmarshalError,
+                          lambda: subdir.dir_unlink("file"))
+        symlink = subdir.dir_traverse("symlink")
+        self.assertRaises(marshal.UnmarshalError,
+                          lambda: symlink.fsobj_utimes(123, 456, 789, 123))
+        names = os.listdir(os.path.join(self.dir_path, "subdir"))
+        names.sort()
+        self.assertEquals(names, ["file", "symlink"])
+
+    def test_read_only(self):
+        real_dir = plash.env.get_dir_from_path(self.dir_path)
+        self.check_read_only(plash.namespace.make_read_only_proxy(real_dir))
+        # The original object is still writable.
+        real_dir.dir_traverse("subdir").dir_mkdir(0777, "new")
+
+    def test_nested_read_only(self):
+        dir = plash.env.get_dir_from_path(self.dir_path)
+        for i in range(3):
+            dir = plash.namespace.make_read_only_proxy(dir)
+        self.check_read_only(dir)
+
+
+class TempDirMixin(object):
 
     def setUp(self):
         self._tmp_dirs = []
 
-    def get_real_temp_dir(self):
+    def make_temp_dir(self):
         dir_path = tempfile.mkdtemp(prefix="plash-test")
         self._tmp_dirs.append(dir_path)
-        return plash.env.get_dir_from_path(dir_path)
+        return dir_path
+
+    def get_real_temp_dir(self):
+        return plash.env.get_dir_from_path(self.make_temp_dir())
 
     def tearDown(self):
         for tmp_dir in self._tmp_dirs:
@@ -228,6 +295,9 @@ class TestDirMixin(object):
         list_expect.sort()
         self.assertEquals(list_got, list_expect)
 
+
+class TestDirMixin(TempDirMixin):
+
     def check_utimes(self, fun):
         "Set the object's atime/mtime and read them back"
         # NB. Currently stat information is cached.
@@ -316,6 +386,31 @@ class TestDirMixin(object):
         stat2 = dir.dir_traverse("dest").fsobj_stat()
         self.assert_stat_equal(stat1, stat2)
 
+    def test_open_or_create(self):
+        dir = self.get_temp_dir()
+        fd = dir.dir_open_or_create(os.O_WRONLY | os.O_CREAT, 0666, "file")
+        os.write(fd.fileno(), "hello")
+        del fd
+        self.check_dir_listing(dir, ["file"])
+        # Opens the existing file rather than failing.
+        fd = dir.dir_open_or_create(os.O_RDONLY | os.O_CREAT, 0666, "file")
+        self.assertEquals(os.read(fd.fileno(), 100), "hello")
+        self.assertRaises(
+            marshal.UnmarshalError,
+            lambda: dir.dir_open_or_create(
+                os.O_WRONLY | os.O_CREAT | os.O_EXCL, 0666, "file"))
+        # Symlinks and directories are left to the caller.
+        dir.dir_symlink("symlink", "file")
+        self.assertRaises(
+            marshal.UnmarshalError,
+            lambda: dir.dir_open_or_create(
+                os.O_WRONLY | os.O_CREAT, 0666, "symlink"))
+        dir.dir_mkdir(0777, "subdir")
+        self.assertRaises(
+            marshal.UnmarshalError,
+            lambda: dir.dir_open_or_create(
+                os.O_RDONLY | os.O_CREAT, 0666, "subdir"))
+
 
 class TestRealDir(TestDirMixin, unittest.TestCase):
 
@@ -341,6 +436,47 @@ class TestRealDir(TestDirMixin, unittest.TestCase):
         self.assert_stat_equal(stat1, stat2)
 
 
+# Union directories are read-only, so they do not get the tests in
+# TestDirMixin.
+class TestUnionDir(TempDirMixin, unittest.TestCase):
+
+    def test_nested_union_dir(self):
+        paths = [self.make_temp_dir() for i in range(3)]
+        os.makedirs(os.path.join(paths[0], "subdir", "a"))
+        write_file(os.path.join(paths[1], "subdir"), "")
+        os.makedirs(os.path.join(paths[2], "subdir", "b"))
+        write_file(os.path.join(paths[0], "file"), "")
+        os.mkdir(os.path.join(paths[1], "file"))
+        write_file(os.path.join(paths[2], "only-in-last"), "")
+        dirs = [plash.env.get_dir_from_path(path) for path in paths]
+        union = plash.namespace.make_union_dir(
+            plash.namespace.make_union_dir(dirs[0], dirs[1]), dirs[2])
+        self.check_dir_listing(union, ["file", "only-in-last", "subdir"])
+        # A file in an earlier layer overrides a directory in a later one.
+        self.assertEquals(union.dir_traverse("file").fsobj_type(),
+                          plash.marshal.OBJT_FILE)
+        # Directories are combined, skipping over non-directories.
+        self.check_dir_listing(union.dir_traverse("subdir"), ["a", "b"])
+        self.assertEquals(union.dir_traverse("only-in-last").fsobj_type(),
+                          plash.marshal.OBJT_FILE)
+        self.assertRaises(marshal.UnmarshalError,
+                          lambda: union.dir_traverse("missing"))
+
+    def test_nested_union_dir_on_right(self):
+        # union(A, union(B, C)) where "subdir" is a directory in A and
+        # C but a file in B.  The inner union gives B's file, which
+        # hides C's directory, so only A's directory is seen.
+        paths = [self.make_temp_dir() for i in range(3)]
+        os.makedirs(os.path.join(paths[0], "subdir", "a"))
+        write_file(os.path.join(paths[1], "subdir"), "")
+        os.makedirs(os.path.join(paths[2], "subdir", "c"))
+        dirs = [plash.env.get_dir_from_path(path) for path in paths]
+        union = plash.namespace.make_union_dir(
+            dirs[0], plash.namespace.make_union_dir(dirs[1], dirs[2]))
+        self.check_dir_listing(union, ["subdir"])
+        self.check_dir_listing(union.dir_traverse("subdir"), ["a"])
+
+
 class TestCowDir(TestDirMixin, unittest.TestCase):
 
     def get_temp_dir(self):
@@ -380,6 +516,299 @@ class TestCowDir(TestDirMixin, unittest.TestCase):
         self.assertEquals(subdir.fsobj_type(), plash.marshal.OBJT_DIR)
         subdir.dir_mkdir(0777, "dir4")
 
+    def test_cow_dir_listing_is_refreshed(self):
+        read_path = self.make_temp_dir()
+        write_path = self.make_temp_dir()
+        write_file(os.path.join(read_path, "file1"), "")
+        write_file(os.path.join(write_path, "file2"), "")
+        # A listing is only cached if the directory's mtime and ctime
+        # are in an earlier second.  utime() cannot set the ctime, so
+        # wait for the next second.
+        time.sleep(1.01 - time.time() % 1)
+        cow_dir = plash.namespace.make_cow_dir(
+            plash.env.get_dir_from_path(write_path),
+            plash.env.get_dir_from_path(read_path))
+        self.check_dir_listing(cow_dir, ["file1", "file2"])
+        self.check_dir_listing(cow_dir, ["file1", "file2"])
+        # Changes made outside of the COW directory must show up.
+        write_file(os.path.join(read_path, "file3"), "")
+        self.check_dir_listing(cow_dir, ["file1", "file2", "file3"])
+        # So must changes made through it.
+        cow_dir.dir_mkdir(0777, "dir")
+        self.check_dir_listing(cow_dir, ["file1", "file2", "file3", "dir"])
+        os.unlink(os.path.join(write_path, "file2"))
+        self.check_dir_listing(cow_dir, ["file1", "file3", "dir"])
+
+    def test_cow_dir_delete_from_read_layer(self):
+        read_path = self.make_temp_dir()
+        write_path = self.make_temp_dir()
+        os.makedirs(os.path.join(read_path, "dir", "subdir"))
+        write_file(os.path.join(read_path, "dir", "file"), "")
+        write_file(os.path.join(read_path, "file"), "")
+        cow_dir = plash.namespace.make_cow_dir(
+            plash.env.get_dir_from_path(write_path),
+            plash.env.get_dir_from_path(read_path))
+
+        cow_dir.dir_unlink("file")
+        self.check_dir_listing(cow_dir, ["dir"])
+        self.assertRaises(marshal.UnmarshalError,
+                          lambda: cow_dir.dir_traverse("file"))
+        self.assertRaises(marshal.UnmarshalError,
+                          lambda: cow_dir.dir_rmdir("dir"))
+        subdir = cow_dir.dir_traverse("dir")
+        subdir.dir_unlink("file")
+        subdir.dir_rmdir("subdir")
+        cow_dir.dir_rmdir("dir")
+        self.check_dir_listing(cow_dir, [])
+        # The read layer is not modified.
+        self.assertEquals(sorted(os.listdir(read_path)), ["dir", "file"])
+
+        # A re-created directory does not show the read layer's contents.
+        cow_dir.dir_mkdir(0777, "dir")
+        self.check_dir_listing(cow_dir, ["dir"])
+        self.check_dir_listing(cow_dir.dir_traverse("dir"), [])
+        cow_dir.dir_create_file(os.O_WRONLY, 0666, "file")
+        self.check_dir_listing(cow_dir, ["dir", "file"])
+        # Names used for whiteouts are reserved.
+        self.assertRaises(marshal.UnmarshalError,
+                          lambda: cow_dir.dir_mkdir(0777, ".wh.foo"))
+
+    def make_deep_cow_dir(self):
+        read_path = self.make_temp_dir()
+        write_path = self.make_temp_dir()
+        os.makedirs(os.path.join(read_path, "a", "b", "c", "d1"))
+        os.makedirs(os.path.join(read_path, "a", "b", "c", "d2"))
+        os.chmod(os.path.join(read_path, "a", "b"), 0750)
+        cow_dir = plash.namespace.make_cow_dir(
+            plash.env.get_dir_from_path(write_path),
+            plash.env.get_dir_from_path(read_path))
+        return cow_dir, write_path
+
+    def traverse_path(self, dir, path):
+        for leaf in path.split("/"):
+            dir = dir.dir_traverse(leaf)
+        return dir
+
+    def test_cow_dir_realize_deep(self):
+        cow_dir, write_path = self.make_deep_cow_dir()
+        subdir = self.traverse_path(cow_dir, "a/b/c/d1")
+        subdir.dir_mkdir(0777, "new")
+        self.assertTrue(os.path.isdir(
+                os.path.join(write_path, "a", "b", "c", "d1", "new")))
+        # Permissions are copied from the read layer.
+        self.assertEquals(
+            os.stat(os.path.join(write_path, "a", "b")).st_mode & 0777, 0750)
+        self.assertEquals(os.listdir(os.path.join(write_path, "a", "b", "c")),
+                          ["d1"])
+
+    def test_cow_dir_realize_siblings(self):
+        # Both siblings are looked up before either is created in the
+        # write layer, so they share unrealized ancestors.
+        cow_dir, write_path = self.make_deep_cow_dir()
+        subdir1 = self.traverse_path(cow_dir, "a/b/c/d1")
+        subdir2 = self.traverse_path(cow_dir, "a/b/c/d2")
+        subdir1.dir_mkdir(0777, "x")
+        subdir2.dir_mkdir(0777, "y")
+        subdir1.dir_mkdir(0777, "z")
+        self.check_dir_listing(subdir1, ["x", "z"])
+        self.check_dir_listing(subdir2, ["y"])
+        self.check_dir_listing(self.traverse_path(cow_dir, "a/b/c"),
+                               ["d1", "d2"])
+        self.assertEquals(
+            sorted(os.listdir(os.path.join(write_path, "a", "b", "c"))),
+            ["d1", "d2"])
+
+    def test_cow_file_copy_up(self):
+        read_path = self.make_temp_dir()
+        write_path = self.make_temp_dir()
+        os.mkdir(os.path.join(read_path, "subdir"))
+        file_path = os.path.join(read_path, "subdir", "file")
+        write_file(file_path, "original")
+        os.chmod(file_path, 0640)
+        os.utime(file_path, (1000000, 2000000))
+        cow_dir = plash.namespace.make_cow_dir(
+            plash.env.get_dir_from_path(write_path),
+            plash.env.get_dir_from_path(read_path))
+        file_obj = cow_dir.dir_traverse("subdir").dir_traverse("file")
+        self.assertEquals(file_obj.fsobj_type(), plash.marshal.OBJT_FILE)
+
+        # Opening for reading does not copy the file.
+        fd = file_obj.file_open(os.O_RDONLY)
+        self.assertEquals(os.read(fd.fileno(), 100), "original")
+        self.assertEquals(os.listdir(write_path), [])
+
+        # Changing metadata copies the file, preserving its contents.
+        file_obj.fsobj_chmod(0600)
+        copy_path = os.path.join(write_path, "subdir", "file")
+        self.assertEquals(read_file(copy_path), "original")
+        self.assertEquals(os.stat(copy_path).st_mtime, 2000000)
+        self.assertEquals(os.stat(copy_path).st_mode & 0777, 0600)
+        self.assertEquals(os.stat(file_path).st_mode & 0777, 0640)
+
+        # Writes go to the copy, including writes through objects that
+        # were looked up before the copy was made.
+        file_obj2 = cow_dir.dir_traverse("subdir").dir_traverse("file")
+        fd = file_obj2.file_open(os.O_WRONLY | os.O_APPEND)
+        os.write(fd.fileno(), " changed")
+        self.assertEquals(read_file(copy_path), "original changed")
+        self.assertEquals(read_file(file_path), "original")
+        self.assertEquals(os.listdir(os.path.join(write_path, "subdir")),
+                          ["file"])
+
+    def test_cow_dir_cross_dir_rename(self):
+        cow_dir, write_path = self.make_deep_cow_dir()
+        subdir1 = self.traverse_path(cow_dir, "a/b/c/d1")
+        subdir2 = self.traverse_path(cow_dir, "a/b/c/d2")
+        subdir1.dir_create_file(os.O_WRONLY, 0666, "tmp")
+        # The destination directory is realized as needed.
+        subdir1.dir_rename("tmp", subdir2, "file")
+        self.check_dir_listing(subdir1, [])
+        self.check_dir_listing(subdir2, ["file"])
+        self.assertEquals(
+            os.listdir(os.path.join(write_path, "a", "b", "c", "d2")),
+            ["file"])
+        subdir2.dir_link("file", subdir1, "link")
+        self.check_dir_listing(subdir1, ["link"])
+
+    def test_cow_dir_rename_between_trees(self):
+        # Whiteouts written against one tree's read layer must not be
+        # carried into another tree, even one with the same write layer.
+        write = self.get_real_temp_dir()
+        cow_dir1 = plash.namespace.make_cow_dir(write,
+                                                self.get_real_temp_dir())
+        cow_dir2 = plash.namespace.make_cow_dir(write,
+                                                self.get_real_temp_dir())
+        cow_dir1.dir_mkdir(0777, "dir")
+        cow_dir1.dir_create_file(os.O_WRONLY, 0666, "file")
+        for method, leaf in (("dir_rename", "dir"), ("dir_link", "file")):
+            result = marshal.unpack(cow_dir1.cap_call(
+                    marshal.pack(method, leaf, cow_dir2, "dest")))
+            self.assertEquals(result, ("fail", (errno.EXDEV,)))
+        self.check_dir_listing(cow_dir1, ["dir", "file"])
+
+    def test_cow_dir_rename_copied_up(self):
+        read_path = self.make_temp_dir()
+        write_path = self.make_temp_dir()
+        write_file(os.path.join(read_path, "file"), "original")
+        os.mkdir(os.path.join(read_path, "dir"))
+        cow_dir = plash.namespace.make_cow_dir(
+            plash.env.get_dir_from_path(write_path),
+            plash.env.get_dir_from_path(read_path))
+        # A file that has not been copied up must be copied by the
+        # caller, as with a rename between filesystems.
+        self.assertRaises(marshal.UnmarshalError,
+                          lambda: cow_dir.dir_rename("file", cow_dir, "new"))
+        fd = cow_dir.dir_traverse("file").file_open(os.O_WRONLY | os.O_APPEND)
+        os.write(fd.fileno(), " changed")
+        del fd
+        # Once modified, the copy is moved and the original hidden.
+        cow_dir.dir_rename("file", cow_dir, "new")
+        self.check_dir_listing(cow_dir, ["dir", "new"])
+        self.assertEquals(read_file(os.path.join(write_path, "new")),
+                          "original changed")
+        self.assertEquals(read_file(os.path.join(read_path, "file")),
+                          "original")
+        # Directories get entries from the read layer, so they are not
+        # moved.
+        cow_dir.dir_traverse("dir").dir_mkdir(0777, "subdir")
+        self.assertRaises(marshal.UnmarshalError,
+                          lambda: cow_dir.dir_rename("dir", cow_dir, "dir2"))
+
+
+class TestNamespaceDir(unittest.TestCase):
+
+    def setUp(self):
+        self.dir_path = tempfile.mkdtemp(prefix="plash-test")
+        os.makedirs(os.path.join(self.dir_path, "a", "b", "c"))
+        write_file(os.path.join(self.dir_path, "a", "secret"), "")
+        write_file(os.path.join(self.dir_path, "a", "b", "file"), "")
+        self.real_root = plash.env.get_root_dir()
+
+    def tearDown(self):
+        shutil.rmtree(self.dir_path)
+
+    def resolve(self, dir, path):
+        for leaf in path.strip("/").split("/"):
+            dir = dir.dir_traverse(leaf)
+        return dir
+
+    def assert_same_inode(self, obj, path, same=True):
+        stat = obj.fsobj_stat()
+        st = os.stat(path)
+        self.assertEquals((stat["st_dev"], stat["st_ino"]) ==
+                          (st.st_dev, st.st_ino), same)
+
+    def test_nested_grants(self):
+        # The grant of "a/b" repeats what the grant of "a" provides,
+        # so "a" can be looked up directly in the real directory.
+        ns = plash.namespace.Namespace()
+        ns.resolve_populate(self.real_root, self.dir_path + "/a")
+        ns.resolve_populate(self.real_root, self.dir_path + "/a/b")
+        dir = self.resolve(ns.get_root_dir(), self.dir_path + "/a")
+        names = [item["name"] for item in dir.dir_list()]
+        names.sort()
+        self.assertEquals(names, ["b", "secret"])
+        self.assertEquals(self.resolve(dir, "b/file").fsobj_type(),
+                          plash.marshal.OBJT_FILE)
+        # "a" is the real directory rather than a fabricated one.
+        self.assert_same_inode(dir, os.path.join(self.dir_path, "a"))
+
+    def test_partial_grant_is_not_widened(self):
+        # Granting "a/b" alone must not expose the rest of "a", even
+        # though "a/b" is the real directory's entry.
+        ns = plash.namespace.Namespace()
+        ns.resolve_populate(self.real_root, self.dir_path + "/a/b")
+        ns.resolve_populate(self.real_root, self.dir_path + "/a/b/c")
+        dir = self.resolve(ns.get_root_dir(), self.dir_path + "/a")
+        self.assertEquals([item["name"] for item in dir.dir_list()], ["b"])
+        self.assertRaises(marshal.UnmarshalError,
+                          lambda: dir.dir_traverse("secret"))
+        self.assertEquals(self.resolve(dir, "b/file").fsobj_type(),
+                          plash.marshal.OBJT_FILE)
+        # "a" stays fabricated, while "b", whose grant of "c" repeats
+        # what it already provides, is the real directory.
+        self.assert_same_inode(dir, os.path.join(self.dir_path, "a"),
+                               same=False)
+        self.assert_same_inode(dir.dir_traverse("b"),
+                               os.path.join(self.dir_path, "a", "b"))
+
+    def test_rename_out_of_namespace_dir(self):
+        # "a/b" is not passed through because of the read-only grant
+        # inside it, but its own entries still belong to the real
+        # directory and can be moved out of it directly.
+        ns = plash.namespace.Namespace()
+        ns.resolve_populate(self.real_root, self.dir_path + "/a/b",
+                            flags=plash.namespace.FS_OBJECT_RW)
+        ns.resolve_populate(self.real_root, self.dir_path + "/a/b/c")
+        dir = self.resolve(ns.get_root_dir(), self.dir_path + "/a/b")
+        dest = self.resolve(self.real_root, self.dir_path + "/a")
+        dir.dir_rename("file", dest, "moved")
+        self.assertEquals(sorted(os.listdir(os.path.join(self.dir_path, "a"))),
+                          ["b", "moved", "secret"])
+        dest.dir_link("moved", dir, "file")
+        # The read-only grant cannot receive entries.
+        self.assertRaises(marshal.UnmarshalError,
+                          lambda: dir.dir_rename("file", dir.dir_traverse("c"),
+                                                 "file"))
+
+    def test_fabricated_identity(self):
+        ns1 = plash.namespace.Namespace()
+        ns1.resolve_populate(self.real_root, self.dir_path + "/a/b")
+        ns2 = plash.namespace.Namespace()
+        ns2.resolve_populate(self.real_root, self.dir_path + "/a/b")
+        root1 = ns1.get_root_dir()
+        root2 = ns2.get_root_dir()
+        # Fabricated directories keep their identity between lookups.
+        stat1 = self.resolve(root1, self.dir_path + "/a").fsobj_stat()
+        stat2 = self.resolve(root1, self.dir_path + "/a").fsobj_stat()
+        self.assertEquals((stat1["st_dev"], stat1["st_ino"]),
+                          (stat2["st_dev"], stat2["st_ino"]))
+        self.assertNotEquals(stat1["st_ino"], root1.fsobj_stat()["st_ino"])
+        # Namespaces do not share device numbers.
+        self.assertEquals(root1.fsobj_stat()["st_dev"], stat1["st_dev"])
+        self.assertNotEquals(root1.fsobj_stat()["st_dev"],
+                             root2.fsobj_stat()["st_dev"])
+
 
 if __name__ == "__main__":
     unittest.main()
@@ -17,11 +17,13 @@
 # Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301,
 # USA.
 
+import errno
 import struct
 import unittest
 
 import plash_core
 import plash.env
+import plash.marshal
 import plash.namespace
 
 
@@ -39,6 +41,35 @@ class FsOpTest(unittest.TestCase):
             assert isinstance(argv_index, int)
             assert isinstance(fd, plash_core.FD)
 
+    def get_stats(self, fs_op):
+        counts = {}
+        for line in fs_op.fsop_stats().split("\n"):
+            fields = line.split()
+            if len(fields) > 1 and "=" in fields[1]:
+                counts[fields[0]] = dict(field.split("=")
+                                         for field in fields[1:])
+        return counts
+
+    def test_stats(self):
+        fs_op = plash.namespace.make_fs_op(plash.env.get_root_dir())
+        before = self.get_stats(fs_op)
+        fs_op.fsop_log("message")
+        self.assertRaises(plash.marshal.UnmarshalError,
+                          lambda: fs_op.fsop_chdir("/does/not/exist"))
+        after = self.get_stats(fs_op)
+        def delta(op_name, key):
+            return (int(after[op_name].get(key, 0)) -
+                    int(before.get(op_name, {}).get(key, 0)))
+        self.assertEquals(delta("log", "ok"), 1)
+        self.assertEquals(delta("chdir", "fail"), 1)
+        self.assertEquals(delta("chdir", "e%i" % errno.ENOENT), 1)
+        # Each call is also counted in a latency histogram.
+        histograms = [line for line in fs_op.fsop_stats().split("\n")
+                      if line.startswith("log ok-us ")]
+        self.assertEquals(len(histograms), 1, histograms)
+        total = sum(int(count) for count in histograms[0].split()[2:])
+        self.assertEquals(total, int(after["log"]["ok"]))
+
 
 if __name__ == "__main__":
     unittest.main()
@@ -18,6 +18,7 @@
 # USA.
 
 import os
+import re
 import shutil
 import signal
 import subprocess
@@ -247,6 +248,21 @@ echo "this does not get used"
             check_subprocess_status(proc.wait())
             self.assertEquals(stdout, "args with spaces   ./script\n")
 
+    def test_script_rewritten(self):
+        # The server caches "#!" lines, so check that rewriting the
+        # script between two execs in one session takes effect.
+        write_file("script", "#!/bin/echo first\n")
+        proc = subprocess.Popen(
+            [self._pola_run, "-B", "-fw", ".", "-e", "sh", "-c",
+             "./script && "
+             "echo '#!/bin/echo second-interpreter' >script && "
+             "./script"],
+            stdout=subprocess.PIPE)
+        stdout, stderr = proc.communicate()
+        check_subprocess_status(proc.wait())
+        self.assertEquals(stdout, "first ./script\n"
+                          "second-interpreter ./script\n")
+
     def test_getuid(self):
         # TODO: use "-B" instead of "-fw /".  See PlashIssues/Lib64Directory.
         expect = "%i\n" % os.getuid()
@@ -319,6 +335,22 @@ class PolaRunCTests(PolaRunTestsMixin, TestCaseChdir):
     def _return_code_for_signal(self, signal):
         return -signal
 
+    def test_trace_signal(self):
+        # The first SIGUSR2 switches the server's tracer on and the
+        # second prints the counts, which should include the requests
+        # made by the "ls" in between.
+        proc = subprocess.Popen(
+            [self._pola_run, "--server-as-parent", "-B", "-e", "sh", "-c",
+             "kill -USR2 $PPID && ls / >/dev/null && "
+             "kill -USR2 $PPID && ls / >/dev/null"],
+            stderr=subprocess.PIPE)
+        stdout, stderr = proc.communicate()
+        check_subprocess_status(proc.wait())
+        self.assertTrue("cap-protocol trace (on)" in stderr, stderr)
+        match = re.search(r"`to-client' .*in: (\d+) msgs", stderr)
+        self.assertTrue(match is not None, stderr)
+        self.assertTrue(int(match.group(1)) > 0, stderr)
+
 
 class PolaRunPythonTests(PolaRunTestsMixin, TestCaseChdir):
 
@@ -266,6 +266,17 @@ int main()
         self.fail("No match found for %r in calls: %r" %
                   (method_name, self._method_calls))
 
+    def assertExecCalled(self, filename, argv):
+        # libc asks the server to preload libraries when it can, and
+        # only falls back to fsop_exec for older servers.
+        for method_name, args in self._method_calls:
+            if ((method_name == "fsop_exec" and args == (filename, argv)) or
+                (method_name == "fsop_exec_preload" and
+                 self._args_match((filename, Wildcard(), argv), args))):
+                return
+        self.fail("No exec of %r found in calls: %r" %
+                  (filename, self._method_calls))
+
     def assertNotCalled(self, method_name):
         for method, args in self._method_calls:
             if method == method_name:
@@ -791,7 +802,7 @@ void test_system()
 """
     def check(self):
         self.assertCalled("fsop_copy")
-        self.assertCalled("fsop_exec", "/bin/sh", ["sh", "-c", "exit 123"])
+        self.assertExecCalled("/bin/sh", ["sh", "-c", "exit 123"])
 
     # Don't expect system() to be replaced properly in the preload library,
     # so disable this test.
@@ -810,8 +821,8 @@ void test_exec()
 }
 """
     def check(self):
-        self.assertCalled("fsop_exec", "/bin/true",
-                          ["zeroth arg", "first arg", "second arg"])
+        self.assertExecCalled("/bin/true",
+                              ["zeroth arg", "first arg", "second arg"])
 
 
 class TestExecNotFound(LibcTest):
@@ -834,10 +845,48 @@ void test_exec_not_found()
 }
 """
     def check(self):
-        self.assertCalled("fsop_exec", "/does-not-exist-1",
-                          ["foo", "bar", "baz"])
-        self.assertCalled("fsop_exec", "/does-not-exist-2",
-                          ["qux", "quux", "quuux"])
+        self.assertExecCalled("/does-not-exist-1", ["foo", "bar", "baz"])
+        self.assertExecCalled("/does-not-exist-2", ["qux", "quux", "quuux"])
+
+
+class TestExecPreload(LibcTest):
+    # The libraries that the server opens for ld.so must not leak into
+    # the program, or into programs that it runs in turn.
+    entry = "test_exec_preload"
+    code = r"""
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+void test_exec_preload()
+{
+  if(!getenv("TEST_EXEC_PRELOAD_CHILD")) {
+    char *const argv[] = { program_invocation_name, NULL };
+    t_check_zero(setenv("TEST_EXEC_PRELOAD_CHILD", "1", 1));
+    t_check_zero(execv(program_invocation_name, argv));
+  }
+  else {
+    int fd;
+    assert(getenv("PLASH_PRELOADED_LIBS") == NULL);
+    /* Only check FDs for regular files, because pipes and sockets
+       are used for other purposes. */
+    if(getenv("PLASH_COMM_FD")) {
+      for(fd = 3; fd < 1024; fd++) {
+        int flags = fcntl(fd, F_GETFD);
+        struct stat st;
+        if(flags >= 0 && !(flags & FD_CLOEXEC)) {
+          t_check_zero(fstat(fd, &st));
+          assert(!S_ISREG(st.st_mode));
+        }
+      }
+    }
+  }
+}
+"""
+    def check(self):
+        self.assertCalledPattern("fsop_exec_preload", self._executable,
+                                 Wildcard(), [self._executable])
 
 
 class TestBind(LibcTest):
@@ -0,0 +1,314 @@
+# Copyright (C) 2008 Mark Seaborn
+#
+# This file is part of Plash.
+#
+# Plash is free software; you can redistribute it and/or modify it
+# under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation; either version 2.1 of
+# the License, or (at your option) any later version.
+#
+# Plash is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with Plash; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301,
+# USA.
+
+"""
+Usage: python macro-benchmark.py [options] [workload...]
+
+Runs some whole-program workloads natively and under pola-run, and
+reports how much slower they are under pola-run.  All the data is
+generated locally, so this does not need network access.
+
+For each workload it prints the native and sandboxed times in seconds
+(the best of several runs), the slowdown ratio, the number of requests
+the sandboxed program made to the file server (counted from a
+--log-binary-file log), and, if strace is installed, the number of
+system calls the program made when run natively.
+
+Workloads: build, find, ls, tar, python
+
+Options:
+  -r, --repeat N     run each workload N times and take the best (default 3)
+  -j, --jobs N       parallel jobs for the build workload (default 4)
+  --files N          number of files in the tree for find/ls (default 200000)
+  --no-counts        skip counting RPCs and system calls
+  --keep DIR         generate the data in DIR and leave it there
+
+Run from the top of the source tree with:
+  ./run-uninstalled.sh sh -c "cd tests && python macro-benchmark.py"
+"""
+
+import getopt
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+import plash.binlog
+
+
+def write_file(filename, data):
+    fh = open(filename, "w")
+    try:
+        fh.write(data)
+    finally:
+        fh.close()
+
+
+def make_file_tree(path, file_count, per_dir=100):
+    """Creates file_count empty files, per_dir to a directory, in a
+    two-level directory tree."""
+    os.mkdir(path)
+    dir_count = (file_count + per_dir - 1) / per_dir
+    created = 0
+    for i in range(dir_count):
+        dir_path = os.path.join(path, "d%i" % (i / per_dir), "d%i" % i)
+        if not os.path.exists(os.path.dirname(dir_path)):
+            os.mkdir(os.path.dirname(dir_path))
+        os.mkdir(dir_path)
+        for j in range(min(per_dir, file_count - created)):
+            write_file(os.path.join(dir_path, "f%i" % j), "")
+            created += 1
+
+
+class Workload(object):
+
+    # Workloads that write to their directory give a setup command to
+    # run before each run to get back to the starting state.
+    reset_cmd = None
+
+    def prepare(self, data_dir):
+        raise NotImplementedError()
+
+
+class BuildWorkload(Workload):
+
+    name = "build"
+    source_files = 200
+
+    def __init__(self, options):
+        self.jobs = options["jobs"]
+
+    def prepare(self, data_dir):
+        self.dir = os.path.join(data_dir, "build")
+        os.mkdir(self.dir)
+        objs = []
+        for i in range(self.source_files):
+            write_file(os.path.join(self.dir, "mod%i.h" % i),
+                       "int mod%i_func(int x);\n" % i)
+            write_file(os.path.join(self.dir, "mod%i.c" % i),
+                       '#include <stdio.h>\n#include <string.h>\n'
+                       '#include "mod%i.h"\n'
+                       'int mod%i_func(int x) { return x * %i; }\n'
+                       % (i, i, i))
+            objs.append("mod%i.o" % i)
+        write_file(os.path.join(self.dir, "main.c"),
+                   "int main() { return 0; }\n")
+        write_file(os.path.join(self.dir, "Makefile"),
+                   "OBJS = main.o %s\n"
+                   "prog: $(OBJS)\n\tgcc $(OBJS) -o prog\n"
+                   "%%.o: %%.c\n\tgcc -O -c $< -o $@\n"
+                   "clean:\n\trm -f prog $(OBJS)\n" % " ".join(objs))
+        self.cmd = ["make", "-s", "-j%i" % self.jobs]
+        self.reset_cmd = ["make", "-s", "clean"]
+
+
+class FindWorkload(Workload):
+
+    name = "find"
+
+    def __init__(self, options):
+        self.file_count = options["files"]
+
+    def prepare(self, data_dir):
+        self.dir = os.path.join(data_dir, "tree")
+        if not os.path.exists(self.dir):
+            make_file_tree(self.dir, self.file_count)
+        self.cmd = ["find", ".", "-type", "f"]
+
+
+class LsWorkload(FindWorkload):
+
+    name = "ls"
+
+    def prepare(self, data_dir):
+        FindWorkload.prepare(self, data_dir)
+        self.cmd = ["ls", "-lR"]
+
+
+class TarWorkload(Workload):
+
+    name = "tar"
+    file_count = 10000
+
+    def __init__(self, options):
+        pass
+
+    def prepare(self, data_dir):
+        self.dir = os.path.join(data_dir, "tar")
+        os.mkdir(self.dir)
+        make_file_tree(os.path.join(self.dir, "src"), self.file_count)
+        rc = subprocess.call(["tar", "-cf", "src.tar", "src"], cwd=self.dir)
+        assert rc == 0
+        shutil.rmtree(os.path.join(self.dir, "src"))
+        self.cmd = ["tar", "-xf", "src.tar"]
+        self.reset_cmd = ["rm", "-rf", "src"]
+
+
+class PythonWorkload(Workload):
+
+    name = "python"
+    modules = ["email", "email.mime.text", "xml.dom.minidom", "urllib2",
+               "httplib", "logging", "optparse", "tarfile", "zipfile",
+               "decimal", "difflib", "inspect", "pydoc", "unittest"]
+
+    def __init__(self, options):
+        pass
+
+    def prepare(self, data_dir):
+        self.dir = os.path.join(data_dir, "python")
+        os.mkdir(self.dir)
+        self.cmd = [sys.executable, "-c",
+                    "import %s" % ", ".join(self.modules)]
+
+
+workload_classes = [BuildWorkload, FindWorkload, LsWorkload, TarWorkload,
+                    PythonWorkload]
+
+
+def pola_run_cmd(workload, extra_args=[]):
+    # The typical grants: the system directories, plus read/write
+    # access to the workload's own directory.
+    return (["pola-run", "-B", "-fw", workload.dir, "--cwd", workload.dir,
+             "-f", sys.executable] + extra_args +
+            ["-e"] + workload.cmd)
+
+
+def run_timed(workload, cmd):
+    if workload.reset_cmd is not None:
+        subprocess.check_call(workload.reset_cmd, cwd=workload.dir)
+    devnull = open(os.devnull, "w")
+    try:
+        start = time.time()
+        rc = subprocess.call(cmd, cwd=workload.dir, stdout=devnull)
+        taken = time.time() - start
+    finally:
+        devnull.close()
+    if rc != 0:
+        raise Exception("Command failed with status %i: %s" % (rc, cmd))
+    return taken
+
+
+def best_time(workload, cmd, repeat):
+    return min(run_timed(workload, cmd) for i in range(repeat))
+
+
+def count_rpcs(workload, tmp_dir):
+    log_file = os.path.join(tmp_dir, "%s.log" % workload.name)
+    run_timed(workload, pola_run_cmd(workload,
+                                     ["--log-binary-file", log_file]))
+    fh = open(log_file, "rb")
+    try:
+        data = fh.read()
+    finally:
+        fh.close()
+    os.unlink(log_file)
+    return len([rec for rec in plash.binlog.read_records(data)
+                if rec["type"] == plash.binlog.LOG_OP])
+
+
+def have_strace():
+    devnull = open(os.devnull, "w")
+    try:
+        try:
+            return subprocess.call(["strace", "-V"], stdout=devnull,
+                                   stderr=devnull) == 0
+        except OSError:
+            return False
+    finally:
+        devnull.close()
+
+
+def count_syscalls(workload, tmp_dir):
+    out_file = os.path.join(tmp_dir, "%s.strace" % workload.name)
+    run_timed(workload, ["strace", "-f", "-c", "-o", out_file] + workload.cmd)
+    fh = open(out_file, "r")
+    try:
+        lines = fh.readlines()
+    finally:
+        fh.close()
+    os.unlink(out_file)
+    # The last line of the summary is the total: its fourth column
+    # is the number of calls.
+    for line in reversed(lines):
+        fields = line.split()
+        if len(fields) >= 4 and fields[-1] == "total":
+            return int(fields[3])
+    return None
+
+
+def main(args):
+    options = {"repeat": 3, "jobs": 4, "files": 200000,
+               "counts": True, "keep": None}
+    try:
+        opts, args = getopt.gnu_getopt(
+            args, "r:j:", ["repeat=", "jobs=", "files=", "no-counts",
+                           "keep="])
+    except getopt.GetoptError, exn:
+        print >>sys.stderr, exn
+        print >>sys.stderr, __doc__
+        return 2
+    for opt, value in opts:
+        if opt in ("-r", "--repeat"):
+            options["repeat"] = int(value)
+        elif opt in ("-j", "--jobs"):
+            options["jobs"] = int(value)
+        elif opt == "--files":
+            options["files"] = int(value)
+        elif opt == "--no-counts":
+            options["counts"] = False
+        elif opt == "--keep":
+            options["keep"] = value
+    workloads = [cls(options) for cls in workload_classes
+                 if len(args) == 0 or cls.name in args]
+
+    if options["keep"] is not None:
+        data_dir = options["keep"]
+        if os.path.exists(data_dir):
+            print >>sys.stderr, "%s already exists" % data_dir
+            return 1
+        os.mkdir(data_dir)
+    else:
+        data_dir = tempfile.mkdtemp(prefix="plash-macro-bench")
+    strace = options["counts"] and have_strace()
+    print "# workload\tnative/s\tpola-run/s\tslowdown\trpcs\tsyscalls"
+    try:
+        for workload in workloads:
+            workload.prepare(data_dir)
+            native = best_time(workload, workload.cmd, options["repeat"])
+            sandboxed = best_time(workload, pola_run_cmd(workload),
+                                  options["repeat"])
+            rpcs = syscalls = "-"
+            if options["counts"]:
+                rpcs = count_rpcs(workload, data_dir)
+                if strace:
+                    syscalls = count_syscalls(workload, data_dir)
+            print "%s\t%.3f\t%.3f\t%.2f\t%s\t%s" % (
+                workload.name, native, sandboxed, sandboxed / native,
+                rpcs, syscalls)
+            sys.stdout.flush()
+    finally:
+        if options["keep"] is None:
+            shutil.rmtree(data_dir)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))